@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <X11/Xlib.h>
+#include <X11/extensions/Xrender.h>
 #define DEBUG
 #include "common/conventions.h"
 #include "common/safemem.h"
@@ -31,425 +32,173 @@
 
 #include "charcache.h"
 
-#define LEFT(a)	((a)->treevars.left)
-#define RIGHT(a)	((a)->treevars.right)
-#define BALANCE(a)	((a)->treevars.balance)
-
-static inline int cmp(struct one_charcache *a, struct one_charcache *b) {
-return _FASTCMP(a->value,b->value);
-}
-
-static void rebalanceleftleft(struct one_charcache **root_inout) {
-struct one_charcache *a=*root_inout;
-struct one_charcache *left=LEFT(a);
-LEFT(a)=RIGHT(left);
-RIGHT(left)=a;
-*root_inout=left;
-BALANCE(left)=0;
-BALANCE(a)=0;
-}
-
-static void rebalancerightright(struct one_charcache **root_inout) {
-struct one_charcache *a=*root_inout;
-struct one_charcache *right=RIGHT(a);
-RIGHT(a)=LEFT(right);
-LEFT(right)=a;
-*root_inout=right;
-BALANCE(right)=0;
-BALANCE(a)=0;
-}
-
-static void rebalanceleftright(struct one_charcache **root_inout) {
-struct one_charcache *a=*root_inout;
-struct one_charcache *left=LEFT(a);
-struct one_charcache *gchild=RIGHT(left);
-int b;
-RIGHT(left)=LEFT(gchild);
-LEFT(gchild)=left;
-LEFT(a)=RIGHT(gchild);
-RIGHT(gchild)=a;
-*root_inout=gchild;
-b=BALANCE(gchild);
-if (b>0) {
-		BALANCE(a)=-1;
-		BALANCE(left)=0;
-} else if (!b) {
-		BALANCE(a)=BALANCE(left)=0;
-} else {
-		BALANCE(a)=0;
-		BALANCE(left)=1;
-}
-BALANCE(gchild)=0;
-}
-
-static void rebalancerightleft(struct one_charcache **root_inout) {
-struct one_charcache *a=*root_inout;
-struct one_charcache *right=RIGHT(a);
-struct one_charcache *gchild=LEFT(right);
-int b;
-LEFT(right)=RIGHT(gchild);
-RIGHT(gchild)=right;
-RIGHT(a)=LEFT(gchild);
-LEFT(gchild)=a;
-*root_inout=gchild;
-b=BALANCE(gchild);
-if (b<0) {
-		BALANCE(a)=1;
-		BALANCE(right)=0;
-} else if (!b) {
-		BALANCE(a)=BALANCE(right)=0;
-} else {
-		BALANCE(a)=0;
-		BALANCE(right)=-1;
-}
-BALANCE(gchild)=0;
+static inline unsigned int hashvalue(struct charcache *cc, uint32_t value) {
+// fibonacci hashing, values differ mostly in low bits and color bits
+return (value*2654435761U)>>cc->hash.shift;
 }
 
-static void rebalanceleftbalance(struct one_charcache **root_inout) {
-struct one_charcache *a=*root_inout;
-struct one_charcache *left=LEFT(a);
-LEFT(a)=RIGHT(left);
-RIGHT(left)=a;
-*root_inout=left;
-BALANCE(left)=-1;
-/* redundant */
-// BALANCE(a)=1;
+static inline struct one_charcache *findnode(struct charcache *cc, uint32_t value) {
+struct one_charcache **slots=cc->hash.slots,*occ;
+unsigned int h;
+h=hashvalue(cc,value);
+while ((occ=slots[h])) {
+	if (occ->value==value) return occ;
+	h=(h+1)&cc->hash.mask;
 }
-
-static void rebalancerightbalance(struct one_charcache **root_inout) {
-struct one_charcache *a=*root_inout;
-struct one_charcache *right=RIGHT(a);
-RIGHT(a)=LEFT(right);
-LEFT(right)=a;
-*root_inout=right;
-BALANCE(right)=1;
-/* redundant */
-// BALANCE(a)=-1;
+return NULL;
 }
 
-static int extracthighest(struct one_charcache **root_inout, struct one_charcache **node_out) {
-/* returns 1 if depth decreased, else 0 */
-struct one_charcache *root=*root_inout;
-
-if (RIGHT(root)) {
-	int r=0;
-	if (extracthighest(&RIGHT(root),node_out)) {
-		int b;
-		b=BALANCE(root);
-		if (b<0) {
-			BALANCE(root)=0; r=1;
-		} else if (!b) {
-			BALANCE(root)=1;
-		} else {
-				if (!BALANCE(LEFT(root))) {
-					(void)rebalanceleftbalance(root_inout); 
-				} else if (BALANCE(LEFT(root))==1) {
-					(void)rebalanceleftleft(root_inout); 
-					r=1;
-				} else {
-					(void)rebalanceleftright(root_inout);
-					r=1;
-				}
-		}
-	}
-	return r;
-} else {
-	/* remove ourselves */
-	*node_out=root;
-	*root_inout=LEFT(root);		
-	return 1;
-}
+static inline void addnode(struct charcache *cc, struct one_charcache *occ) {
+struct one_charcache **slots=cc->hash.slots;
+unsigned int h;
+h=hashvalue(cc,occ->value);
+while (slots[h]) h=(h+1)&cc->hash.mask;
+slots[h]=occ;
+occ->slot=h;
 }
 
-static int extractlowest(struct one_charcache **root_inout, struct one_charcache **node_out) {
-/* returns 1 if depth decreased, else 0 */
-struct one_charcache *root=*root_inout;
-
-if (LEFT(root)) {
-	int r=0;
-	if (extractlowest(&LEFT(root),node_out)) {
-		int b;
-		b=BALANCE(root);
-		if (b>0) {
-			BALANCE(root)=0; r=1;
-		} else if (!b) {
-			BALANCE(root)=-1;
-		} else {
-				if (!BALANCE(RIGHT(root))) {
-					(void)rebalancerightbalance(root_inout);
-				} else if (BALANCE(RIGHT((root)))==-1) {
-					(void)rebalancerightright(root_inout);
-					r=1;
-				} else {
-					(void)rebalancerightleft(root_inout);
-					r=1;
-				}
-		}
-	}
-	return r;
-} else {
-	/* remove ourselves */
-	*node_out=root;
-	*root_inout=RIGHT(root);
-	return 1;
-}
+static void rmnode(struct charcache *cc, struct one_charcache *occ) {
+// backward shift deletion, so there are no tombstones
+struct one_charcache **slots=cc->hash.slots;
+unsigned int mask=cc->hash.mask;
+unsigned int i,j;
+i=occ->slot;
+slots[i]=NULL;
+j=i;
+while (1) {
+	struct one_charcache *n;
+	unsigned int k;
+	j=(j+1)&mask;
+	if (!(n=slots[j])) break;
+	k=hashvalue(cc,n->value);
+	if (((j-k)&mask) < ((j-i)&mask)) continue; // n's home is between i and j
+	slots[i]=n;
+	n->slot=i;
+	slots[j]=NULL;
+	i=j;
 }
-
-
-static int rmnode(struct one_charcache **root_inout, struct one_charcache *node) {
-/* returns 1 if depth decreased, else 0 */
-struct one_charcache *root=*root_inout;
-int r=0;
-int c;
-
-if (!root) { D2WHEREAMI; return 0; } /* if the node doesn't exist in the tree */
-
-c=cmp(node,root);
-if (c<0) {
-	if (rmnode(&LEFT(root),node)) {
-		int b;
-		b=BALANCE(root);
-		if (b>0) {
-				BALANCE(root)=0;
-				r=1;
-		} else if (!b) {
-				BALANCE(root)=-1;
-		} else {
-				if (!BALANCE(RIGHT(root))) {
-					(void)rebalancerightbalance(root_inout);
-				} else if (BALANCE(RIGHT(root))<0) {
-					(void)rebalancerightright(root_inout);
-					r=1;
-				} else {
-					(void)rebalancerightleft(root_inout);
-					r=1;
-				}
-		}
-	}
-} else if (c>0) {
-	if (rmnode(&RIGHT(root),node)) {
-		int b;
-		b=BALANCE(root);
-		if (b<0) {
-				BALANCE(root)=0;
-				r=1;
-		} else if (!b) {
-				BALANCE(root)=1;
-		} else {
-				if (!BALANCE(LEFT(root))) {
-					(void)rebalanceleftbalance(root_inout);
-				} else if (BALANCE(LEFT(root))>0) {
-					(void)rebalanceleftleft(root_inout);
-					r=1;
-				} else {
-					(void)rebalanceleftright(root_inout);
-					r=1;
-				}
-		}
-	}
-} else {
-	/* found it */
-	struct one_charcache *temp;
-	if (BALANCE(root)==1) {
-		if (extracthighest(&LEFT(root),&temp)) {
-			BALANCE(temp)=0;
-			r=1;
-		} else {
-			BALANCE(temp)=1;
-		}
-		LEFT(temp)=LEFT(root);
-		RIGHT(temp)=RIGHT(root);
-		*root_inout=temp;
-	} else if (BALANCE(root)==-1) {
-		if (extractlowest(&RIGHT(root),&temp)) {
-			BALANCE(temp)=0;
-			r=1;
-		} else {
-			BALANCE(temp)=-1;
-		}
-		LEFT(temp)=LEFT(root);
-		RIGHT(temp)=RIGHT(root);
-		*root_inout=temp;
-	} else { /* balance 0 */
-		if (LEFT(root)) {
-			if (extracthighest(&LEFT(root),&temp)) {
-				BALANCE(temp)=-1;
-			} else {
-				BALANCE(temp)=0;
-			}
-			LEFT(temp)=LEFT(root);
-			RIGHT(temp)=RIGHT(root);
-			*root_inout=temp;
-		} else {
-			*root_inout=NULL;
-			r=1;
-		}
-	}
 }
 
-return r;
+static struct one_charcache *evict(struct charcache *cc) {
+// CLOCK: skip (and clear) recently used entries
+struct one_charcache *occ;
+while (1) {
+	occ=cc->list+cc->clockhand;
+	cc->clockhand+=1;
+	if (cc->clockhand==cc->count) cc->clockhand=0;
+	if (!occ->isreferenced) break;
+	occ->isreferenced=0;
+}
+(void)rmnode(cc,occ);
+cc->stats.evictions+=1;
+return occ;
 }
 
-static int addnode(struct one_charcache **root_inout, struct one_charcache *node) {
-/* returns 1 if depth increased, else 0 */
-struct one_charcache *root=*root_inout;
-int r=0;
-
-if (!root) {
-	*root_inout=node;
-	return 1;
-}
+#define MAXPIXELS_ATLAS	32767
+static int makeatlas(struct charcache *cc, unsigned int width, unsigned int height) {
+// one pixmap for every slot, roughly square
+struct x11info *x=cc->x;
+struct one_charcache *occ;
+unsigned int ui,perrow,rows;
 
-if (cmp((node),(root))<0) {
-	if (addnode(&LEFT(root),node)) {
-		int b;
-		b=BALANCE(root);
-		if (!b) {
-			BALANCE(root)=1; r=1;
-		} else if (b>0) {
-				if (BALANCE(LEFT(root))>0) (void)rebalanceleftleft(root_inout); else (void)rebalanceleftright(root_inout);
-		} else {
-			BALANCE(root)=0;
-		}
-	}
-} else {
-	if (addnode(&RIGHT(root),node)) {
-		int b;
-		b=BALANCE(root);
-		if (!b) {
-			BALANCE(root)=-1; r=1;
-		} else if (b>0) {
-			BALANCE(root)=0;
-		} else {
-				if (BALANCE(RIGHT(root))<0) (void)rebalancerightright(root_inout); else (void)rebalancerightleft(root_inout);
-		}
-	}
-}
+perrow=1;
+while (perrow*perrow<cc->count) perrow++;
+if (perrow*width>MAXPIXELS_ATLAS) perrow=MAXPIXELS_ATLAS/width;
+rows=(cc->count+perrow-1)/perrow;
+if (rows*height>MAXPIXELS_ATLAS) GOTOERROR;
 
-return r;
+if (cc->picture) { (ignore)XRenderFreePicture(x->display,cc->picture); cc->picture=0; }
+if (cc->atlas) (ignore)XFreePixmap(x->display,cc->atlas);
+if (!(cc->atlas=XCreatePixmap(x->display,x->window,perrow*width,rows*height,cc->depth))) GOTOERROR;
+if (cc->format) {
+	if (!(cc->picture=XRenderCreatePicture(x->display,cc->atlas,cc->format,0,NULL))) GOTOERROR;
 }
-
-static inline struct one_charcache *findnode(struct one_charcache *root, uint32_t value) {
-while (root) {
-	if (value<root->value) {
-		root=LEFT(root);
-	} else if (value>root->value) {
-		root=RIGHT(root);
-	} else {
-		return root;
-	}
+cc->slotsperrow=perrow;
+occ=cc->list;
+for (ui=0;ui<cc->count;ui++) {
+	occ->x=(ui%perrow)*width;
+	occ->y=(ui/perrow)*height;
+	occ++;
 }
-return NULL;
+return 0;
+error:
+	return -1;
 }
 
 SICLEARFUNC(one_charcache);
-int init_charcache(struct charcache *cc, struct x11info *x, unsigned int count, unsigned int width, unsigned int height) {
-struct one_charcache *occ,*list=NULL;
+int init_charcache(struct charcache *cc, struct x11info *x, unsigned int count, unsigned int width, unsigned int height,
+		XRenderPictFormat *format) {
+// format is optional, it's needed to composite into or out of the atlas
+struct one_charcache *list=NULL;
+unsigned int ui,size,bits;
 cc->x=x;
+cc->format=format;
+cc->depth=(format)?format->depth:x->depth;
+if (!count) count=1;
 if (!(list=MALLOC(count*sizeof(struct one_charcache)))) GOTOERROR;
 cc->config.width=width;
 cc->config.height=height;
 cc->list=list;
-occ=list;
-while (count) {
-	clear_one_charcache(occ);
-	if (!(occ->pixmap=XCreatePixmap(x->display,x->window,width,height,x->depth))) GOTOERROR;
-	occ->next=cc->freepool.first;
-	cc->freepool.first=occ;
-	cc->count+=1;
-	occ+=1;
-	count--;
-}
+cc->count=count;
+for (ui=0;ui<count;ui++) clear_one_charcache(list+ui);
+bits=1;
+size=2;
+while (size<2*count) { size<<=1; bits++; } // load factor <= .5
+if (!(cc->hash.slots=ZTMALLOC(size,struct one_charcache*))) GOTOERROR;
+cc->hash.mask=size-1;
+cc->hash.shift=32-bits;
+if (makeatlas(cc,width,height)) GOTOERROR;
 return 0;
 error:
 	return -1;
 }
 
 void deinit_charcache(struct charcache *cc) {
-struct x11info *x=cc->x;
-struct one_charcache *list,*occ;
-unsigned int count;
-list=cc->list;
-if (!list) return;
-count=cc->count;
-occ=list;
-while (count) {
-	(ignore)XFreePixmap(x->display,occ->pixmap);
-	count--;
-	occ+=1;
+IFFREE(cc->hash.slots);
+IFFREE(cc->list);
+if (cc->picture) (ignore)XRenderFreePicture(cc->x->display,cc->picture);
+if (cc->atlas) (ignore)XFreePixmap(cc->x->display,cc->atlas);
 }
 
-FREE(list);
-}
-
-Pixmap find_charcache(struct charcache *cc, uint32_t value) {
+struct one_charcache *find_charcache(struct charcache *cc, uint32_t value) {
 struct one_charcache *occ;
-occ=findnode(cc->active.treetop,value);
-if (!occ) return 0;
-return occ->pixmap;
+occ=findnode(cc,value);
+if (!occ) {
+	cc->stats.misses+=1;
+	return NULL;
+}
+cc->stats.hits+=1;
+occ->isreferenced=1;
+return occ;
 }
 
 struct one_charcache *add_charcache(struct charcache *cc, uint32_t value) {
 struct one_charcache *occ;
 
-occ=cc->freepool.first;
-if (occ) {
-	cc->freepool.first=occ->next;
+if (cc->used<cc->count) {
+	occ=cc->list+cc->used;
+	cc->used+=1;
 } else {
-	occ=cc->active.first;
-	cc->active.first=occ->next;
-	(ignore)rmnode(&cc->active.treetop,occ);
+	occ=evict(cc);
 }
 
 occ->value=value;
-occ->treevars.balance=0;
-occ->treevars.left=occ->treevars.right=NULL;
-occ->next=NULL;
-
-(void)addnode(&cc->active.treetop,occ);
-
-if (!cc->active.first) {
-	cc->active.first=cc->active.last=occ;
-} else {
-	cc->active.last->next=occ;
-	cc->active.last=occ;
-}
-
+occ->isreferenced=1;
+(void)addnode(cc,occ);
 return occ;
 }
 
 void reset_charcache(struct charcache *cc) {
-struct one_charcache *one;
-
-one=cc->active.first;
-while (one) {
-	struct one_charcache *next;
-	next=one->next;
-	one->next=cc->freepool.first;
-	cc->freepool.first=one;
-	one=next;
-}
-
-cc->active.last=cc->active.first=cc->active.treetop=NULL;
+memset(cc->hash.slots,0,(cc->hash.mask+1)*sizeof(struct one_charcache*));
+cc->used=0;
+cc->clockhand=0;
 }
 
 int resize_charcache(struct charcache *cc, unsigned int width, unsigned int height) {
-struct x11info *x=cc->x;
-struct one_charcache *occ;
-unsigned int count;
-
-if ((width<=cc->config.width)&&(height<=cc->config.height)) return 0;
+// slots are placed by the current size, so any change needs a new atlas
+if ((width==cc->config.width)&&(height==cc->config.height)) return 0;
 (void)reset_charcache(cc);
-
-count=cc->count;
-occ=cc->list;
-while (1) {
-	(ignore)XFreePixmap(x->display,occ->pixmap);
-	if (!(occ->pixmap=XCreatePixmap(x->display,x->window,width,height,x->depth))) GOTOERROR;
-	count--;
-	if (!count) break;
-	occ+=1;
-}
+if (makeatlas(cc,width,height)) GOTOERROR;
 cc->config.width=width;
 cc->config.height=height;
 return 0;
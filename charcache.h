@@ -19,13 +19,10 @@
 
 struct one_charcache {
 	uint32_t value;
-	struct {
-		signed char balance;
-		struct one_charcache *left,*right;
-	} treevars;
-	struct one_charcache *next;
+	unsigned int isreferenced:1; // CLOCK bit, set on each hit
+	unsigned int slot; // index in hash.slots
 
-	Pixmap pixmap;
+	unsigned int x,y; // location in .atlas
 };
 
 struct charcache {
@@ -33,20 +30,28 @@ struct charcache {
 	struct {
 		unsigned int width,height;
 	} config;
+	unsigned int depth;
+	XRenderPictFormat *format; // NULL if there's no RENDER
+	Pixmap atlas; // all cells, each entry has a fixed slot
+	Picture picture; // of atlas, 0 without .format
+	unsigned int slotsperrow;
 	struct {
-		struct one_charcache *treetop;
-		struct one_charcache *first,*last;
-	} active;
+		struct one_charcache **slots; // open addressing, linear probing
+		unsigned int mask,shift;
+	} hash;
+	unsigned int used; // list[0..used) are active
+	unsigned int clockhand;
 	struct {
-		struct one_charcache *first;
-	} freepool;
+		uint64_t hits,misses,evictions;
+	} stats;
 	unsigned int count;
 	struct one_charcache *list;
 };
 
-int init_charcache(struct charcache *cc, struct x11info *x, unsigned int count, unsigned int width, unsigned int height);
+int init_charcache(struct charcache *cc, struct x11info *x, unsigned int count, unsigned int width, unsigned int height,
+		XRenderPictFormat *format);
 void deinit_charcache(struct charcache *cc);
-Pixmap find_charcache(struct charcache *cc, uint32_t value);
+struct one_charcache *find_charcache(struct charcache *cc, uint32_t value);
 struct one_charcache *add_charcache(struct charcache *cc, uint32_t value);
 void reset_charcache(struct charcache *cc);
 int resize_charcache(struct charcache *cc, unsigned int width, unsigned int height);
@@ -46,6 +46,17 @@ error:
 	return -1;
 }
 
+void reset_blockmem(struct blockmem *blockmem) {
+// forgets every allocation but keeps the memory for reuse
+struct node_blockmem *node;
+node=&blockmem->node;
+while (node) {
+	node->num=0;
+	node=node->next;
+}
+blockmem->current=&blockmem->node;
+}
+
 static struct node_blockmem *new_node_blockmem(unsigned int size) {
 struct node_blockmem *node;
 if (!size) size=DEFAULTSIZE_BLOCKMEM;
@@ -47,4 +47,5 @@ void *alloc_blockmem(struct blockmem *blockmem, unsigned int size);
 unsigned char *memdup_blockmem(struct blockmem *blockmem, unsigned char *data, unsigned int datalen);
 int init_blockmem(struct blockmem *blockmem, unsigned int size);
 void deinit_blockmem(struct blockmem *blockmem);
+void reset_blockmem(struct blockmem *blockmem);
 char *strdup2_blockmem(struct blockmem *blockmem, unsigned char *str, unsigned int len);
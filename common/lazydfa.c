@@ -0,0 +1,686 @@
+/*
+ * lazydfa.c - regular expressions matched by a dfa that's built as input arrives
+ * Copyright (C) 2021 Sanjay Rao
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include "conventions.h"
+
+#include "lazydfa.h"
+
+/*
+ * Supported: literals, '.', [classes] and [^classes] with ranges, \d \w \s \D \W \S,
+ * \n \r \t \e \f \v \xHH, (groups), alternation with |, and * + ? {m} {m,} {m,n}.
+ * Matching is unanchored and streaming: a pattern matches whenever a match ends on the
+ * latest value. '.' doesn't match CR or LF. Patterns that can match nothing are refused.
+ */
+
+#define EPSILON_TYPE_NFA	0
+#define SPLIT_TYPE_NFA		1
+#define CLASS_TYPE_NFA		2
+#define MATCH_TYPE_NFA		3
+
+#define MAXREPEAT_LAZYDFA	100
+#define MAXNFA_LAZYDFA		65536
+#define MAXDFA_LAZYDFA		2048 // the dfa cache is flushed when it reaches this
+#define BUCKETS_LAZYDFA		4096
+
+struct fragment {
+	unsigned int start,end; // end is an epsilon with .out unset
+};
+
+struct parser {
+	struct lazydfa *lazydfa;
+	uint32_t *cur;
+	int isbad;
+};
+
+static int grow(void **buffer_inout, unsigned int *max_inout, unsigned int need, unsigned int size) {
+void *temp;
+unsigned int max;
+if (need<=*max_inout) return 0;
+max=_BADMAX(need,*max_inout*2);
+max=_BADMAX(max,64);
+if (!(temp=realloc(*buffer_inout,(size_t)max*size))) GOTOERROR;
+*buffer_inout=temp;
+*max_inout=max;
+return 0;
+error:
+	return -1;
+}
+
+int init_lazydfa(struct lazydfa *lazydfa) {
+if (!(lazydfa->dfa.buckets=ZTMALLOC(BUCKETS_LAZYDFA,unsigned int))) GOTOERROR;
+return 0;
+error:
+	return -1;
+}
+
+void deinit_lazydfa(struct lazydfa *lazydfa) {
+struct pattern_lazydfa *p,*next;
+for (p=lazydfa->patterns.first;p;p=next) {
+	next=p->next;
+	free(p->values);
+	free(p);
+}
+iffree(lazydfa->nfa.states);
+iffree(lazydfa->ranges.buffer);
+iffree(lazydfa->dfa.states);
+iffree(lazydfa->dfa.buckets);
+iffree(lazydfa->sets.buffer);
+iffree(lazydfa->matches.buffer);
+iffree(lazydfa->scratch.marks);
+iffree(lazydfa->scratch.stack);
+iffree(lazydfa->scratch.list);
+}
+
+static int newstate(unsigned int *index_out, struct parser *p, int type) {
+struct lazydfa *l=p->lazydfa;
+struct nfa_lazydfa *s;
+if (l->nfa.count==MAXNFA_LAZYDFA) { p->isbad=1; GOTOERROR; }
+if (grow((void **)&l->nfa.states,&l->nfa.max,l->nfa.count+1,sizeof(struct nfa_lazydfa))) GOTOERROR;
+s=l->nfa.states+l->nfa.count;
+memset(s,0,sizeof(struct nfa_lazydfa));
+s->type=type;
+*index_out=l->nfa.count;
+l->nfa.count+=1;
+return 0;
+error:
+	return -1;
+}
+
+static int addrange(struct parser *p, uint32_t lo, uint32_t hi) {
+struct lazydfa *l=p->lazydfa;
+if (grow((void **)&l->ranges.buffer,&l->ranges.max,l->ranges.count+1,sizeof(struct range_lazydfa))) GOTOERROR;
+l->ranges.buffer[l->ranges.count].lo=lo;
+l->ranges.buffer[l->ranges.count].hi=hi;
+l->ranges.count+=1;
+return 0;
+error:
+	return -1;
+}
+
+static int addnamedclass(struct parser *p, uint32_t c) {
+// adds ranges for \d \w \s, c is lowercase
+switch (c) {
+	case 'd': return addrange(p,'0','9');
+	case 'w':
+		if (addrange(p,'0','9')) return -1;
+		if (addrange(p,'A','Z')) return -1;
+		if (addrange(p,'_','_')) return -1;
+		return addrange(p,'a','z');
+	case 's':
+		if (addrange(p,9,13)) return -1;
+		return addrange(p,32,32);
+}
+p->isbad=1;
+return -1;
+}
+
+static int ishex(uint32_t c) {
+return ((c>='0')&&(c<='9'))||((c>='a')&&(c<='f'))||((c>='A')&&(c<='F'));
+}
+static unsigned int hexvalue(uint32_t c) {
+if (c<='9') return c-'0';
+return (c|32)-'a'+10;
+}
+
+static int escapedvalue(uint32_t *value_out, struct parser *p) {
+// p->cur is after the backslash
+uint32_t c;
+c=*p->cur;
+if (!c) { p->isbad=1; return -1; }
+p->cur++;
+switch (c) {
+	case 'n': *value_out=10; return 0;
+	case 'r': *value_out=13; return 0;
+	case 't': *value_out=9; return 0;
+	case 'e': *value_out=27; return 0;
+	case 'f': *value_out=12; return 0;
+	case 'v': *value_out=11; return 0;
+	case 'x':
+		if (!ishex(p->cur[0]) || !ishex(p->cur[1])) { p->isbad=1; return -1; }
+		*value_out=hexvalue(p->cur[0])*16+hexvalue(p->cur[1]);
+		p->cur+=2;
+		return 0;
+}
+if (((c>='0')&&(c<='9'))||((c>='A')&&(c<='Z'))||((c>='a')&&(c<='z'))) { p->isbad=1; return -1; }
+*value_out=c;
+return 0;
+}
+
+static int classfragment(struct fragment *frag_out, struct parser *p, unsigned int first, int isnegated) {
+// ranges from first to the end are the class
+unsigned int c,e;
+if (newstate(&c,p,CLASS_TYPE_NFA)) GOTOERROR;
+if (newstate(&e,p,EPSILON_TYPE_NFA)) GOTOERROR;
+p->lazydfa->nfa.states[c].first=first;
+p->lazydfa->nfa.states[c].count=p->lazydfa->ranges.count-first;
+p->lazydfa->nfa.states[c].isnegated=isnegated;
+p->lazydfa->nfa.states[c].out=e;
+frag_out->start=c;
+frag_out->end=e;
+return 0;
+error:
+	return -1;
+}
+
+static int parseclass(struct fragment *frag_out, struct parser *p) {
+// p->cur is after the '['
+unsigned int first;
+int isnegated=0,isfirst=1;
+first=p->lazydfa->ranges.count;
+if (*p->cur=='^') { isnegated=1; p->cur++; }
+while (1) {
+	uint32_t lo,hi;
+	lo=*p->cur;
+	if (!lo) { p->isbad=1; GOTOERROR; }
+	p->cur++;
+	if ((lo==']')&&(!isfirst)) break;
+	isfirst=0;
+	if (lo=='\\') {
+		uint32_t c;
+		c=*p->cur;
+		if ((c=='d')||(c=='w')||(c=='s')) {
+			p->cur++;
+			if (addnamedclass(p,c)) GOTOERROR;
+			continue;
+		}
+		if (escapedvalue(&lo,p)) GOTOERROR;
+	}
+	hi=lo;
+	if ((p->cur[0]=='-')&&(p->cur[1])&&(p->cur[1]!=']')) {
+		p->cur++;
+		hi=*p->cur;
+		p->cur++;
+		if (hi=='\\') {
+			if (escapedvalue(&hi,p)) GOTOERROR;
+		}
+		if (hi<lo) { p->isbad=1; GOTOERROR; }
+	}
+	if (addrange(p,lo,hi)) GOTOERROR;
+}
+return classfragment(frag_out,p,first,isnegated);
+error:
+	return -1;
+}
+
+static int parsealt(struct fragment *frag_out, struct parser *p);
+
+static int parseatom(struct fragment *frag_out, struct parser *p) {
+unsigned int first;
+uint32_t c;
+first=p->lazydfa->ranges.count;
+c=*p->cur;
+p->cur++;
+switch (c) {
+	case 0: case '*': case '+': case '?': case '{': case '|': case ')':
+		p->isbad=1;
+		GOTOERROR;
+	case '(':
+		if (parsealt(frag_out,p)) GOTOERROR;
+		if (*p->cur!=')') { p->isbad=1; GOTOERROR; }
+		p->cur++;
+		return 0;
+	case '[':
+		return parseclass(frag_out,p);
+	case '.':
+		if (addrange(p,10,10)) GOTOERROR;
+		if (addrange(p,13,13)) GOTOERROR;
+		return classfragment(frag_out,p,first,1);
+	case '\\':
+		c=*p->cur;
+		if ((c=='d')||(c=='w')||(c=='s')||(c=='D')||(c=='W')||(c=='S')) {
+			p->cur++;
+			if (addnamedclass(p,c|32)) GOTOERROR;
+			return classfragment(frag_out,p,first,!(c&32));
+		}
+		if (escapedvalue(&c,p)) GOTOERROR;
+		break;
+}
+if (addrange(p,c,c)) GOTOERROR;
+return classfragment(frag_out,p,first,0);
+error:
+	return -1;
+}
+
+static int split(unsigned int *index_out, struct parser *p, unsigned int out, unsigned int out1) {
+if (newstate(index_out,p,SPLIT_TYPE_NFA)) return -1;
+p->lazydfa->nfa.states[*index_out].out=out;
+p->lazydfa->nfa.states[*index_out].out1=out1;
+return 0;
+}
+
+static int parsecount(unsigned int *count_out, struct parser *p) {
+unsigned int n=0;
+if ((*p->cur<'0')||(*p->cur>'9')) { p->isbad=1; return -1; }
+while ((*p->cur>='0')&&(*p->cur<='9')) {
+	n=n*10+*p->cur-'0';
+	if (n>MAXREPEAT_LAZYDFA) { p->isbad=1; return -1; }
+	p->cur++;
+}
+*count_out=n;
+return 0;
+}
+
+static int parserepeat(struct fragment *frag_out, struct parser *p) {
+// an atom and at most one quantifier, {m,n} parses the atom again for each copy
+struct lazydfa *l=p->lazydfa;
+struct fragment frag,copy;
+uint32_t *atom,*after;
+unsigned int m,n,i,s,e;
+int isunbounded=0;
+
+atom=p->cur;
+if (parseatom(&frag,p)) GOTOERROR;
+switch (*p->cur) {
+	case '*':
+		p->cur++;
+		if (newstate(&e,p,EPSILON_TYPE_NFA)) GOTOERROR;
+		if (split(&s,p,frag.start,e)) GOTOERROR;
+		l->nfa.states[frag.end].out=s;
+		frag_out->start=s;
+		frag_out->end=e;
+		goto done;
+	case '+':
+		p->cur++;
+		if (newstate(&e,p,EPSILON_TYPE_NFA)) GOTOERROR;
+		if (split(&s,p,frag.start,e)) GOTOERROR;
+		l->nfa.states[frag.end].out=s;
+		frag_out->start=frag.start;
+		frag_out->end=e;
+		goto done;
+	case '?':
+		p->cur++;
+		if (split(&s,p,frag.start,frag.end)) GOTOERROR;
+		frag_out->start=s;
+		frag_out->end=frag.end;
+		goto done;
+	case '{':
+		break;
+	default:
+		*frag_out=frag;
+		return 0;
+}
+after=p->cur;
+p->cur++;
+if (parsecount(&m,p)) GOTOERROR;
+n=m;
+if (*p->cur==',') {
+	p->cur++;
+	if (*p->cur=='}') isunbounded=1;
+	else if (parsecount(&n,p)) GOTOERROR;
+}
+if ((*p->cur!='}')||(n<m)||(!n && !isunbounded)) { p->isbad=1; GOTOERROR; }
+p->cur++;
+{
+	uint32_t *resume=p->cur;
+	unsigned int copies;
+	copies=(isunbounded)?_BADMAX(m,1):n;
+	*frag_out=frag;
+	copy=frag;
+	for (i=0;i<copies;i++) {
+		if (i) {
+			p->cur=atom;
+			if (parseatom(&copy,p)) GOTOERROR;
+			if (p->cur!=after) { p->isbad=1; GOTOERROR; } // shouldn't happen
+		}
+		if (isunbounded && (i==copies-1)) { // last copy loops
+			if (newstate(&e,p,EPSILON_TYPE_NFA)) GOTOERROR;
+			if (split(&s,p,copy.start,e)) GOTOERROR;
+			l->nfa.states[copy.end].out=s;
+			copy.start=(m)?copy.start:s;
+			copy.end=e;
+		} else if (i>=m) {
+			if (split(&s,p,copy.start,copy.end)) GOTOERROR;
+			copy.start=s;
+		}
+		if (!i) *frag_out=copy;
+		else {
+			l->nfa.states[frag_out->end].out=copy.start;
+			frag_out->end=copy.end;
+		}
+	}
+	p->cur=resume;
+}
+done:
+if ((*p->cur=='*')||(*p->cur=='+')||(*p->cur=='?')||(*p->cur=='{')) { p->isbad=1; GOTOERROR; }
+return 0;
+error:
+	return -1;
+}
+
+static int parseconcat(struct fragment *frag_out, struct parser *p) {
+unsigned int e;
+if (newstate(&e,p,EPSILON_TYPE_NFA)) GOTOERROR;
+frag_out->start=frag_out->end=e;
+while (*p->cur && (*p->cur!='|') && (*p->cur!=')')) {
+	struct fragment frag;
+	if (parserepeat(&frag,p)) GOTOERROR;
+	p->lazydfa->nfa.states[frag_out->end].out=frag.start;
+	frag_out->end=frag.end;
+}
+return 0;
+error:
+	return -1;
+}
+
+static int parsealt(struct fragment *frag_out, struct parser *p) {
+if (parseconcat(frag_out,p)) GOTOERROR;
+while (*p->cur=='|') {
+	struct fragment frag;
+	unsigned int s,e;
+	p->cur++;
+	if (parseconcat(&frag,p)) GOTOERROR;
+	if (split(&s,p,frag_out->start,frag.start)) GOTOERROR;
+	if (newstate(&e,p,EPSILON_TYPE_NFA)) GOTOERROR;
+	p->lazydfa->nfa.states[frag_out->end].out=e;
+	p->lazydfa->nfa.states[frag.end].out=e;
+	frag_out->start=s;
+	frag_out->end=e;
+}
+return 0;
+error:
+	return -1;
+}
+
+static int fitscratch(struct lazydfa *l) {
+unsigned int max;
+if (l->scratch.max>=l->nfa.count) return 0;
+max=_BADMAX(l->nfa.count,l->scratch.max*2);
+iffree(l->scratch.marks);
+iffree(l->scratch.stack);
+iffree(l->scratch.list);
+l->scratch.max=0;
+if (!(l->scratch.marks=ZTMALLOC(max,unsigned int))) GOTOERROR;
+if (!(l->scratch.stack=malloc((2*max+1)*sizeof(unsigned int)))) GOTOERROR;
+if (!(l->scratch.list=malloc(max*sizeof(unsigned int)))) GOTOERROR;
+l->scratch.max=max;
+l->scratch.mark=0;
+return 0;
+error:
+	return -1;
+}
+
+static inline void newmark(struct lazydfa *l) {
+l->scratch.mark+=1;
+if (!l->scratch.mark) {
+	memset(l->scratch.marks,0,l->scratch.max*sizeof(unsigned int));
+	l->scratch.mark=1;
+}
+}
+
+static unsigned int closure(struct lazydfa *l, unsigned int count, unsigned int index) {
+// appends classes and matches reachable from index to scratch.list[count..], returns the new count
+unsigned int *stack=l->scratch.stack;
+unsigned int depth=1;
+stack[0]=index;
+while (depth) {
+	struct nfa_lazydfa *s;
+	unsigned int i;
+	i=stack[--depth];
+	if (l->scratch.marks[i]==l->scratch.mark) continue;
+	l->scratch.marks[i]=l->scratch.mark;
+	s=l->nfa.states+i;
+	switch (s->type) {
+		case EPSILON_TYPE_NFA: stack[depth++]=s->out; break;
+		case SPLIT_TYPE_NFA: stack[depth++]=s->out1; stack[depth++]=s->out; break;
+		default: l->scratch.list[count++]=i; break;
+	}
+}
+return count;
+}
+
+static int compile(struct fragment *frag_out, struct parser *p, uint32_t *values, void *tag) {
+// appends the pattern, ending in a match state, to the nfa
+unsigned int m,count,i;
+p->cur=values;
+if (parsealt(frag_out,p)) GOTOERROR;
+if (*p->cur) { p->isbad=1; GOTOERROR; } // unbalanced ')'
+if (newstate(&m,p,MATCH_TYPE_NFA)) GOTOERROR;
+p->lazydfa->nfa.states[m].tag=tag;
+p->lazydfa->nfa.states[frag_out->end].out=m;
+if (fitscratch(p->lazydfa)) GOTOERROR;
+(void)newmark(p->lazydfa);
+count=closure(p->lazydfa,0,frag_out->start);
+for (i=0;i<count;i++) {
+	if (p->lazydfa->scratch.list[i]==m) { p->isbad=1; GOTOERROR; } // matches nothing
+}
+return 0;
+error:
+	return -1;
+}
+
+static int cmp_uint(const void *a, const void *b) {
+return _FASTCMP(*(unsigned int *)a,*(unsigned int *)b);
+}
+
+static unsigned int hashset(unsigned int *list, unsigned int count) {
+unsigned int h=2166136261u;
+while (count) {
+	h=(h^*list)*16777619u;
+	list++;
+	count--;
+}
+return h%BUCKETS_LAZYDFA;
+}
+
+static int intern(unsigned int *index_out, struct lazydfa *l, unsigned int *list, unsigned int count) {
+// list is sorted, returns the dfa state for it, adding one if needed
+struct dfa_lazydfa *d;
+unsigned int h,i,index;
+h=hashset(list,count);
+for (i=l->dfa.buckets[h];i;i=d->hashnext) {
+	d=l->dfa.states+i-1;
+	if ((d->count==count)&&(!memcmp(l->sets.buffer+d->first,list,count*sizeof(unsigned int)))) {
+		*index_out=i-1;
+		return 0;
+	}
+}
+if (grow((void **)&l->dfa.states,&l->dfa.max,l->dfa.count+1,sizeof(struct dfa_lazydfa))) GOTOERROR;
+if (grow((void **)&l->sets.buffer,&l->sets.max,l->sets.count+count,sizeof(unsigned int))) GOTOERROR;
+index=l->dfa.count;
+d=l->dfa.states+index;
+memset(d,0,sizeof(struct dfa_lazydfa));
+d->first=l->sets.count;
+d->count=count;
+memcpy(l->sets.buffer+l->sets.count,list,count*sizeof(unsigned int));
+l->sets.count+=count;
+d->matchfirst=l->matches.count;
+for (i=0;i<count;i++) {
+	struct nfa_lazydfa *s;
+	s=l->nfa.states+list[i];
+	if (s->type!=MATCH_TYPE_NFA) continue;
+	if (grow((void **)&l->matches.buffer,&l->matches.max,l->matches.count+1,sizeof(void *))) GOTOERROR;
+	l->matches.buffer[l->matches.count]=s->tag;
+	l->matches.count+=1;
+}
+d->matchcount=l->matches.count-d->matchfirst;
+d->hashnext=l->dfa.buckets[h];
+l->dfa.buckets[h]=index+1;
+l->dfa.count+=1;
+*index_out=index;
+return 0;
+error:
+	return -1;
+}
+
+static void resetdfa(struct lazydfa *l) {
+l->dfa.count=0;
+l->sets.count=0;
+l->matches.count=0;
+memset(l->dfa.buckets,0,BUCKETS_LAZYDFA*sizeof(unsigned int));
+}
+
+static int build(struct lazydfa *l) {
+// compiles every pattern into one nfa, start splits to each of them
+struct pattern_lazydfa *pattern;
+struct parser parser;
+unsigned int count;
+int isfirst=1;
+
+l->nfa.count=0;
+l->ranges.count=0;
+(void)resetdfa(l);
+parser.lazydfa=l;
+parser.isbad=0;
+for (pattern=l->patterns.first;pattern;pattern=pattern->next) {
+	struct fragment frag;
+	if (compile(&frag,&parser,pattern->values,pattern->tag)) GOTOERROR; // these were checked in add_
+	if (isfirst) l->nfa.start=frag.start;
+	else if (split(&l->nfa.start,&parser,frag.start,l->nfa.start)) GOTOERROR;
+	isfirst=0;
+}
+l->isdirty=0;
+if (!l->patterns.first) return 0;
+if (fitscratch(l)) GOTOERROR;
+(void)newmark(l);
+count=closure(l,0,l->nfa.start);
+qsort(l->scratch.list,count,sizeof(unsigned int),cmp_uint);
+if (intern(&l->current,l,l->scratch.list,count)) GOTOERROR;
+return 0;
+error:
+	l->isdirty=1;
+	return -1;
+}
+
+static inline int isinclass(struct lazydfa *l, struct nfa_lazydfa *s, uint32_t value) {
+struct range_lazydfa *r;
+unsigned int count;
+r=l->ranges.buffer+s->first;
+for (count=s->count;count;count--,r++) {
+	if ((value>=r->lo)&&(value<=r->hi)) return !s->isnegated;
+}
+return s->isnegated;
+}
+
+static int step(unsigned int *next_out, struct lazydfa *l, uint32_t value) {
+unsigned int *set,count=0,i,n;
+if (l->dfa.count>=MAXDFA_LAZYDFA) { // flush the cache, keeping the current state
+	struct dfa_lazydfa *d;
+	d=l->dfa.states+l->current;
+	n=d->count;
+	memcpy(l->scratch.list,l->sets.buffer+d->first,n*sizeof(unsigned int));
+	(void)resetdfa(l);
+	if (intern(&l->current,l,l->scratch.list,n)) GOTOERROR;
+}
+(void)newmark(l);
+set=l->sets.buffer+l->dfa.states[l->current].first;
+n=l->dfa.states[l->current].count;
+for (i=0;i<n;i++) {
+	struct nfa_lazydfa *s;
+	s=l->nfa.states+set[i];
+	if (s->type!=CLASS_TYPE_NFA) continue;
+	if (!isinclass(l,s,value)) continue;
+	count=closure(l,count,s->out);
+}
+count=closure(l,count,l->nfa.start); // unanchored, a match can start anywhere
+qsort(l->scratch.list,count,sizeof(unsigned int),cmp_uint);
+if (intern(next_out,l,l->scratch.list,count)) GOTOERROR;
+return 0;
+error:
+	return -1;
+}
+
+int next_lazydfa(unsigned int *next_out, struct lazydfa *lazydfa, uint32_t value) {
+// finds the state after value, caller sets .current to accept it
+struct dfa_lazydfa *d;
+unsigned int next;
+if (lazydfa->isdirty) {
+	if (build(lazydfa)) GOTOERROR;
+}
+d=lazydfa->dfa.states+lazydfa->current;
+if (value<128) {
+	if (d->ascii[value]) { *next_out=d->ascii[value]-1; return 0; }
+} else if (d->lastnext && (d->lastvalue==value)) {
+	*next_out=d->lastnext-1;
+	return 0;
+}
+if (step(&next,lazydfa,value)) GOTOERROR;
+d=lazydfa->dfa.states+lazydfa->current; // step can move and renumber states
+if (value<128) d->ascii[value]=next+1;
+else {
+	d->lastvalue=value;
+	d->lastnext=next+1;
+}
+*next_out=next;
+return 0;
+error:
+	return -1;
+}
+
+unsigned int matches_lazydfa(void ***tags_out, struct lazydfa *lazydfa, unsigned int state) {
+struct dfa_lazydfa *d;
+d=lazydfa->dfa.states+state;
+*tags_out=lazydfa->matches.buffer+d->matchfirst;
+return d->matchcount;
+}
+
+struct pattern_lazydfa *add_lazydfa(int *isbad_out, struct lazydfa *lazydfa, uint32_t *values, void *tag) {
+// the pattern is compiled once to check it, states are rebuilt before the next value
+struct pattern_lazydfa *pattern=NULL;
+struct parser parser;
+struct fragment frag;
+unsigned int len,nfacount,rangecount,size;
+
+*isbad_out=0;
+nfacount=lazydfa->nfa.count;
+rangecount=lazydfa->ranges.count;
+parser.lazydfa=lazydfa;
+parser.isbad=0;
+if (compile(&frag,&parser,values,tag)) {
+	lazydfa->nfa.count=nfacount;
+	lazydfa->ranges.count=rangecount;
+	if (parser.isbad) { *isbad_out=1; return NULL; }
+	GOTOERROR;
+}
+size=lazydfa->nfa.count-nfacount+1; // +1 for the split in build()
+lazydfa->nfa.count=nfacount;
+lazydfa->ranges.count=rangecount;
+if (lazydfa->nfa.total+size>MAXNFA_LAZYDFA) { *isbad_out=1; return NULL; }
+
+for (len=0;values[len];len++);
+if (!(pattern=malloc(sizeof(struct pattern_lazydfa)))) GOTOERROR;
+if (!(pattern->values=malloc((len+1)*sizeof(uint32_t)))) GOTOERROR;
+memcpy(pattern->values,values,(len+1)*sizeof(uint32_t));
+pattern->tag=tag;
+pattern->size=size;
+lazydfa->nfa.total+=size;
+pattern->next=lazydfa->patterns.first;
+lazydfa->patterns.first=pattern;
+lazydfa->isdirty=1;
+return pattern;
+error:
+	if (pattern) free(pattern);
+	return NULL;
+}
+
+void remove_lazydfa(struct lazydfa *lazydfa, struct pattern_lazydfa *pattern) {
+struct pattern_lazydfa **ppnext;
+for (ppnext=&lazydfa->patterns.first;*ppnext;ppnext=&(*ppnext)->next) {
+	if (*ppnext!=pattern) continue;
+	*ppnext=pattern->next;
+	lazydfa->nfa.total-=pattern->size;
+	free(pattern->values);
+	free(pattern);
+	lazydfa->isdirty=1;
+	return;
+}
+}
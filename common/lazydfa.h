@@ -0,0 +1,89 @@
+/*
+ * lazydfa.h
+ * Copyright (C) 2021 Sanjay Rao
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+struct pattern_lazydfa {
+	uint32_t *values; // 0-terminated copy of the expression
+	void *tag; // reported when the pattern matches
+	unsigned int size; // nfa states
+	struct pattern_lazydfa *next;
+};
+
+struct nfa_lazydfa {
+	int type;
+	int isnegated:1;
+	unsigned int out,out1;
+	unsigned int first,count; // into ranges, for classes
+	void *tag; // for matches
+};
+
+struct range_lazydfa {
+	uint32_t lo,hi;
+};
+
+struct dfa_lazydfa {
+	unsigned int first,count; // into sets, sorted nfa classes and matches
+	unsigned int matchfirst,matchcount; // into matches
+	unsigned int hashnext; // 0 => end, otherwise index+1
+	uint32_t lastvalue; // one entry cache for values >= 128
+	unsigned int lastnext; // 0 => empty, otherwise index+1
+	unsigned int ascii[128]; // 0 => not built yet, otherwise index+1
+};
+
+struct lazydfa {
+	int isdirty; // patterns changed, rebuild before the next value
+	unsigned int current; // dfa state after the last value
+	struct {
+		struct pattern_lazydfa *first;
+	} patterns;
+	struct {
+		struct nfa_lazydfa *states;
+		unsigned int count,max;
+		unsigned int start;
+		unsigned int total; // sum of pattern sizes, for the limit
+	} nfa;
+	struct {
+		struct range_lazydfa *buffer;
+		unsigned int count,max;
+	} ranges;
+	struct {
+		struct dfa_lazydfa *states;
+		unsigned int count,max;
+		unsigned int *buckets;
+	} dfa;
+	struct {
+		unsigned int *buffer;
+		unsigned int count,max;
+	} sets;
+	struct {
+		void **buffer;
+		unsigned int count,max;
+	} matches;
+	struct {
+		unsigned int *marks,mark;
+		unsigned int *stack,*list;
+		unsigned int max;
+	} scratch; // sized for nfa.count
+};
+
+int init_lazydfa(struct lazydfa *lazydfa);
+void deinit_lazydfa(struct lazydfa *lazydfa);
+struct pattern_lazydfa *add_lazydfa(int *isbad_out, struct lazydfa *lazydfa, uint32_t *values, void *tag);
+void remove_lazydfa(struct lazydfa *lazydfa, struct pattern_lazydfa *pattern);
+int next_lazydfa(unsigned int *next_out, struct lazydfa *lazydfa, uint32_t value);
+unsigned int matches_lazydfa(void ***tags_out, struct lazydfa *lazydfa, unsigned int state);
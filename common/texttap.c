@@ -25,6 +25,7 @@
 #define DEBUG
 #include "conventions.h"
 #include "blockmem.h"
+#include "lazydfa.h"
 
 #include "texttap.h"
 
@@ -376,15 +377,147 @@ error:
 int init_texttap(struct texttap *texttap) {
 texttap->isempty=1;
 if (init_blockmem(&texttap->tofree.blockmem,8192)) GOTOERROR;
+if (init_lazydfa(&texttap->regex)) GOTOERROR;
 return 0;
 error:
 	return -1;
 }
 
 void deinit_texttap(struct texttap *texttap) {
+iffree(texttap->automaton.states);
+iffree(texttap->automaton.edges);
+deinit_lazydfa(&texttap->regex);
 deinit_blockmem(&texttap->tofree.blockmem);
 }
 
+static inline unsigned int findedge(struct texttap *tap, unsigned int state, unsigned int value) {
+// returns the trie child of state for value >= ASCII_TEXTTAP, 0 if there isn't one
+struct edge_texttap *edges;
+unsigned int lo=0,hi;
+edges=tap->automaton.edges+tap->automaton.states[state].sparse.first;
+hi=tap->automaton.states[state].sparse.count;
+while (lo<hi) {
+	unsigned int mid=(lo+hi)/2;
+	if (edges[mid].value<value) lo=mid+1;
+	else if (edges[mid].value>value) hi=mid;
+	else return edges[mid].state;
+}
+return 0;
+}
+
+static int addstate(struct texttap *tap, unsigned int parent, struct node_texttap *node) {
+// node is a trie child of parent's node, parent's fail chain is already built
+struct state_texttap *st;
+unsigned int index,fail=0,value=node->value.uint;
+
+if (tap->automaton.count==tap->automaton.max) {
+	unsigned int max;
+	max=tap->automaton.max*2;
+	if (!(st=realloc(tap->automaton.states,max*sizeof(struct state_texttap)))) GOTOERROR;
+	tap->automaton.states=st;
+	tap->automaton.max=max;
+}
+index=tap->automaton.count;
+tap->automaton.count+=1;
+
+if (value<ASCII_TEXTTAP) {
+	if (parent) fail=tap->automaton.states[tap->automaton.states[parent].fail].ascii[value];
+	tap->automaton.states[parent].ascii[value]=index;
+} else {
+	if (tap->automaton.edgecount==tap->automaton.edgemax) {
+		struct edge_texttap *edges;
+		unsigned int max;
+		max=tap->automaton.edgemax*2;
+		if (!(edges=realloc(tap->automaton.edges,max*sizeof(struct edge_texttap)))) GOTOERROR;
+		tap->automaton.edges=edges;
+		tap->automaton.edgemax=max;
+	}
+	tap->automaton.edges[tap->automaton.edgecount].value=value;
+	tap->automaton.edges[tap->automaton.edgecount].state=index;
+	tap->automaton.edgecount+=1;
+	if (parent) {
+		unsigned int f;
+		f=tap->automaton.states[parent].fail;
+		while (1) {
+			if ((fail=findedge(tap,f,value))) break;
+			if (!f) break;
+			f=tap->automaton.states[f].fail;
+		}
+	}
+}
+
+st=tap->automaton.states+index;
+st->node=node;
+st->fail=fail;
+st->output=(node->finals.first)?index:tap->automaton.states[fail].output;
+node->state=index;
+return 0;
+error:
+	return -1;
+}
+
+static int addstates(struct texttap *tap, unsigned int parent, struct node_texttap *root) {
+// in order, so parent's sparse edges come out sorted
+if (!root) return 0;
+if (addstates(tap,parent,LEFT(root))) GOTOERROR;
+if (addstate(tap,parent,root)) GOTOERROR;
+if (addstates(tap,parent,RIGHT(root))) GOTOERROR;
+return 0;
+error:
+	return -1;
+}
+
+static int build_automaton(struct texttap *tap) {
+// breadth first over the trie, a state's fail is always shallower so it's finished first
+struct node_texttap *current=NULL;
+unsigned int i;
+
+if (tap->automaton.count) current=tap->automaton.states[tap->automaton.current].node;
+if (!tap->automaton.states) {
+	if (!(tap->automaton.states=malloc(64*sizeof(struct state_texttap)))) GOTOERROR;
+	tap->automaton.max=64;
+}
+if (!tap->automaton.edges) {
+	if (!(tap->automaton.edges=malloc(64*sizeof(struct edge_texttap)))) GOTOERROR;
+	tap->automaton.edgemax=64;
+}
+tap->automaton.count=1;
+tap->automaton.edgecount=0;
+tap->automaton.current=0;
+tap->automaton.states[0].node=NULL;
+tap->automaton.states[0].fail=0;
+tap->automaton.states[0].output=0;
+for (i=0;i<tap->automaton.count;i++) {
+	struct state_texttap *st;
+	unsigned int first;
+	st=tap->automaton.states+i;
+	if (!i) memset(st->ascii,0,sizeof(st->ascii));
+	else memcpy(st->ascii,tap->automaton.states[st->fail].ascii,sizeof(st->ascii));
+	first=tap->automaton.edgecount;
+	if (addstates(tap,i,(i)?st->node->nextvalue.treetop:tap->treetop)) GOTOERROR;
+	st=tap->automaton.states+i; // addstates can move states
+	st->sparse.first=first;
+	st->sparse.count=tap->automaton.edgecount-first;
+}
+if (current) tap->automaton.current=current->state; // partial matches survive the rebuild
+tap->automaton.isdirty=0;
+return 0;
+error:
+	tap->automaton.count=0;
+	return -1;
+}
+
+static inline unsigned int nextstate(struct texttap *tap, unsigned int value) {
+unsigned int st,next;
+st=tap->automaton.current;
+if (value<ASCII_TEXTTAP) return tap->automaton.states[st].ascii[value];
+while (1) {
+	if ((next=findedge(tap,st,value))) return next;
+	if (!st) return 0;
+	st=tap->automaton.states[st].fail;
+}
+}
+
 static int fulltap_runfinals(unsigned int *count_inout, struct final_texttap *first, unsigned int uint) {
 struct value_texttap value;
 value.previous=NULL;
@@ -401,6 +534,27 @@ return 0;
 error:
 	return -1;
 }
+static int regex_runfinals(unsigned int *count_inout, struct texttap *texttap, unsigned int state, unsigned int uint) {
+struct value_texttap value;
+void **tags;
+unsigned int n;
+value.previous=NULL;
+value.uint=uint;
+n=matches_lazydfa(&tags,&texttap->regex,state);
+while (n) {
+	struct final_texttap *final=(struct final_texttap *)*tags;
+	int r;
+	*count_inout+=1;
+	r=final->cb(final->cbparam,&value);
+	if (r<0) GOTOERROR; // TODO, remove it
+	if (texttap->regex.isdirty) break; // a callback changed the looks, tags are stale
+	tags++;
+	n--;
+}
+return 0;
+error:
+	return -1;
+}
 static int runfinals(unsigned int *count_inout, struct final_texttap *first, struct value_texttap *value) {
 while (1) {
 	int r;
@@ -416,98 +570,92 @@ error:
 }
 
 int addchar_texttap(unsigned int *count_out, struct texttap *texttap, unsigned int value) {
-struct node_texttap *node,**ppnext;
-unsigned int count=0;
+unsigned int count=0,o;
 
 if (texttap->fulltap.first) {
 	if (fulltap_runfinals(&count,texttap->fulltap.first,value)) GOTOERROR;
 }
+if (texttap->regex.patterns.first) {
+	unsigned int next;
+	if (next_lazydfa(&next,&texttap->regex,value)) GOTOERROR;
+	texttap->regex.current=next;
+	if (regex_runfinals(&count,texttap,next,value)) GOTOERROR;
+}
 
-node=texttap->active.first;
-ppnext=&texttap->active.first;
-while (node) {
-	struct node_texttap *next,*fn;
-
-	next=node->list.next;
-	fn=find_node_texttap(node->nextvalue.treetop,value);
-	if (!fn) *ppnext=next;
-	else {
-		if (fn->finals.first) {
-			if (runfinals(&count,fn->finals.first,&fn->value)) GOTOERROR;
-			if (!fn->nextvalue.treetop) *ppnext=next;
-			else {
-				*ppnext=fn;
-				fn->list.next=next;
-				ppnext=&fn->list.next;
-			}
-		} else {
-			*ppnext=fn;
-			fn->list.next=next;
-			ppnext=&fn->list.next;
-		}
-	}
-	node=next;
+if (texttap->automaton.isdirty) {
+	if (build_automaton(texttap)) GOTOERROR;
 }
-{
+if (!texttap->automaton.count) goto done; // no looks have been added
+texttap->automaton.current=nextstate(texttap,value);
+o=texttap->automaton.states[texttap->automaton.current].output;
+while (o) {
 	struct node_texttap *fn;
-	fn=find_node_texttap(texttap->treetop,value);
-	if (fn) {
-		if (fn->finals.first) {
-			if (runfinals(&count,fn->finals.first,&fn->value)) GOTOERROR;
-			if (fn->nextvalue.treetop) { fn->list.next=texttap->active.first; texttap->active.first=fn; }
-		} else {
-			fn->list.next=texttap->active.first; texttap->active.first=fn;
-		}
-	}
+	fn=texttap->automaton.states[o].node;
+	if (runfinals(&count,fn->finals.first,&fn->value)) GOTOERROR;
+	if (texttap->automaton.isdirty) break; // a callback changed the looks, states are stale
+	o=texttap->automaton.states[texttap->automaton.states[o].fail].output;
 }
+done:
 *count_out=count;
 return 0;
 error:
 	return -1;
 }
 
+static inline int nocbadd(struct texttap *texttap, unsigned int value) {
+// full taps aren't checked, callers hand those values to fulltap_texttap
+unsigned int next,renext=0;
+void **tags;
+
+if (texttap->isempty) return 1;
+if (texttap->regex.patterns.first) {
+	if (next_lazydfa(&renext,&texttap->regex,value)) return 0; // addchar_texttap will report it
+	if (matches_lazydfa(&tags,&texttap->regex,renext)) return 0;
+}
+if (texttap->automaton.isdirty) {
+	if (build_automaton(texttap)) return 0;
+}
+if (texttap->automaton.count) {
+	next=nextstate(texttap,value);
+	if (texttap->automaton.states[next].output) return 0;
+	texttap->automaton.current=next;
+}
+if (texttap->regex.patterns.first) texttap->regex.current=renext;
+return 1;
+}
+
 int isnocbadd_texttap(struct texttap *texttap, unsigned int value) {
-// returns 1 if there would be a callback
-struct node_texttap *node,*fn,**ppnext;
-
-// fprintf(stderr,"Adding %u\n",value);
-
-if (texttap->fulltap.first) return 0;
-
-node=texttap->active.first;
-while (node) {
-	fn=find_node_texttap(node->nextvalue.treetop,value);
-	if ((fn) && (fn->finals.first)) return 0;
-	node=node->list.next;
-}
-fn=find_node_texttap(texttap->treetop,value);
-if ((fn) && (fn->finals.first)) return 0;
-
-// fprintf(stderr,"No cb on %u\n",value);
-
-// this is addchar_, stripped of cases we just checked
-node=texttap->active.first;
-ppnext=&texttap->active.first;
-while (node) {
-	struct node_texttap *next;
-	next=node->list.next;
-	fn=find_node_texttap(node->nextvalue.treetop,value);
-	if (!fn) *ppnext=next;
-	else {
-		*ppnext=fn;
-		fn->list.next=next;
-		ppnext=&fn->list.next;
-	}
-	node=next;
+// returns 0 if a look or regex would have a callback, otherwise adds value and returns 1
+return nocbadd(texttap,value);
 }
-{
-	fn=find_node_texttap(texttap->treetop,value);
-	if (fn) {
-		fn->list.next=texttap->active.first; texttap->active.first=fn;
-	}
+
+unsigned int nocbaddrun_texttap(struct texttap *texttap, uint32_t *values, unsigned int count) {
+// adds values until one would have a callback, returns how many were added
+unsigned int i;
+if (texttap->isempty) return count;
+for (i=0;i<count;i++) if (!nocbadd(texttap,values[i])) break;
+return i;
 }
 
-return 1;
+unsigned int nocbaddbytes_texttap(struct texttap *texttap, unsigned char *bytes, unsigned int count) {
+// nocbaddrun_texttap for 7bit text
+unsigned int i;
+if (texttap->isempty) return count;
+for (i=0;i<count;i++) if (!nocbadd(texttap,bytes[i])) break;
+return i;
+}
+
+int fulltap_texttap(unsigned int *count_out, struct texttap *texttap, uint32_t *values, unsigned int count) {
+// runs only the full taps, for values that went through the nocbadd functions
+unsigned int n=0,i;
+for (i=0;i<count;i++) {
+	if (!texttap->fulltap.first) break; // a callback removed the last one
+	if (fulltap_runfinals(&n,texttap->fulltap.first,values[i])) GOTOERROR;
+}
+*count_out=n;
+return 0;
+error:
+	return -1;
 }
 
 int addstring_texttap(unsigned int *count_out, struct texttap *texttap, char *str) {
@@ -584,6 +732,9 @@ while (1) {
 	treetop=&fn->nextvalue.treetop;
 	previous=&fn->value;
 }
+handle->pattern=NULL;
+tap->isempty=0;
+tap->automaton.isdirty=1;
 return handle;
 error:
 	return NULL;
@@ -626,25 +777,42 @@ if ((!values)||(!*values)) {
 		treetop=&fn->nextvalue.treetop;
 		previous=&fn->value;
 	}
+	tap->automaton.isdirty=1;
 }
+handle->pattern=NULL;
 tap->isempty=0;
 return handle;
 error:
 	return NULL;
 }
 
-static void removefromactive(struct texttap *tap, struct node_texttap *node) {
-struct node_texttap **ppnext,*cur;
-ppnext=&tap->active.first;
-cur=*ppnext;
-while (cur) {
-	if (cur==node) {
-		*ppnext=node->list.next;
-		break;
-	}
-	ppnext=&cur->list.next;
-	cur=*ppnext;
+struct handle_texttap *regex_look_texttap(int *isbad_out, struct texttap *tap, struct handle_texttap *handle, unsigned int *values,
+		int (*cb)(void *,struct value_texttap *), void *param) {
+// values is a 0-terminated regular expression, see lazydfa.c, isbad_out is set if it's invalid
+struct final_texttap *final;
+
+*isbad_out=0;
+if (!(final=alloc_final_texttap(tap))) GOTOERROR;
+final->cbparam=param;
+final->cb=cb;
+final->next=NULL;
+if (!(handle->pattern=add_lazydfa(isbad_out,&tap->regex,values,final))) {
+	(void)recycle_final_texttap(tap,final);
+	if (*isbad_out) return NULL;
+	GOTOERROR;
 }
+handle->final=final;
+handle->value=NULL;
+tap->isempty=0;
+return handle;
+error:
+	return NULL;
+}
+
+static void forgetnode(struct texttap *tap, struct node_texttap *node) {
+// the rebuild can't map a recycled node, so partial matches through it are dropped
+if (!tap->automaton.count) return;
+if (tap->automaton.states[tap->automaton.current].node==node) tap->automaton.current=0;
 }
 
 #if 0
@@ -665,7 +833,7 @@ while (1) {
 	str++;
 }
 if ((!fn->finals.first) && (!fn->nextvalue.treetop)) {
-	(void)removefromactive(tap,fn);
+	(void)forgetnode(tap,fn);
 	(ignore)rmnode(treetop,fn);
 	(void)recycle_node_texttap(tap,fn);
 	return fn;
@@ -688,7 +856,7 @@ while (1) {
 	values++;
 }
 if ((!fn->finals.first) && (!fn->nextvalue.treetop)) {
-	(void)removefromactive(tap,fn);
+	(void)forgetnode(tap,fn);
 	(ignore)rmnode(treetop,fn);
 	(void)recycle_node_texttap(tap,fn);
 	return fn;
@@ -763,15 +931,18 @@ if (node->samevalue.right) print_node_texttap(node->samevalue.right,depth);
 void print_texttap(struct texttap *tap) {
 fprintf(stderr,"struct texttap {\n"\
 "	struct {\n"\
-"		struct node_texttap *first:%p\n"\
-"	} active;\n"\
+"		int isdirty:%d\n"\
+"		unsigned int current:%u\n"\
+"		unsigned int count:%u\n"\
+"		unsigned int edgecount:%u\n"\
+"	} automaton;\n"\
 "	struct node_texttap *treetop:%p\n"\
 "	struct {\n"\
 "		struct node_texttap *firstnode:%p\n"\
 "		struct final_texttap *firstfinal:%p\n"\
 "	} recyclepool;\n"\
 "} %p;\n",
-	tap->active.first,
+	tap->automaton.isdirty,tap->automaton.current,tap->automaton.count,tap->automaton.edgecount,
 	tap->treetop,
 	tap->recyclepool.firstnode,
 	tap->recyclepool.firstfinal,
@@ -786,7 +957,7 @@ while (1) {
 	if (node->nextvalue.treetop) break;
 	previous=previous_node_texttap(node); // just node->value.previous, recast
 	
-	(void)removefromactive(tap,node); // previous nodes can also be active if the search repeats, e.g. "aaaa"
+	(void)forgetnode(tap,node);
 	if (previous) (ignore)rmnode(&previous->nextvalue.treetop,node);
 	else (ignore)rmnode(&tap->treetop,node);
 	(void)recycle_node_texttap(tap,node);
@@ -796,7 +967,9 @@ while (1) {
 }
 
 static inline void checkforempty(struct texttap *tap) {
+tap->automaton.isdirty=1;
 if (tap->treetop) return;
+if (tap->regex.patterns.first) return;
 if (tap->fulltap.first) return;
 tap->isempty=1;
 }
@@ -866,6 +1039,14 @@ if (isfound_out) *isfound_out=isfound;
 void handle_remove_texttap(int *isfound_out, struct texttap *tap, struct handle_texttap *h) {
 struct node_texttap *fn;
 struct final_texttap *final;
+if (h->pattern) {
+	(void)remove_lazydfa(&tap->regex,h->pattern);
+	(void)recycle_final_texttap(tap,h->final);
+	h->pattern=NULL;
+	(void)checkforempty(tap);
+	*isfound_out=1;
+	return;
+}
 fn=node_handle_texttap(h);
 final=removefinal(fn,h->final);
 if (!final) {
@@ -26,10 +26,11 @@ struct node_texttap {
 
 	struct {
 		struct node_texttap *next;
-	} list; // for active and recycle
+	} list; // for recycle
 	struct {
 			struct node_texttap *treetop;
 	} nextvalue;
+	unsigned int state; // index in automaton.states, set by each build
 
 	struct {
 		struct node_texttap *left,*right;
@@ -51,17 +52,41 @@ struct final_texttap {
 struct handle_texttap {
 	struct value_texttap *value;
 	struct final_texttap *final;
+	struct pattern_lazydfa *pattern; // !NULL => regex look
+};
+
+#define ASCII_TEXTTAP	128
+
+struct state_texttap { // aho-corasick state, one per trie node
+	struct node_texttap *node; // NULL for the root
+	unsigned int fail; // state for the longest proper suffix in the trie
+	unsigned int output; // nearest state in the fail chain (self included) with finals, 0 => none
+	struct {
+		unsigned int first,count; // into automaton.edges, sorted by value
+	} sparse; // trie children >= ASCII_TEXTTAP, others go through the fail chain
+	unsigned int ascii[ASCII_TEXTTAP]; // complete transitions
+};
+
+struct edge_texttap {
+	unsigned int value;
+	unsigned int state;
 };
 
 
 struct texttap {
 	int isempty;
 	struct {
-		struct node_texttap *first;
-	} active;
+		int isdirty; // looks changed, rebuild before the next value
+		unsigned int current; // state after the last value
+		struct state_texttap *states;
+		unsigned int count,max;
+		struct edge_texttap *edges;
+		unsigned int edgecount,edgemax;
+	} automaton;
 	struct {
 		struct final_texttap *first;
 	} fulltap;
+	struct lazydfa regex; // tags are final_texttap
 	struct node_texttap *treetop;
 	struct {
 		struct node_texttap *firstnode;
@@ -81,8 +106,13 @@ struct handle_texttap *str_look_texttap(struct texttap *tap, struct handle_textt
 		int (*cb)(void *,struct value_texttap *), void *param);
 struct handle_texttap *look_texttap(struct texttap *tap, struct handle_texttap *handle, unsigned int *values,
 		int (*cb)(void *,struct value_texttap *), void *param);
+struct handle_texttap *regex_look_texttap(int *isbad_out, struct texttap *tap, struct handle_texttap *handle, unsigned int *values,
+		int (*cb)(void *,struct value_texttap *), void *param);
 void str_remove_texttap(int *isfound_out, struct texttap *tap, char *str, int (*cb)(void *,struct value_texttap *), void *param);
 void remove_texttap(int *isfound_out, struct texttap *tap, uint32_t *values, int (*cb)(void *,struct value_texttap *), void *param);
 void print_texttap(struct texttap *tap);
 void handle_remove_texttap(int *isfound_out, struct texttap *tap, struct handle_texttap *h);
 int isnocbadd_texttap(struct texttap *texttap, unsigned int value);
+unsigned int nocbaddrun_texttap(struct texttap *texttap, uint32_t *values, unsigned int count);
+unsigned int nocbaddbytes_texttap(struct texttap *texttap, unsigned char *bytes, unsigned int count);
+int fulltap_texttap(unsigned int *count_out, struct texttap *texttap, uint32_t *values, unsigned int count);
@@ -76,6 +76,7 @@ c->cellh=27;
 c->columns=68;
 c->rows=20;
 c->scrollbackcount=1000;
+c->spilldir[0]='\0';
 c->cursorheight=11;
 c->cursoryoff=15;
 
@@ -128,6 +129,14 @@ SETCOLOR(c->darkmode.colors[14],0x93,0xA1,0xA1); // bright cyan
 SETCOLOR(c->darkmode.colors[15],0xFD,0xF6,0xE3); // foreground
 
 c->charcache=200; // 2000 has worked, 100 seems ok
+c->framerate=60;
+c->isshmdraw=0;
+c->isparsethread=0;
+c->issearchindex=0;
+c->logfile[0]='\0';
+c->islogtiming=0;
+c->islogcompress=0;
+c->jumpscroll=16384;
 
 (void)recalc_config(c);
 }
@@ -28,6 +28,8 @@
 
 #define MAX_EXPORTTERM_CONFIG	31
 #define MAX_TYPEFACE_CONFIG		31
+#define MAX_SPILLDIR_CONFIG		255
+#define MAX_LOGFILE_CONFIG		255
 struct config {
 	char **cmdline;
 	char exportterm[MAX_EXPORTTERM_CONFIG+1];
@@ -36,6 +38,7 @@ struct config {
 	unsigned int cellw,cellh;
 	unsigned int columns,rows;
 	unsigned int scrollbackcount;
+	char spilldir[MAX_SPILLDIR_CONFIG+1]; // "" => lines past scrollbackcount are dropped
 	unsigned int cursorheight,cursoryoff;
 	int font0shift,font0line,fontulline,fontullines; // <0 => auto
 
@@ -55,6 +58,14 @@ struct config {
 
 // below this, config.apply() ignores but OnInitBegin can modify
 	unsigned int charcache;
+	unsigned int framerate; // max screen updates per second, 0 => update after every batch
+	unsigned int isshmdraw:1; // draw cells client-side and send them with MIT-SHM
+	unsigned int isparsethread:1; // parse output on a second thread while the last batch is drawn
+	unsigned int issearchindex:1; // keep trigram filters of the history for search_xclient
+	char logfile[MAX_LOGFILE_CONFIG+1]; // "" => no session log
+	unsigned int islogtiming:1; // also write logfile.timing for scriptreplay
+	unsigned int islogcompress:1; // gzip the session log
+	unsigned int jumpscroll; // input bytes per frame that start jump scrolling, 0 => never
 	struct { // this is readonly
 		unsigned int height,width,heightmm,widthmm;
 	} screen;
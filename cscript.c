@@ -22,13 +22,17 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <X11/Xlib.h>
 #define DEBUG
 #include "common/conventions.h"
+#include "common/blockmem.h"
 #include "config.h"
 #include "x11info.h"
 #include "vte.h"
 #include "cursor.h"
+#include "history.h"
+#include "search.h"
 #include "xclient.h"
 
 #include "cscript.h"
@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <pty.h>
+#include <pthread.h>
 #include <ctype.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -30,9 +31,12 @@
 #define DEBUG
 #include "config.h"
 #include "common/conventions.h"
+#include "common/blockmem.h"
 #include "x11info.h"
 #include "pty.h"
 #include "vte.h"
+#include "history.h"
+#include "search.h"
 #include "xclient.h"
 
 #include "cursor.h"
@@ -106,12 +110,13 @@ error:
 	return -1;
 }
 
-int set_cursor(struct cursor *cursor, uint32_t value, Pixmap backing, unsigned int row, unsigned int col) {
+int set_cursor(struct cursor *cursor, uint32_t value, Pixmap backing, unsigned int bx, unsigned int by, unsigned int row, unsigned int col) {
+// bx,by: location of the cell in backing
 if (cursor->lastvalue!=value) {
 	struct x11info *x=cursor->x;
-	if (!XCopyArea(x->display,backing,cursor->pixmaps.backing,x->context,0,0,cursor->config.cellw,cursor->config.cellh,0,0)) GOTOERROR;
-	if (!XCopyArea(x->display,backing,cursor->pixmaps.blinkon,x->context,0,0,cursor->config.cellw,cursor->config.cellh,0,0)) GOTOERROR;
-	if (!XCopyArea(x->display,backing,cursor->pixmaps.blinkoff,x->context,0,0,cursor->config.cellw,cursor->config.cellh,0,0)) GOTOERROR;
+	if (!XCopyArea(x->display,backing,cursor->pixmaps.backing,x->context,bx,by,cursor->config.cellw,cursor->config.cellh,0,0)) GOTOERROR;
+	if (!XCopyArea(x->display,backing,cursor->pixmaps.blinkon,x->context,bx,by,cursor->config.cellw,cursor->config.cellh,0,0)) GOTOERROR;
+	if (!XCopyArea(x->display,backing,cursor->pixmaps.blinkoff,x->context,bx,by,cursor->config.cellw,cursor->config.cellh,0,0)) GOTOERROR;
 	if (!XSetForeground(x->display,x->context,cursor->color.pixel)) GOTOERROR;
 	if (!XFillRectangle(x->display,cursor->pixmaps.blinkon,x->context,0,cursor->config.cursoryoff,cursor->config.cellw,cursor->config.cursorheight)) GOTOERROR;
 	if (!XFillRectangle(x->display,cursor->pixmaps.blinkoff,x->context,0,cursor->config.cursoryoff+cursor->config.cursorheight-2,cursor->config.cellw,2)) GOTOERROR;
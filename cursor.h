@@ -42,7 +42,7 @@ struct cursor {
 int init_cursor(struct cursor *cursor, struct config *config, struct x11info *x);
 void deinit_cursor(struct cursor *cursor);
 int pulse_cursor(struct cursor *cursor);
-int set_cursor(struct cursor *cursor, uint32_t value, Pixmap backing, unsigned int row, unsigned int col);
+int set_cursor(struct cursor *cursor, uint32_t value, Pixmap backing, unsigned int bx, unsigned int by, unsigned int row, unsigned int col);
 int unset_cursor(struct cursor *cursor);
 int reset_cursor(struct cursor *cursor);
 int setcolors_cursor(struct cursor *cursor, unsigned short r, unsigned short g, unsigned short b);
@@ -28,35 +28,52 @@
 
 #include "event.h"
 
-static inline void setupevents(struct all_event *all, unsigned int count, struct one_event *events) {
-all->unused.count=count;
-while (count) {
-	events->next=all->unused.first;
-	all->unused.first=events;
-	events+=1;
-	count--;
-}
-}
+#define CELLSPEREVENT	16
 
-int init_all_event(struct all_event *all, int num) {
-if (!(all->events=MALLOC(num*sizeof(struct one_event)))) GOTOERROR;
-(void)setupevents(all,num,all->events);
+int init_all_event(struct all_event *all, unsigned int num, unsigned int limit) {
+if (!(all->events.buffer=MALLOC(num*sizeof(struct one_event)))) GOTOERROR;
+all->events.max=num;
+all->events.limit=_BADMAX(num,limit);
+all->cells.max=num*CELLSPEREVENT;
+if (!(all->cells.buffer=MALLOC(all->cells.max*sizeof(uint32_t)))) GOTOERROR;
+all->taps.max=num*CELLSPEREVENT;
+if (!(all->taps.buffer=MALLOC(all->taps.max*sizeof(uint32_t)))) GOTOERROR;
 return 0;
 error:
 	return -1;
 }
 
 void deinit_all_event(struct all_event *all) {
-IFFREE(all->events);
+IFFREE(all->events.buffer);
+IFFREE(all->cells.buffer);
+IFFREE(all->taps.buffer);
+}
+
+static void grow(struct all_event *all) {
+// only called with no events outstanding, nothing points into the buffers
+struct one_event *events;
+uint32_t *cells,*taps;
+unsigned int max;
+max=_BADMIN(all->events.max*2,all->events.limit);
+if (max==all->events.max) return;
+if (!(events=MALLOC(max*sizeof(struct one_event)))) return;
+if (!(cells=MALLOC(max*CELLSPEREVENT*sizeof(uint32_t)))) { FREE(events); return; }
+if (!(taps=MALLOC(max*CELLSPEREVENT*sizeof(uint32_t)))) { FREE(cells); FREE(events); return; }
+FREE(all->events.buffer);
+FREE(all->cells.buffer);
+FREE(all->taps.buffer);
+all->events.buffer=events;
+all->events.max=max;
+all->cells.buffer=cells;
+all->cells.max=max*CELLSPEREVENT;
+all->taps.buffer=taps;
+all->taps.max=max*CELLSPEREVENT;
 }
 
 static inline struct one_event *getevent(struct all_event *all) {
-struct one_event *e;
-e=all->unused.first;
-if (!e) return NULL;
-all->unused.first=e->next;
-all->unused.count-=1;
-return e;
+if (all->events.len==all->events.max) { all->events.isshort=1; return NULL; }
+all->events.len+=1;
+return all->events.buffer+all->events.len-1;
 }
 static inline void addevent(struct all_event *all, struct one_event *e) {
 e->next=NULL;
@@ -69,9 +86,24 @@ all->last=e;
 }
 
 void recycle_event(struct all_event *all, struct one_event *e) {
-all->unused.count+=1;
-e->next=all->unused.first;
-all->unused.first=e;
+// events are freed together, once nothing is left in the list
+if (all->first) return;
+all->events.len=0;
+all->cells.len=0;
+all->taps.len=0;
+all->taprun=NULL;
+all->ishooked=0;
+if (all->events.isshort) {
+	all->events.isshort=0;
+	(void)grow(all);
+}
+}
+
+int isroom_event(struct all_event *all, unsigned int count) {
+// returns 0 if count events aren't available, the pool grows once the list drains
+if (all->events.max-all->events.len>=count) return 1;
+all->events.isshort=1;
+return 0;
 }
 
 void addchar_event(struct all_event *all, uint32_t value, unsigned int row, unsigned int col) {
@@ -91,6 +123,35 @@ e->addchar.col=col;
 (void)addevent(all,e);
 }
 
+unsigned int reservecells_event(struct all_event *all, unsigned int count) {
+// returns how many of count cells are available for addstring_event
+unsigned int n;
+n=all->cells.max-all->cells.len;
+if (n>=count) return count;
+all->events.isshort=1;
+return n;
+}
+
+uint32_t *addstring_event(struct all_event *all, unsigned int row, unsigned int col, unsigned int count) {
+// caller fills the returned cells, count should be <= reservecells_event()
+struct one_event *e;
+uint32_t *cells;
+e=getevent(all);
+#ifdef DEBUG
+if (!e) { WHEREAMI; return NULL; }
+if (count>all->cells.max-all->cells.len) { WHEREAMI; all->events.len-=1; return NULL; }
+#endif
+cells=all->cells.buffer+all->cells.len;
+all->cells.len+=count;
+e->type=ADDSTRING_TYPE_EVENT;
+e->addstring.cells=cells;
+e->addstring.row=row;
+e->addstring.col=col;
+e->addstring.count=count;
+(void)addevent(all,e);
+return cells;
+}
+
 void eraseinline_event(struct all_event *all, uint32_t value, unsigned int row, unsigned int rowcount,
 		unsigned int col, unsigned int colcount) {
 struct one_event *e;
@@ -246,6 +307,8 @@ if (!e) { WHEREAMI; return; }
 e->type=GENERIC_TYPE_EVENT;
 // TODO do ESC[0n reply if !type
 strcpy(e->generic.str,str);
+all->ishooked=1;
+all->taprun=NULL;
 (void)addevent(all,e);
 }
 
@@ -284,6 +347,8 @@ if (!e) { WHEREAMI; return; }
 #endif
 e->type=TITLE_TYPE_EVENT;
 e->title.name=name;
+all->ishooked=1;
+all->taprun=NULL;
 (void)addevent(all,e);
 }
 
@@ -308,6 +373,8 @@ e=getevent(all);
 if (!e) { WHEREAMI; return; }
 #endif
 e->type=BELL_TYPE_EVENT;
+all->ishooked=1;
+all->taprun=NULL;
 (void)addevent(all,e);
 }
 
@@ -322,6 +389,8 @@ if (!e) { WHEREAMI; return; }
 e->type=MESSAGE_TYPE_EVENT;
 e->message.data=data;
 e->message.len=len;
+all->ishooked=1;
+all->taprun=NULL;
 (void)addevent(all,e);
 }
 
@@ -335,6 +404,8 @@ if (!e) { WHEREAMI; return; }
 e->type=SMESSAGE_TYPE_EVENT;
 memcpy(e->smessage.str,data,len);
 e->smessage.str[len]='\0';
+all->ishooked=1;
+all->taprun=NULL;
 (void)addevent(all,e);
 }
 void smessage_event(struct all_event *all, char *str) {
@@ -346,6 +417,8 @@ if (!e) { WHEREAMI; return; }
 #endif
 e->type=SMESSAGE_TYPE_EVENT;
 strcpy(e->smessage.str,str);
+all->ishooked=1;
+all->taprun=NULL;
 (void)addevent(all,e);
 }
 
@@ -357,9 +430,52 @@ if (!e) { WHEREAMI; return; }
 #endif
 e->type=TAP_TYPE_EVENT;
 e->tap.value=value;
+all->ishooked=1;
+all->taprun=NULL;
 (void)addevent(all,e);
 }
 
+unsigned int reservetaps_event(struct all_event *all, unsigned int count) {
+// returns how many of count values are available for taprun_event
+unsigned int n;
+n=all->taps.max-all->taps.len;
+if (n>=count) return count;
+all->events.isshort=1;
+return n;
+}
+
+uint32_t *taprun_event(struct all_event *all, unsigned int count) {
+// caller fills the returned values, count should be <= reservetaps_event()
+// values are added to the open run, so a parse slice needs one event for all of its full tap values
+struct one_event *e;
+uint32_t *values;
+#ifdef DEBUG
+if (count>all->taps.max-all->taps.len) { WHEREAMI; return NULL; }
+#endif
+values=all->taps.buffer+all->taps.len;
+if (all->taprun) {
+	all->taprun->taprun.count+=count; // the open run always ends at taps.len
+} else {
+	e=getevent(all);
+#ifdef DEBUG
+	if (!e) { WHEREAMI; return NULL; }
+#endif
+	e->type=TAPRUN_TYPE_EVENT;
+	e->taprun.values=values;
+	e->taprun.count=count;
+	all->ishooked=1;
+	all->taprun=e;
+	(void)addevent(all,e);
+}
+all->taps.len+=count;
+return values;
+}
+
+void endtaprun_event(struct all_event *all) {
+// the open run may be drawn before the next slice is parsed
+all->taprun=NULL;
+}
+
 void reverse_event(struct all_event *all) {
 struct one_event *e;
 e=getevent(all);
@@ -401,3 +517,213 @@ if (!e) { WHEREAMI; return; }
 e->type=RESET_TYPE_EVENT;
 (void)addevent(all,e);
 }
+
+#define WINDOW_PEEPHOLE	64 // how far ahead to look, keeps the passes linear
+
+static inline unsigned int upcount(struct one_event *e) {
+switch (e->type) {
+	case SCROLL1UP_TYPE_EVENT: return 1;
+	case SCROLLUP_TYPE_EVENT: return e->scrollup.count;
+}
+return 0;
+}
+
+static inline int ismovable(struct one_event *e) {
+// these only change cells or the (deferred) cursor
+switch (e->type) {
+	case ADDCHAR_TYPE_EVENT:
+	case ADDSTRING_TYPE_EVENT:
+	case ERASEINLINE_TYPE_EVENT:
+	case SETCURSOR_TYPE_EVENT:
+		return 1;
+}
+return 0;
+}
+
+static inline int getrows(unsigned int *first_out, unsigned int *last_out, struct one_event *e) {
+// returns 0 if e doesn't touch cells
+switch (e->type) {
+	case ADDCHAR_TYPE_EVENT: *first_out=*last_out=e->addchar.row; return 1;
+	case ADDSTRING_TYPE_EVENT: *first_out=*last_out=e->addstring.row; return 1;
+	case ERASEINLINE_TYPE_EVENT:
+		*first_out=e->eraseinline.row;
+		*last_out=e->eraseinline.row+e->eraseinline.rowcount-1;
+		return 1;
+}
+return 0;
+}
+
+static inline void shiftrows(struct one_event *e, unsigned int delta) {
+switch (e->type) {
+	case ADDCHAR_TYPE_EVENT: e->addchar.row-=delta; break;
+	case ADDSTRING_TYPE_EVENT: e->addstring.row-=delta; break;
+	case ERASEINLINE_TYPE_EVENT: e->eraseinline.row-=delta; break;
+}
+}
+
+static inline void unlinkevent(struct all_event *all, struct one_event *prev, struct one_event *e) {
+// prev is NULL if e is first
+if (prev) prev->next=e->next;
+else all->first=e->next;
+if (all->last==e) all->last=prev;
+(void)recycle_event(all,e);
+}
+
+static int mergescroll(struct all_event *all, struct one_event *e) {
+// e scrolls up, tries to absorb the next scroll up of the same region
+// writes in between are moved to where the second scroll would put them
+// returns 1 if merged
+struct one_event *n,*prev,*second=NULL,*secondprev=NULL;
+unsigned int top,bottom,count,count2,steps=0;
+
+top=e->scrollup.toprow;
+bottom=e->scrollup.bottomrow;
+count=upcount(e);
+prev=e;
+for (n=e->next;n;prev=n,n=n->next) {
+	if (ismovable(n)) {
+		steps++;
+		if (steps==WINDOW_PEEPHOLE) return 0;
+		continue;
+	}
+	if (upcount(n)) { second=n; secondprev=prev; }
+	break;
+}
+if (!second) return 0;
+if ((second->scrollup.toprow!=top)||(second->scrollup.bottomrow!=bottom)) return 0;
+if (second->scrollup.erasevalue!=e->scrollup.erasevalue) return 0;
+count2=upcount(second);
+if (count+count2>bottom-top+1) return 0; // scrollup would clamp, changing what goes to scrollback
+for (n=e->next;n!=second;n=n->next) {
+	unsigned int first,last;
+	if (!getrows(&first,&last,n)) continue;
+	if ((last<top)||(first>bottom)) continue;
+	if ((first>=top+count2)&&(last<=bottom)) continue;
+	return 0; // it writes to a line the second scroll removes
+}
+for (n=e->next;n!=second;n=n->next) {
+	unsigned int first,last;
+	if (!getrows(&first,&last,n)) continue;
+	if ((last<top)||(first>bottom)) continue;
+	(void)shiftrows(n,count2);
+}
+e->scrollup.count=count+count2; // scroll1up and scrollup share a layout
+e->type=SCROLLUP_TYPE_EVENT;
+(void)unlinkevent(all,secondprev,second);
+return 1;
+}
+
+static int iserased(struct one_event *e, unsigned int row, unsigned int first, unsigned int last) {
+// true if e replaces every cell in row[first..last]
+switch (e->type) {
+	case ADDCHAR_TYPE_EVENT:
+		return (e->addchar.row==row)&&(e->addchar.col==first)&&(first==last);
+	case ADDSTRING_TYPE_EVENT:
+		return (e->addstring.row==row)&&(e->addstring.col<=first)&&(e->addstring.col+e->addstring.count>last);
+	case ERASEINLINE_TYPE_EVENT:
+		if ((row<e->eraseinline.row)||(row>=e->eraseinline.row+e->eraseinline.rowcount)) return 0;
+		return (e->eraseinline.col<=first)&&(e->eraseinline.col+e->eraseinline.colcount>last);
+}
+return 0;
+}
+
+static int isdeadwrite(struct one_event *w) {
+// true if a later event overwrites or discards all of w's cells before anything can see them
+// lines scrolled off the top of the screen go to scrollback, so they're never dead
+struct one_event *e;
+unsigned int row,first,last,steps=0;
+
+if (w->type==ADDCHAR_TYPE_EVENT) {
+	row=w->addchar.row;
+	first=last=w->addchar.col;
+} else {
+	row=w->addstring.row;
+	first=w->addstring.col;
+	last=first+w->addstring.count-1;
+}
+for (e=w->next;e;e=e->next) {
+	unsigned int top,bottom,count;
+	steps++;
+	if (steps==WINDOW_PEEPHOLE) return 0;
+	switch (e->type) {
+		case ADDCHAR_TYPE_EVENT:
+		case ADDSTRING_TYPE_EVENT:
+		case ERASEINLINE_TYPE_EVENT:
+			if (iserased(e,row,first,last)) return 1;
+			continue;
+		case SETCURSOR_TYPE_EVENT: continue;
+		case SCROLL1UP_TYPE_EVENT:
+		case SCROLLUP_TYPE_EVENT:
+			top=e->scrollup.toprow;
+			bottom=e->scrollup.bottomrow;
+			count=upcount(e);
+			if ((row<top)||(row>bottom)) continue;
+			if (row<top+count) return (top)?1:0;
+			row-=count;
+			continue;
+		case SCROLL1DOWN_TYPE_EVENT:
+		case SCROLLDOWN_TYPE_EVENT:
+			top=e->scrolldown.toprow;
+			bottom=e->scrolldown.bottomrow;
+			count=(e->type==SCROLL1DOWN_TYPE_EVENT)?1:e->scrolldown.count;
+			if ((row<top)||(row>bottom)) continue;
+			if (row+count>bottom) return 1;
+			row+=count;
+			continue;
+	}
+	return 0;
+}
+return 0;
+}
+
+static int fuseerase(struct one_event *e, struct one_event *n) {
+// n follows e, both are erases, returns 1 if n was folded into e
+if (e->eraseinline.value!=n->eraseinline.value) return 0;
+if ((e->eraseinline.row==n->eraseinline.row)&&(e->eraseinline.rowcount==n->eraseinline.rowcount)) {
+	unsigned int first,last;
+	if (n->eraseinline.col>e->eraseinline.col+e->eraseinline.colcount) return 0;
+	if (n->eraseinline.col+n->eraseinline.colcount<e->eraseinline.col) return 0;
+	first=_BADMIN(e->eraseinline.col,n->eraseinline.col);
+	last=_BADMAX(e->eraseinline.col+e->eraseinline.colcount,n->eraseinline.col+n->eraseinline.colcount);
+	e->eraseinline.col=first;
+	e->eraseinline.colcount=last-first;
+	return 1;
+}
+if ((e->eraseinline.col==n->eraseinline.col)&&(e->eraseinline.colcount==n->eraseinline.colcount)) {
+	if (e->eraseinline.row+e->eraseinline.rowcount==n->eraseinline.row) {
+		e->eraseinline.rowcount+=n->eraseinline.rowcount;
+		return 1;
+	}
+	if (n->eraseinline.row+n->eraseinline.rowcount==e->eraseinline.row) {
+		e->eraseinline.row=n->eraseinline.row;
+		e->eraseinline.rowcount+=n->eraseinline.rowcount;
+		return 1;
+	}
+}
+return 0;
+}
+
+void peephole_event(struct all_event *all) {
+// rewrites pending events so a batch draws less, call before drawing them
+struct one_event *e,*prev,*next;
+
+for (e=all->first;e;e=e->next) {
+	if (!upcount(e)) continue;
+	while (mergescroll(all,e));
+}
+
+for (e=all->first;e;e=e->next) {
+	if (e->type!=ERASEINLINE_TYPE_EVENT) continue;
+	while ((next=e->next) && (next->type==ERASEINLINE_TYPE_EVENT) && fuseerase(e,next)) (void)unlinkevent(all,e,next);
+}
+
+prev=NULL;
+for (e=all->first;e;e=next) {
+	next=e->next;
+	if (((e->type==ADDCHAR_TYPE_EVENT)||(e->type==ADDSTRING_TYPE_EVENT)) && isdeadwrite(e)) {
+		(void)unlinkevent(all,prev,e);
+		continue;
+	}
+	prev=e;
+}
+}
@@ -35,6 +35,8 @@
 #define AUTOREPEAT_TYPE_EVENT	17
 #define TAP_TYPE_EVENT				18
 #define RESET_TYPE_EVENT			19
+#define ADDSTRING_TYPE_EVENT	20
+#define TAPRUN_TYPE_EVENT		21
 #if 0
 #define INSERTLINE_TYPE_EVENT	11
 #define DELETELINE_TYPE_EVENT	12
@@ -47,6 +49,11 @@ struct one_event {
 			uint32_t value;
 			unsigned int row,col;
 		} addchar;
+		struct {
+			uint32_t *cells; // points into all_event.cells
+			unsigned int row,col;
+			unsigned int count;
+		} addstring;
 		struct {
 			uint32_t value;
 			unsigned int row,col;
@@ -100,6 +107,10 @@ struct one_event {
 		struct {
 			unsigned int value;
 		} tap;
+		struct {
+			uint32_t *values; // for the full taps, in the taps arena
+			unsigned int count;
+		} taprun;
 		struct {
 		} reverse;
 		struct {
@@ -112,17 +123,31 @@ struct one_event {
 
 struct all_event {
 	struct one_event *first,*last;
+	int ishooked:1; // an event calls into scripts or points into vte, cleared when the list empties
+	struct {
+		struct one_event *buffer; // events are handed out in order, all are freed when the list empties
+		unsigned int max,len; // len is reset when all events are recycled
+		unsigned int limit; // max doubles up to this when we run short
+		int isshort:1; // a reservation failed since the last reset
+	} events;
+	struct {
+		uint32_t *buffer;
+		unsigned int max,len; // len is reset when all events are recycled
+	} cells;
 	struct {
-		unsigned int count;
-		struct one_event *first;
-	} unused;
-	struct one_event *events;
+		uint32_t *buffer;
+		unsigned int max,len; // len is reset when all events are recycled
+	} taps;
+	struct one_event *taprun; // run that taprun_event extends, bell, message, title and tap events end it so callbacks keep their order
 };
 
-int init_all_event(struct all_event *all, int num);
+int init_all_event(struct all_event *all, unsigned int num, unsigned int limit);
+int isroom_event(struct all_event *all, unsigned int count);
+unsigned int reservecells_event(struct all_event *all, unsigned int count);
 void deinit_all_event(struct all_event *all);
 void recycle_event(struct all_event *all, struct one_event *e);
 void addchar_event(struct all_event *all, uint32_t value, unsigned int row, unsigned int col);
+uint32_t *addstring_event(struct all_event *all, unsigned int row, unsigned int col, unsigned int count);
 void eraseinline_event(struct all_event *all, uint32_t value, unsigned int row, unsigned int rowcount,
 		unsigned int col, unsigned int colcount);
 void insertline_event(struct all_event *all, uint32_t value, unsigned int row, unsigned int bottom, unsigned int count);
@@ -137,6 +162,9 @@ void bell_event(struct all_event *all);
 void ich_event(struct all_event *all, uint32_t value, unsigned int row, unsigned int col, unsigned int count);
 void message_event(struct all_event *all, char *data, unsigned int len);
 void tap_event(struct all_event *all, unsigned int value);
+unsigned int reservetaps_event(struct all_event *all, unsigned int count);
+uint32_t *taprun_event(struct all_event *all, unsigned int count);
+void endtaprun_event(struct all_event *all);
 void reverse_event(struct all_event *all);
 void scroll1up_event(struct all_event *all, uint32_t value, unsigned int toprow, unsigned int bottomrow);
 void scroll1down_event(struct all_event *all, uint32_t value, unsigned int toprow, unsigned int bottomrow);
@@ -145,3 +173,4 @@ void smessage2_event(struct all_event *all, unsigned char *data, unsigned int le
 void appcursor_event(struct all_event *all, unsigned int isset);
 void autorepeat_event(struct all_event *all, unsigned int isset);
 void reset_event(struct all_event *all);
+void peephole_event(struct all_event *all);
@@ -0,0 +1,477 @@
+/*
+ * history.c - compressed scrollback lines
+ * Copyright (C) 2021 Sanjay Rao
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#define DEBUG
+#include "config.h"
+#include "common/conventions.h"
+#include "common/safemem.h"
+#include "common/blockmem.h"
+
+#include "history.h"
+
+/*
+	A line is stored as:
+		uint16_t cells,textcells,textbytes,spans
+		utf8 text of the first textcells cells, the rest are spaces
+		spans * { uint16_t count; uint32_t attributes; }, covering all cells
+	Nothing is aligned, so fields are memcpy'd.
+	Lines are allocated in order from a fifo of blockmem chunks, a chunk is
+	recycled once all of its lines have been evicted.
+	With spilling, evicted lines are appended to a file in the same format.
+	Line n of the file starts at offsets[n], the index is an mmap'd file too
+	so neither grows with the history in memory.
+*/
+
+#define HEADERSIZE	(4*sizeof(uint16_t))
+#define SPANSIZE	(sizeof(uint16_t)+sizeof(uint32_t))
+
+static inline uint32_t uninvert(uint32_t u) {
+// selection highlighting isn't kept, the selection is cleared by its backing pointers
+uint32_t n;
+if (!(u&SELECTINVERSION_VALUE)) return u;
+n=u&(UCS4_MASK_VALUE|UNDERLINEBIT_VALUE);
+n|=(u&FGINDEX_MASK_VALUE)>>4;
+n|=(u&BGINDEX_MASK_VALUE)<<4;
+return n;
+}
+
+static inline unsigned char *decodeutf8(uint32_t *u_out, unsigned char *src) {
+// we only decode what we encoded
+unsigned int c;
+c=*src;
+if (c<0x80) {
+	*u_out=c;
+	return src+1;
+}
+if (c<0xe0) {
+	*u_out=((c&0x1f)<<6)|(src[1]&0x3f);
+	return src+2;
+}
+if (c<0xf0) {
+	*u_out=((c&0x0f)<<12)|((src[1]&0x3f)<<6)|(src[2]&0x3f);
+	return src+3;
+}
+*u_out=((c&0x07)<<18)|((src[1]&0x3f)<<12)|((src[2]&0x3f)<<6)|(src[3]&0x3f);
+return src+4;
+}
+
+static int encodeline(unsigned int *size_out, struct history *history, uint32_t *cells, unsigned int len) {
+uint16_t header[4];
+unsigned int textcells,spans,ui,max;
+unsigned char *buffer,*dest;
+
+if (len>MAXCELLS_HISTORY) len=MAXCELLS_HISTORY;
+max=HEADERSIZE+len*(4+SPANSIZE);
+if (max>history->scratch.max) {
+	unsigned char *temp;
+	temp=REALLOC(history->scratch.buffer,max);
+	if (!temp) GOTOERROR;
+	history->scratch.buffer=temp;
+	history->scratch.max=max;
+}
+buffer=history->scratch.buffer;
+
+textcells=len;
+while (textcells) {
+	if ((uninvert(cells[textcells-1])&UCS4_MASK_VALUE)!=32) break;
+	textcells--;
+}
+
+dest=buffer+HEADERSIZE;
+for (ui=0;ui<textcells;ui++) dest=encodeutf8_history(dest,cells[ui]&UCS4_MASK_VALUE);
+header[2]=dest-(buffer+HEADERSIZE);
+
+spans=0;
+ui=0;
+while (ui<len) {
+	uint32_t attr;
+	uint16_t count;
+	attr=uninvert(cells[ui])&~UCS4_MASK_VALUE;
+	count=0;
+	while (1) {
+		count++;
+		ui++;
+		if (ui==len) break;
+		if ((uninvert(cells[ui])&~UCS4_MASK_VALUE)!=attr) break;
+	}
+	memcpy(dest,&count,sizeof(uint16_t));
+	memcpy(dest+sizeof(uint16_t),&attr,sizeof(uint32_t));
+	dest+=SPANSIZE;
+	spans++;
+}
+
+header[0]=len;
+header[1]=textcells;
+header[3]=spans;
+memcpy(buffer,header,HEADERSIZE);
+
+*size_out=dest-buffer;
+return 0;
+error:
+	return -1;
+}
+
+static struct chunk_history *newchunk(struct history *history) {
+struct chunk_history *chunk;
+if ((chunk=history->chunks.firstfree)) {
+	history->chunks.firstfree=chunk->next;
+	history->chunks.freecount-=1;
+} else {
+	if (!(chunk=MALLOC(sizeof(struct chunk_history)))) GOTOERROR;
+	memset(chunk,0,sizeof(struct chunk_history));
+	if (init_blockmem(&chunk->blockmem,CHUNKSIZE_HISTORY)) {
+		FREE(chunk);
+		GOTOERROR;
+	}
+}
+chunk->count=0;
+chunk->next=NULL;
+if (history->chunks.last) history->chunks.last->next=chunk;
+else history->chunks.first=chunk;
+history->chunks.last=chunk;
+return chunk;
+error:
+	return NULL;
+}
+
+static void freechunk(struct chunk_history *chunk) {
+deinit_blockmem(&chunk->blockmem);
+FREE(chunk);
+}
+
+static inline unsigned int recordsize(unsigned char *record) {
+uint16_t header[4];
+memcpy(header,record,HEADERSIZE);
+return HEADERSIZE+header[2]+header[3]*SPANSIZE;
+}
+
+static int writeall(int fd, unsigned char *data, unsigned int len) {
+while (len) {
+	ssize_t k;
+	k=write(fd,data,len);
+	if (k<=0) GOTOERROR;
+	data+=k;
+	len-=k;
+}
+return 0;
+error:
+	return -1;
+}
+
+static int flushspill(struct history *history) {
+if (!history->spill.buffer.len) return 0;
+if (writeall(history->spill.fd,history->spill.buffer.data,history->spill.buffer.len)) GOTOERROR;
+history->spill.buffer.len=0;
+return 0;
+error:
+	return -1;
+}
+
+static int growindex(struct history *history) {
+uint64_t *temp;
+unsigned int max;
+max=history->spill.max+INDEXGROW_HISTORY;
+if (max<history->spill.max) GOTOERROR; // 4G lines
+if (ftruncate(history->spill.indexfd,(off_t)max*sizeof(uint64_t))) GOTOERROR;
+temp=mremap(history->spill.offsets,(size_t)history->spill.max*sizeof(uint64_t),(size_t)max*sizeof(uint64_t),MREMAP_MAYMOVE);
+if (temp==MAP_FAILED) GOTOERROR;
+history->spill.offsets=temp;
+history->spill.max=max;
+return 0;
+error:
+	return -1;
+}
+
+static int spillline(struct history *history, unsigned char *record) {
+unsigned int size;
+
+if (history->spill.count==history->spill.max) {
+	if (growindex(history)) GOTOERROR;
+}
+size=recordsize(record);
+if (history->spill.buffer.len+size>WRITEBUFFER_HISTORY) {
+	if (flushspill(history)) GOTOERROR;
+}
+if (size>WRITEBUFFER_HISTORY) {
+	if (writeall(history->spill.fd,record,size)) GOTOERROR;
+} else {
+	memcpy(history->spill.buffer.data+history->spill.buffer.len,record,size);
+	history->spill.buffer.len+=size;
+}
+history->spill.offsets[history->spill.count]=history->spill.size;
+history->spill.size+=size;
+history->spill.count+=1;
+return 0;
+error:
+	return -1;
+}
+
+static void dropspill(struct history *history) {
+// after a failed write the spilled lines can't be trusted to be contiguous with the ring
+// so they're all forgotten, line numbers stay added-lines_history
+history->spill.iserror=1;
+history->spill.count=0;
+history->spill.size=0;
+history->spill.buffer.len=0;
+history->spill.hintlast=0;
+(ignore)ftruncate(history->spill.fd,0);
+}
+
+static void evictline(struct history *history) {
+struct chunk_history *chunk;
+
+if ((history->spill.fd>=0)&&(!history->spill.iserror)) {
+	if (spillline(history,history->lines[history->first])) {
+		fprintf(stderr,"%s:%d error spilling scrollback, spilled and evicted lines will be dropped\n",__FILE__,__LINE__);
+		(void)dropspill(history);
+	}
+}
+
+history->first+=1;
+if (history->first==history->max) history->first=0;
+history->count-=1;
+
+chunk=history->chunks.first;
+chunk->count-=1;
+if (chunk->count) return;
+if (chunk==history->chunks.last) { // older chunks are already gone
+	(void)reset_blockmem(&chunk->blockmem);
+	return;
+}
+history->chunks.first=chunk->next;
+if (history->chunks.freecount<SPARECHUNKS_HISTORY) {
+	(void)reset_blockmem(&chunk->blockmem);
+	chunk->next=history->chunks.firstfree;
+	history->chunks.firstfree=chunk;
+	history->chunks.freecount+=1;
+} else {
+	(void)freechunk(chunk);
+}
+}
+
+int add_history(struct history *history, uint32_t *cells, unsigned int len) {
+struct chunk_history *chunk;
+struct node_blockmem *node;
+unsigned int size,index;
+unsigned char *dest;
+
+if (!history->max) return 0;
+if (encodeline(&size,history,cells,len)) GOTOERROR;
+if (history->count==history->max) (void)evictline(history);
+
+chunk=history->chunks.last;
+if (chunk && chunk->count) {
+	node=&chunk->blockmem.node;
+	if (node->num+size>node->max) chunk=NULL;
+}
+if (!chunk) {
+	if (!(chunk=newchunk(history))) GOTOERROR;
+}
+if (!(dest=alloc_blockmem(&chunk->blockmem,size))) GOTOERROR;
+memcpy(dest,history->scratch.buffer,size);
+chunk->count+=1;
+
+index=history->first+history->count;
+if (index>=history->max) index-=history->max;
+history->lines[index]=dest;
+history->count+=1;
+history->added+=1;
+return 0;
+error:
+	return -1;
+}
+
+static void hintspill(struct history *history, unsigned int index) {
+// the kernel reads ahead in the background so paging back further doesn't wait on the disk
+unsigned int first;
+uint64_t start,stop;
+if ((history->spill.hintlast)&&(index>=history->spill.hintfirst)&&(index<history->spill.hintlast)) return;
+first=(index>READAHEAD_HISTORY)?index-READAHEAD_HISTORY:0;
+start=history->spill.offsets[first];
+stop=(index+1<history->spill.count)?history->spill.offsets[index+1]:history->spill.size;
+(ignore)posix_fadvise(history->spill.fd,start,stop-start,POSIX_FADV_WILLNEED);
+(ignore)posix_fadvise(history->spill.indexfd,(off_t)first*sizeof(uint64_t),(off_t)(index+1-first)*sizeof(uint64_t),POSIX_FADV_WILLNEED);
+history->spill.hintfirst=first;
+history->spill.hintlast=index+1;
+}
+
+static unsigned char *readspill(struct history *history, unsigned int index) {
+uint64_t offset,stop,unwritten;
+unsigned int size;
+
+offset=history->spill.offsets[index];
+stop=(index+1<history->spill.count)?history->spill.offsets[index+1]:history->spill.size;
+size=stop-offset;
+unwritten=history->spill.size-history->spill.buffer.len;
+if (offset>=unwritten) return history->spill.buffer.data+(offset-unwritten);
+
+(void)hintspill(history,index);
+if (size>history->scratch.max) {
+	unsigned char *temp;
+	temp=REALLOC(history->scratch.buffer,size);
+	if (!temp) GOTOERROR;
+	history->scratch.buffer=temp;
+	history->scratch.max=size;
+}
+if (pread(history->spill.fd,history->scratch.buffer,size,offset)!=size) GOTOERROR;
+return history->scratch.buffer;
+error:
+	return NULL;
+}
+
+static void decodeline(uint32_t *cells, unsigned int len, unsigned char *record) {
+uint16_t header[4];
+unsigned int textcells,spans,ui,num;
+unsigned char *src;
+uint32_t attr=0;
+
+memcpy(header,record,HEADERSIZE);
+src=record+HEADERSIZE;
+
+num=_BADMIN(header[0],len);
+textcells=_BADMIN(header[1],num);
+for (ui=0;ui<textcells;ui++) src=decodeutf8(cells+ui,src);
+for (;ui<num;ui++) cells[ui]=32;
+
+src=record+HEADERSIZE+header[2];
+spans=header[3];
+ui=0;
+while (spans) {
+	uint16_t count;
+	memcpy(&count,src,sizeof(uint16_t));
+	memcpy(&attr,src+sizeof(uint16_t),sizeof(uint32_t));
+	src+=SPANSIZE;
+	while (count) {
+		if (ui==num) break;
+		cells[ui]|=attr;
+		ui++;
+		count--;
+	}
+	spans--;
+}
+for (ui=num;ui<len;ui++) cells[ui]=32|attr; // the terminal was narrower then
+}
+
+static unsigned char *getrecord(struct history *history, unsigned int back) {
+unsigned int index;
+if (back<history->count) {
+	index=history->first+history->count-1-back;
+	if (index>=history->max) index-=history->max;
+	return history->lines[index];
+}
+return readspill(history,history->spill.count-1-(back-history->count));
+}
+
+unsigned char *text_history(unsigned int *len_out, struct history *history, unsigned int back) {
+// the utf8 of the line without trailing blanks, valid until the next call
+uint16_t header[4];
+unsigned char *record;
+if (!(record=getrecord(history,back))) return NULL;
+memcpy(header,record,HEADERSIZE);
+*len_out=header[2];
+return record+HEADERSIZE;
+}
+
+void get_history(uint32_t *cells, unsigned int len, struct history *history, unsigned int back) {
+// back: 0 => newest line, must be < lines_history(history)
+unsigned char *record;
+
+record=getrecord(history,back);
+if (!record) {
+	unsigned int ui;
+	for (ui=0;ui<len;ui++) cells[ui]=32;
+	return;
+}
+(void)decodeline(cells,len,record);
+}
+
+int init_history(struct history *history, unsigned int max) {
+history->spill.fd=history->spill.indexfd=-1;
+history->max=max;
+if (!max) return 0;
+if (!(history->lines=MALLOC(max*sizeof(unsigned char *)))) GOTOERROR;
+return 0;
+error:
+	return -1;
+}
+
+void deinit_history(struct history *history) {
+struct chunk_history *chunk;
+chunk=history->chunks.first;
+while (chunk) {
+	struct chunk_history *next;
+	next=chunk->next;
+	(void)freechunk(chunk);
+	chunk=next;
+}
+chunk=history->chunks.firstfree;
+while (chunk) {
+	struct chunk_history *next;
+	next=chunk->next;
+	(void)freechunk(chunk);
+	chunk=next;
+}
+IFFREE(history->scratch.buffer);
+IFFREE(history->lines);
+if (history->spill.offsets) (ignore)munmap(history->spill.offsets,(size_t)history->spill.max*sizeof(uint64_t));
+ifclose(history->spill.fd);
+ifclose(history->spill.indexfd);
+IFFREE(history->spill.buffer.data);
+}
+
+static int opentemp(char *dir) {
+// the file is gone when we exit, even if we crash
+char filename[PATH_MAX];
+int fd;
+if (snprintf(filename,PATH_MAX,"%s/xapterm-XXXXXX",dir)>=PATH_MAX) GOTOERROR;
+if (0>(fd=mkstemp(filename))) GOTOERROR;
+(ignore)unlink(filename);
+return fd;
+error:
+	return -1;
+}
+
+int spill_history(struct history *history, char *dir) {
+void *offsets;
+if (0>(history->spill.fd=opentemp(dir))) GOTOERROR;
+if (0>(history->spill.indexfd=opentemp(dir))) GOTOERROR;
+if (ftruncate(history->spill.indexfd,INDEXGROW_HISTORY*sizeof(uint64_t))) GOTOERROR;
+offsets=mmap(NULL,INDEXGROW_HISTORY*sizeof(uint64_t),PROT_READ|PROT_WRITE,MAP_SHARED,history->spill.indexfd,0);
+if (offsets==MAP_FAILED) GOTOERROR;
+history->spill.offsets=offsets;
+history->spill.max=INDEXGROW_HISTORY;
+if (!(history->spill.buffer.data=MALLOC(WRITEBUFFER_HISTORY))) GOTOERROR;
+return 0;
+error:
+	if (history->spill.offsets) (ignore)munmap(history->spill.offsets,(size_t)history->spill.max*sizeof(uint64_t));
+	history->spill.offsets=NULL;
+	history->spill.max=0;
+	ifclose(history->spill.fd);
+	ifclose(history->spill.indexfd);
+	history->spill.fd=history->spill.indexfd=-1;
+	return -1;
+}
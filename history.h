@@ -0,0 +1,93 @@
+/*
+ * history.h
+ * Copyright (C) 2021 Sanjay Rao
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#define CHUNKSIZE_HISTORY	DEFAULTSIZE_BLOCKMEM
+#define SPARECHUNKS_HISTORY	2
+#define MAXCELLS_HISTORY	16383 // so 4 byte utf8 still fits the uint16_t text length
+#define INDEXGROW_HISTORY	(1<<20) // spilled offsets added to the index at a time
+#define WRITEBUFFER_HISTORY	DEFAULTSIZE_BLOCKMEM
+#define READAHEAD_HISTORY	4096 // spilled lines hinted past one that's paged in
+
+struct chunk_history {
+	struct blockmem blockmem; // encoded lines, in order
+	unsigned int count; // lines in here that haven't been evicted
+	struct chunk_history *next;
+};
+
+struct history {
+	unsigned char **lines; // ring of encoded lines, [max]
+	unsigned int max; // 0 => no scrollback
+	unsigned int first; // index of the oldest line
+	unsigned int count;
+	uint64_t added; // lines ever added, the newest line is number added-1
+	struct {
+		struct chunk_history *first,*last; // first holds the oldest lines, last gets new ones
+		struct chunk_history *firstfree;
+		unsigned int freecount;
+	} chunks;
+	struct {
+		unsigned char *buffer; // a line is encoded here before it's sized into a chunk, spilled lines are read here
+		unsigned int max;
+	} scratch;
+	struct { // evicted lines are appended to an unlinked file, older than everything in lines
+		int fd,indexfd; // -1 => not spilling
+		uint64_t *offsets; // mmap of indexfd, [max], where each line starts in fd
+		unsigned int count,max;
+		uint64_t size; // bytes spilled, including the buffer
+		struct {
+			unsigned char *data; // [WRITEBUFFER_HISTORY], starts at size-len in the file
+			unsigned int len;
+		} buffer;
+		unsigned int hintfirst,hintlast; // lines that were last passed to fadvise, hintlast==0 => none
+		int iserror:1; // stopped spilling, the spilled lines were forgotten and evicted lines are dropped again
+	} spill;
+};
+
+#define lines_history(a) ((a)->count+(a)->spill.count)
+#define oldest_history(a) ((a)->added-lines_history(a)) // number of the oldest line still around
+
+static inline unsigned char *encodeutf8_history(unsigned char *dest, uint32_t u) {
+// lines are stored with this, search matches text_history against live rows encoded the same way
+if (u<0x80) {
+	*dest=u;
+	return dest+1;
+}
+if (u<0x800) {
+	dest[0]=0xc0|(u>>6);
+	dest[1]=0x80|(u&0x3f);
+	return dest+2;
+}
+if (u<0x10000) {
+	dest[0]=0xe0|(u>>12);
+	dest[1]=0x80|((u>>6)&0x3f);
+	dest[2]=0x80|(u&0x3f);
+	return dest+3;
+}
+dest[0]=0xf0|(u>>18);
+dest[1]=0x80|((u>>12)&0x3f);
+dest[2]=0x80|((u>>6)&0x3f);
+dest[3]=0x80|(u&0x3f);
+return dest+4;
+}
+
+int init_history(struct history *history, unsigned int max);
+void deinit_history(struct history *history);
+int spill_history(struct history *history, char *dir);
+int add_history(struct history *history, uint32_t *cells, unsigned int len);
+void get_history(uint32_t *cells, unsigned int len, struct history *history, unsigned int back);
+unsigned char *text_history(unsigned int *len_out, struct history *history, unsigned int back);
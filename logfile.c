@@ -0,0 +1,316 @@
+/*
+ * logfile.c - tee the pty's output to a file from a writer thread
+ * Copyright (C) 2021 Sanjay Rao
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#define DEBUG
+#include "common/conventions.h"
+#include "common/safemem.h"
+
+#include "logfile.h"
+
+/*
+	The main thread copies each chunk it peeks from the pty into the ring
+	with a struct chunk_logfile in front of it, nothing else. If the ring is
+	full the chunk is dropped and counted, the main thread never waits.
+	The next chunk that fits carries the count, and the writer puts a
+	marker line in the log where the bytes are missing.
+	The writer thread drains the ring every FLUSHMS_LOGFILE, or sooner if
+	WAKEBYTES_LOGFILE are waiting, and writes OUTSIZE_LOGFILE at a time.
+	With timing, a script(1) style timing file gets "delay bytes" per chunk
+	so the log can be played back with scriptreplay.
+*/
+
+static void wake(int fd) {
+uint64_t u=1;
+(ignore)write(fd,&u,sizeof(u));
+}
+
+static uint64_t getstamp(void) {
+struct timespec ts;
+(ignore)clock_gettime(CLOCK_REALTIME,&ts);
+return (uint64_t)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+static void copyin(struct logfile *logfile, unsigned int head, void *src, unsigned int len) {
+unsigned int offset,k;
+offset=head&(RINGSIZE_LOGFILE-1);
+k=RINGSIZE_LOGFILE-offset;
+if (k>=len) {
+	memcpy(logfile->ring.buffer+offset,src,len);
+} else {
+	memcpy(logfile->ring.buffer+offset,src,k);
+	memcpy(logfile->ring.buffer,(unsigned char *)src+k,len-k);
+}
+}
+
+static void copyout(void *dest, struct logfile *logfile, unsigned int tail, unsigned int len) {
+unsigned int offset,k;
+offset=tail&(RINGSIZE_LOGFILE-1);
+k=RINGSIZE_LOGFILE-offset;
+if (k>=len) {
+	memcpy(dest,logfile->ring.buffer+offset,len);
+} else {
+	memcpy(dest,logfile->ring.buffer+offset,k);
+	memcpy((unsigned char *)dest+k,logfile->ring.buffer,len-k);
+}
+}
+
+static int writeall(int fd, unsigned char *data, unsigned int len) {
+while (len) {
+	ssize_t k;
+	k=write(fd,data,len);
+	if (k<=0) {
+		if ((k<0) && (errno==EINTR)) continue;
+		GOTOERROR;
+	}
+	data+=k;
+	len-=k;
+}
+return 0;
+error:
+	return -1;
+}
+
+static void flushout(struct logfile *logfile) {
+unsigned int len;
+len=logfile->out.len;
+if (!len) return;
+logfile->out.len=0;
+if (logfile->iserror) return;
+if (logfile->gz) {
+	if (gzwrite((gzFile)logfile->gz,logfile->out.buffer,len)!=(int)len) GOTOERROR;
+} else {
+	if (writeall(logfile->fd,logfile->out.buffer,len)) GOTOERROR;
+}
+return;
+error:
+	__atomic_store_n(&logfile->iserror,1,__ATOMIC_SEQ_CST);
+}
+
+static void addout(struct logfile *logfile, unsigned int tail, unsigned int len) {
+// copies len bytes of the ring at tail to out, writing out as it fills
+while (len) {
+	unsigned int k;
+	k=OUTSIZE_LOGFILE-logfile->out.len;
+	if (k>len) k=len;
+	copyout(logfile->out.buffer+logfile->out.len,logfile,tail,k);
+	logfile->out.len+=k;
+	if (logfile->out.len==OUTSIZE_LOGFILE) flushout(logfile);
+	tail+=k;
+	len-=k;
+}
+}
+
+static void addbytes(struct logfile *logfile, void *data, unsigned int len) {
+// like addout, for bytes that aren't in the ring
+while (len) {
+	unsigned int k;
+	k=OUTSIZE_LOGFILE-logfile->out.len;
+	if (k>len) k=len;
+	memcpy(logfile->out.buffer+logfile->out.len,data,k);
+	logfile->out.len+=k;
+	if (logfile->out.len==OUTSIZE_LOGFILE) flushout(logfile);
+	data=(unsigned char *)data+k;
+	len-=k;
+}
+}
+
+static void addtiming(struct logfile *logfile, uint64_t stamp, unsigned int len) {
+uint64_t delay;
+if (!logfile->timing) return;
+delay=(stamp>logfile->laststamp)?stamp-logfile->laststamp:0;
+logfile->laststamp=stamp;
+(ignore)fprintf(logfile->timing,"%u.%06u %u\n",(unsigned int)(delay/1000000),(unsigned int)(delay%1000000),len);
+}
+
+static void addgap(struct logfile *logfile, uint64_t gap, uint64_t stamp) {
+// a visible marker where output was dropped, it's in the timing file too so replay stays in step
+char buff[80];
+int n;
+n=snprintf(buff,sizeof(buff),"\r\n[xapterm: %"PRIu64" bytes missing from this log]\r\n",gap);
+addbytes(logfile,buff,n);
+addtiming(logfile,stamp,n);
+}
+
+static void drain(struct logfile *logfile) {
+unsigned int head,tail;
+tail=logfile->ring.tail;
+head=__atomic_load_n(&logfile->ring.head,__ATOMIC_ACQUIRE);
+if (head==tail) return;
+while (head!=tail) {
+	struct chunk_logfile chunk;
+	copyout(&chunk,logfile,tail,sizeof(chunk));
+	tail+=sizeof(chunk);
+	if (chunk.gap) addgap(logfile,chunk.gap,chunk.stamp);
+	addout(logfile,tail,chunk.len);
+	tail+=chunk.len;
+	addtiming(logfile,chunk.stamp,chunk.len);
+}
+__atomic_store_n(&logfile->ring.tail,tail,__ATOMIC_SEQ_CST);
+flushout(logfile);
+if (logfile->iserror) return;
+if (logfile->gz) {
+	if (Z_OK!=gzflush((gzFile)logfile->gz,Z_SYNC_FLUSH)) __atomic_store_n(&logfile->iserror,1,__ATOMIC_SEQ_CST);
+}
+if (logfile->timing) {
+	if (fflush(logfile->timing)) __atomic_store_n(&logfile->iserror,1,__ATOMIC_SEQ_CST);
+}
+}
+
+static void *writer_logfile(void *v) {
+// the only writer of .tail
+struct logfile *logfile=(struct logfile *)v;
+sigset_t set;
+(ignore)sigfillset(&set);
+(ignore)pthread_sigmask(SIG_BLOCK,&set,NULL); // signals stay with the main thread
+while (1) {
+	struct pollfd pollfd;
+	uint64_t u;
+	drain(logfile);
+	if (__atomic_load_n(&logfile->ring.isquit,__ATOMIC_SEQ_CST)) {
+		drain(logfile); // anything added before isquit was set
+		break;
+	}
+	__atomic_store_n(&logfile->ring.iswait,1,__ATOMIC_SEQ_CST);
+	pollfd.fd=logfile->ring.wakefd;
+	pollfd.events=POLLIN;
+	if (0<poll(&pollfd,1,FLUSHMS_LOGFILE)) (ignore)read(logfile->ring.wakefd,&u,sizeof(u));
+	__atomic_store_n(&logfile->ring.iswait,0,__ATOMIC_SEQ_CST);
+}
+return NULL;
+}
+
+void write_logfile(struct logfile *logfile, unsigned char *data, unsigned int len) {
+// called only from the main thread, copies data into the ring or drops it
+struct chunk_logfile chunk;
+unsigned int head,tail,need;
+if (!len) return;
+if (__atomic_load_n(&logfile->iserror,__ATOMIC_RELAXED)) goto drop;
+need=sizeof(chunk)+len;
+head=logfile->ring.head;
+tail=__atomic_load_n(&logfile->ring.tail,__ATOMIC_ACQUIRE);
+if (RINGSIZE_LOGFILE-(head-tail)<need) goto drop;
+chunk.stamp=getstamp();
+chunk.gap=logfile->gap;
+chunk.len=len;
+chunk.padding=0;
+copyin(logfile,head,&chunk,sizeof(chunk));
+copyin(logfile,head+sizeof(chunk),data,len);
+head+=need;
+logfile->gap=0;
+__atomic_store_n(&logfile->ring.head,head,__ATOMIC_SEQ_CST);
+__atomic_store_n(&logfile->stats.bytes,logfile->stats.bytes+len,__ATOMIC_RELAXED);
+if ((head-tail>=WAKEBYTES_LOGFILE) && __atomic_exchange_n(&logfile->ring.iswait,0,__ATOMIC_SEQ_CST)) (void)wake(logfile->ring.wakefd);
+return;
+drop:
+	logfile->gap+=len;
+	__atomic_store_n(&logfile->stats.dropped,logfile->stats.dropped+len,__ATOMIC_RELAXED);
+}
+
+static int writeheader(struct logfile *logfile) {
+// scriptreplay skips the first line of the log
+char buff[128];
+struct tm tm;
+time_t t;
+int n;
+t=time(NULL);
+if (!localtime_r(&t,&tm)) GOTOERROR;
+n=strftime(buff,sizeof(buff),"Script started on %Y-%m-%d %H:%M:%S%z\n",&tm);
+if (!n) GOTOERROR;
+if (logfile->gz) {
+	if (gzwrite((gzFile)logfile->gz,buff,n)!=n) GOTOERROR;
+} else {
+	if (writeall(logfile->fd,(unsigned char *)buff,n)) GOTOERROR;
+}
+return 0;
+error:
+	return -1;
+}
+
+int init_logfile(struct logfile *logfile, char *filename, int istiming, int iscompress) {
+logfile->fd=logfile->ring.wakefd=-1;
+
+if (0>(logfile->fd=open(filename,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0600))) GOTOERROR;
+if (iscompress) {
+	if (!(logfile->gz=gzdopen(logfile->fd,"wb1"))) GOTOERROR;
+	logfile->fd=-1; // gzclose closes it now
+}
+if (istiming) {
+	char *timingname;
+	int fd;
+	if (!(timingname=MALLOC(strlen(filename)+8))) GOTOERROR;
+	sprintf(timingname,"%s.timing",filename);
+	fd=open(timingname,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0600);
+	FREE(timingname);
+	if (fd<0) GOTOERROR;
+	if (!(logfile->timing=fdopen(fd,"w"))) {
+		(ignore)close(fd);
+		GOTOERROR;
+	}
+	if (writeheader(logfile)) GOTOERROR;
+}
+logfile->laststamp=getstamp();
+
+if (!(logfile->out.buffer=MALLOC(OUTSIZE_LOGFILE))) GOTOERROR;
+logfile->ring.buffer=mmap(NULL,RINGSIZE_LOGFILE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+if (logfile->ring.buffer==MAP_FAILED) { logfile->ring.buffer=NULL; GOTOERROR; }
+if (0>(logfile->ring.wakefd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC))) GOTOERROR;
+if (pthread_create(&logfile->ring.thread,NULL,writer_logfile,logfile)) GOTOERROR;
+logfile->ring.isthread=1;
+return 0;
+error:
+	return -1;
+}
+
+void deinit_logfile(struct logfile *logfile) {
+// the writer empties the ring before it quits
+if (logfile->ring.isthread) {
+	__atomic_store_n(&logfile->ring.isquit,1,__ATOMIC_SEQ_CST);
+	(void)wake(logfile->ring.wakefd);
+	(ignore)pthread_join(logfile->ring.thread,NULL);
+	logfile->ring.isthread=0;
+	if (logfile->gap) { // dropped at the end, nothing came after to carry it
+		addgap(logfile,logfile->gap,getstamp());
+		flushout(logfile);
+	}
+	if (logfile->stats.dropped || logfile->iserror) {
+		fprintf(stderr,"Session log: %"PRIu64" of %"PRIu64" bytes were dropped%s\n",logfile->stats.dropped,
+				logfile->stats.bytes+logfile->stats.dropped,(logfile->iserror)?" after a write error":"");
+	}
+}
+if (logfile->gz) (ignore)gzclose((gzFile)logfile->gz);
+ifclose(logfile->fd);
+iffclose(logfile->timing);
+ifclose(logfile->ring.wakefd);
+if (logfile->ring.buffer) (ignore)munmap(logfile->ring.buffer,RINGSIZE_LOGFILE);
+IFFREE(logfile->out.buffer);
+}
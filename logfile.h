@@ -0,0 +1,59 @@
+/*
+ * logfile.h
+ * Copyright (C) 2021 Sanjay Rao
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#define RINGSIZE_LOGFILE	(1<<22) // power of 2
+#define WAKEBYTES_LOGFILE	(1<<18) // the writer is woken early once this much is waiting
+#define FLUSHMS_LOGFILE	1000 // otherwise it writes what it has this often
+#define OUTSIZE_LOGFILE	(1<<18) // bytes collected for each write()
+
+struct chunk_logfile { // in the ring before each chunk's data
+	uint64_t stamp; // microseconds, CLOCK_REALTIME
+	uint64_t gap; // bytes dropped right before this chunk, the writer marks them in the log
+	uint32_t len;
+	uint32_t padding;
+};
+
+struct logfile {
+	int fd;
+	void *gz; // gzFile, NULL unless compressing
+	FILE *timing; // NULL unless timing
+	uint64_t laststamp; // of the previous chunk, for timing
+	struct {
+		unsigned char *buffer; // RINGSIZE_LOGFILE
+		unsigned int head; // written only by the main thread
+		unsigned int tail; // written only by the writer thread
+		int iswait; // writer wants wakefd written once WAKEBYTES_LOGFILE are waiting
+		int isquit;
+		int wakefd; // eventfd
+		int isthread;
+		pthread_t thread;
+	} ring;
+	struct {
+		unsigned char *buffer; // OUTSIZE_LOGFILE
+		unsigned int len;
+	} out; // only touched by the writer thread, and by deinit_logfile once it's joined
+	int iserror; // writer stopped writing, chunks are dropped
+	uint64_t gap; // bytes dropped since the last chunk that fit, only touched by the main thread
+	struct {
+		uint64_t bytes,dropped; // written by the main thread, read with __atomic
+	} stats;
+};
+
+int init_logfile(struct logfile *logfile, char *filename, int istiming, int iscompress);
+void deinit_logfile(struct logfile *logfile);
+void write_logfile(struct logfile *logfile, unsigned char *data, unsigned int len);
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <pty.h>
+#include <pthread.h>
 #include <ctype.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -30,16 +31,21 @@
 #include "common/conventions.h"
 #include "common/safemem.h"
 #include "common/blockmem.h"
+#include "common/lazydfa.h"
 #include "common/texttap.h"
 #include "config.h"
 #include "x11info.h"
 #include "xftchar.h"
 #include "charcache.h"
+#include "shmdraw.h"
 #include "pty.h"
 #include "event.h"
+#include "logfile.h"
 #include "vte.h"
 #include "cursor.h"
 #include "xclipboard.h"
+#include "history.h"
+#include "search.h"
 #include "xclient.h"
 #include "script.h"
 #include "cscript.h"
@@ -106,9 +112,11 @@ error:
 SICLEARFUNC(x11info);
 SICLEARFUNC(xftchar);
 SICLEARFUNC(charcache);
+SICLEARFUNC(shmdraw);
 SICLEARFUNC(pty);
 SICLEARFUNC(all_event);
 SICLEARFUNC(vte);
+SICLEARFUNC(logfile);
 SICLEARFUNC(xclient);
 SICLEARFUNC(cursor);
 SICLEARFUNC(texttap);
@@ -119,12 +127,15 @@ struct config config;
 struct x11info x11info;
 struct xftchar xftchar;
 struct charcache charcache;
+struct charcache maskcache,*maskcachep=NULL;
+struct shmdraw shmdraw,*shmdrawp=NULL;
 struct texttap texttap;
 struct xclient xclient;
 struct cursor cursor;
 struct pty pty;
-struct all_event all_event;
+struct all_event all_event,spare_event;
 struct vte vte;
+struct logfile logfile,*logfilep=NULL;
 struct script *script=NULL;
 void *cscript=NULL;
 struct xclipboard xclipboard;
@@ -136,10 +147,14 @@ char **pargv;
 clear_x11info(&x11info);
 clear_xftchar(&xftchar);
 clear_charcache(&charcache);
+clear_charcache(&maskcache);
+clear_shmdraw(&shmdraw);
 clear_texttap(&texttap);
 clear_pty(&pty);
 clear_all_event(&all_event);
+clear_all_event(&spare_event);
 clear_vte(&vte);
+clear_logfile(&logfile);
 clear_xclient(&xclient);
 clear_cursor(&cursor);
 clear_xclipboard(&xclipboard);
@@ -169,10 +184,25 @@ x11info.depth=config.depth;
 if (init_x11info(&x11info,config.xwidth,config.xheight,NULL,config.bgbgra,config.isfullscreen,TERMXTITLE_CONFIG)) GOTOERROR;
 if (init_cursor(&cursor,&config,&x11info)) GOTOERROR;
 if (init_xftchar(&xftchar,&config,&x11info)) GOTOERROR;
-if (init_charcache(&charcache,&x11info,config.charcache,config.cellw,config.cellh)) GOTOERROR; // count: 2000 has worked fine
+if (init_charcache(&charcache,&x11info,config.charcache,config.cellw,config.cellh,xftchar.render.visual)) GOTOERROR; // count: 2000 has worked fine
+if (xftchar.render.isavailable) {
+	if (init_charcache(&maskcache,&x11info,config.charcache,config.cellw,config.cellh,xftchar.render.a8)) GOTOERROR;
+	maskcachep=&maskcache;
+}
+if (config.isshmdraw) {
+	if (!maskcachep) {
+		fprintf(stderr,"isshmdraw needs XRender, ignoring\n");
+	} else if (init_shmdraw(&shmdraw,&x11info,config.charcache,config.rows,config.columns,config.cellw,config.cellh)) {
+		fprintf(stderr,"isshmdraw failed, using X drawing\n");
+		deinit_shmdraw(&shmdraw);
+		clear_shmdraw(&shmdraw);
+	} else {
+		shmdrawp=&shmdraw;
+	}
+}
 if (init_texttap(&texttap)) GOTOERROR;
 if (init_pty(&pty,config.columns,config.rows,config.cmdline)) GOTOERROR;
-if (init_all_event(&all_event,500)) GOTOERROR; // higher numbers increase delay in key processing
+if (init_all_event(&all_event,500,16000)) GOTOERROR; // grows under load, vte's time budget bounds key delay
 #define INPUTBUFFERSIZE	8192
 #define MESSAGEBUFFERSIZE	1024
 #define PASTEBUFFERMAX	(1024*1024)
@@ -180,9 +210,22 @@ if (init_all_event(&all_event,500)) GOTOERROR; // higher numbers increase delay
 #error
 #endif
 if (init_vte(&vte,&config,&pty,&all_event,&texttap,INPUTBUFFERSIZE,MESSAGEBUFFERSIZE,PASTEBUFFERMAX)) GOTOERROR;
+if (config.isparsethread) {
+	if (init_all_event(&spare_event,500,16000)) GOTOERROR;
+	if (startparser_vte(&vte,&spare_event)) fprintf(stderr,"isparsethread failed, parsing on the main thread\n");
+}
+if (config.logfile[0]) {
+	if (init_logfile(&logfile,config.logfile,config.islogtiming,config.islogcompress)) {
+		fprintf(stderr,"Unable to log to %s, continuing without a log\n",config.logfile);
+		deinit_logfile(&logfile);
+	} else {
+		logfilep=&logfile;
+		vte.baggage.logfile=logfilep;
+	}
+}
 if (init_xclipboard(&xclipboard,&x11info)) GOTOERROR;
 if (script) {
-	if (init_xclient(&xclient,&config,&x11info,&xftchar,&charcache,&texttap,&pty,&all_event,&vte,&cursor,&xclipboard,script)) GOTOERROR;
+	if (init_xclient(&xclient,&config,&x11info,&xftchar,&charcache,maskcachep,shmdrawp,&texttap,&pty,&all_event,&vte,&cursor,&xclipboard,script)) GOTOERROR;
 	xclient.hooks.key=onkey_script;
 	xclient.hooks.control=oncontrolkey_script;
 	xclient.hooks.control_s=onsuspend_script;
@@ -191,6 +234,7 @@ if (script) {
 	xclient.hooks.bell=onbell_script;
 	xclient.hooks.getinsertion=getinsertion_script;
 	xclient.hooks.checkinsertion=checkinsertion_script;
+	xclient.hooks.insertionfd=insertionfd_script;
 	xclient.hooks.message=onmessage_script;
 	xclient.hooks.keysym=onkeysym_script;
 	xclient.hooks.unkeysym=onkeysymrelease_script;
@@ -200,7 +244,7 @@ if (script) {
 	if (oninitend_script(script)) GOTOERROR;
 } else {
 	if (!cscript) GOTOERROR;
-	if (init_xclient(&xclient,&config,&x11info,&xftchar,&charcache,&texttap,&pty,&all_event,&vte,&cursor,&xclipboard,cscript)) GOTOERROR;
+	if (init_xclient(&xclient,&config,&x11info,&xftchar,&charcache,maskcachep,shmdrawp,&texttap,&pty,&all_event,&vte,&cursor,&xclipboard,cscript)) GOTOERROR;
 	xclient.hooks.control_s=onsuspend_cscript;
 	xclient.hooks.control_q=onresume_cscript;
 	xclient.hooks.message=onmessage_cscript;
@@ -220,9 +264,13 @@ deinit_xclipboard(&xclipboard);
 deinit_cursor(&cursor);
 deinit_xclient(&xclient);
 deinit_vte(&vte);
+if (logfilep) deinit_logfile(logfilep);
 deinit_all_event(&all_event);
+deinit_all_event(&spare_event);
 deinit_pty(&pty);
 deinit_texttap(&texttap);
+deinit_shmdraw(&shmdraw);
+deinit_charcache(&maskcache);
 deinit_charcache(&charcache);
 deinit_xftchar(&xftchar);
 deinit_x11info(&x11info);
@@ -234,8 +282,11 @@ error:
 	deinit_cursor(&cursor);
 	deinit_xclient(&xclient);
 	deinit_vte(&vte);
+	if (logfilep) deinit_logfile(logfilep);
 	deinit_pty(&pty);
 	deinit_texttap(&texttap);
+	deinit_shmdraw(&shmdraw);
+	deinit_charcache(&maskcache);
 	deinit_charcache(&charcache);
 	deinit_xftchar(&xftchar);
 	deinit_x11info(&x11info);
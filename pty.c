@@ -28,11 +28,119 @@
 #include <termios.h>
 #include <pty.h>
 #include <utmp.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #define DEBUG
 #include "common/conventions.h"
 
 #include "pty.h"
 
+static void wake(int fd) {
+uint64_t u=1;
+(ignore)write(fd,&u,sizeof(u));
+}
+
+static void *reader_pty(void *p_in) {
+// the only writer of .head, blocks on spacefd when the ring is full
+struct pty *p=(struct pty *)p_in;
+unsigned int batch=0;
+sigset_t set;
+(ignore)sigfillset(&set);
+(ignore)pthread_sigmask(SIG_BLOCK,&set,NULL); // signals stay with the main thread
+while (1) {
+	unsigned int head,tail,n;
+	int k;
+	head=p->ring.head;
+	tail=__atomic_load_n(&p->ring.tail,__ATOMIC_ACQUIRE);
+	if (head-tail==RINGSIZE_PTY) {
+		uint64_t u;
+		__atomic_store_n(&p->ring.isspacewait,1,__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&p->ring.tail,__ATOMIC_SEQ_CST)==tail) (ignore)read(p->ring.spacefd,&u,sizeof(u));
+		__atomic_store_n(&p->ring.isspacewait,0,__ATOMIC_SEQ_CST);
+		continue;
+	}
+	if ((head==tail) && (p->ring.sincetrim>=TRIMBYTES_PTY)) { // idle after a flood, nothing points into the ring
+		(ignore)madvise(p->ring.buffer,RINGSIZE_PTY,MADV_DONTNEED);
+		p->ring.sincetrim=0;
+	}
+	n=RINGSIZE_PTY-(head&(RINGSIZE_PTY-1));
+	n=_BADMIN(n,RINGSIZE_PTY-(head-tail));
+	k=read(p->master,p->ring.buffer+(head&(RINGSIZE_PTY-1)),n);
+	if (k<=0) {
+		if ((k<0)&&(errno==EINTR)) continue;
+		break; // EIO after the child exits
+	}
+	__atomic_store_n(&p->ring.head,head+k,__ATOMIC_SEQ_CST);
+	__atomic_store_n(&p->ring.stats.bytes,p->ring.stats.bytes+k,__ATOMIC_RELAXED);
+	__atomic_store_n(&p->ring.stats.reads,p->ring.stats.reads+1,__ATOMIC_RELAXED);
+	p->ring.sincetrim+=k;
+	batch+=k;
+	if ((batch<WAKEBYTES_PTY) && (head+k-tail<RINGSIZE_PTY)) { // drain what's there before waking anyone
+		int avail;
+		if (!ioctl(p->master,FIONREAD,&avail) && (avail>0)) continue;
+	}
+	batch=0;
+	if (__atomic_exchange_n(&p->ring.isdatawait,0,__ATOMIC_SEQ_CST)) {
+		(void)wake(p->ring.datafd);
+		__atomic_store_n(&p->ring.stats.wakeups,p->ring.stats.wakeups+1,__ATOMIC_RELAXED);
+	}
+}
+__atomic_store_n(&p->ring.iseof,1,__ATOMIC_SEQ_CST);
+(void)wake(p->ring.datafd);
+return NULL;
+}
+
+static int startreader(struct pty *p) {
+p->ring.buffer=mmap(NULL,RINGSIZE_PTY,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+if (p->ring.buffer==MAP_FAILED) { p->ring.buffer=NULL; GOTOERROR; }
+if (0>(p->ring.datafd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC))) GOTOERROR;
+if (0>(p->ring.spacefd=eventfd(0,EFD_CLOEXEC))) GOTOERROR;
+if (pthread_create(&p->ring.thread,NULL,reader_pty,p)) GOTOERROR;
+p->ring.isthread=1;
+return 0;
+error:
+	return -1;
+}
+
+unsigned char *peek_pty(unsigned int *len_out, struct pty *p) {
+// returns the contiguous bytes the reader thread has, NULL once it's stopped and everything's been read
+unsigned int head,tail;
+int iseof;
+tail=p->ring.tail;
+iseof=__atomic_load_n(&p->ring.iseof,__ATOMIC_ACQUIRE);
+head=__atomic_load_n(&p->ring.head,__ATOMIC_ACQUIRE);
+if (head==tail) {
+	*len_out=0;
+	return (iseof)?NULL:p->ring.buffer;
+}
+*len_out=_BADMIN(head-tail,RINGSIZE_PTY-(tail&(RINGSIZE_PTY-1)));
+return p->ring.buffer+(tail&(RINGSIZE_PTY-1));
+}
+
+void release_pty(struct pty *p, unsigned int len) {
+// len bytes from peek_pty have been used
+if (!len) return;
+__atomic_store_n(&p->ring.tail,p->ring.tail+len,__ATOMIC_SEQ_CST);
+if (__atomic_exchange_n(&p->ring.isspacewait,0,__ATOMIC_SEQ_CST)) (void)wake(p->ring.spacefd);
+}
+
+int isidle_pty(struct pty *p) {
+// call before sleeping on datafd, returns 0 if there's already something to read
+__atomic_store_n(&p->ring.isdatawait,1,__ATOMIC_SEQ_CST);
+if ((__atomic_load_n(&p->ring.head,__ATOMIC_SEQ_CST)==p->ring.tail) && !__atomic_load_n(&p->ring.iseof,__ATOMIC_SEQ_CST)) return 1;
+__atomic_store_n(&p->ring.isdatawait,0,__ATOMIC_SEQ_CST);
+return 0;
+}
+
+void ack_pty(struct pty *p) {
+// clears datafd after it was readable
+uint64_t u;
+(ignore)read(p->ring.datafd,&u,sizeof(u));
+}
+
 int init_pty(struct pty *p, unsigned int cols, unsigned int rows, char **args) {
 int ptym=-1,ptys=-1;
 pid_t pid;
@@ -40,6 +148,7 @@ struct termios termios;
 struct winsize winsize;
 
 // fprintf(stderr,"%s:%d cols:%u rows:%u\n",__FILE__,__LINE__,cols,rows);
+p->ring.datafd=p->ring.spacefd=-1;
 
 if (tcgetattr(STDOUT_FILENO,&termios)) GOTOERROR;
 #if 0 //	(void)cfmakeraw(&termios);
@@ -65,7 +174,10 @@ if (!pid) {
 	_exit(execl("/bin/bash","bash","-i",NULL));
 }
 (ignore)close(ptys);
+ptys=-1;
 p->master=ptym;
+ptym=-1; // deinit_pty closes it now
+if (startreader(p)) GOTOERROR;
 return 0;
 error:
 	ifclose(ptym);
@@ -73,6 +185,13 @@ error:
 	return -1;
 }
 void deinit_pty(struct pty *p) {
+if (p->ring.isthread) {
+	(ignore)pthread_cancel(p->ring.thread);
+	(ignore)pthread_join(p->ring.thread,NULL);
+}
+ifclose(p->ring.datafd);
+ifclose(p->ring.spacefd);
+if (p->ring.buffer) (ignore)munmap(p->ring.buffer,RINGSIZE_PTY);
 ifclose(p->master);
 }
 int resize_pty(struct pty *p, unsigned int cols, unsigned int rows) {
@@ -17,9 +17,32 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#define RINGSIZE_PTY	(1<<20) // power of 2
+#define WAKEBYTES_PTY	(1<<16) // most we'll read while draining before waking the main thread
+#define TRIMBYTES_PTY	(1<<18) // after this much, an empty ring gives its pages back
+
 struct pty {
 	int master;
+	struct {
+		unsigned char *buffer; // RINGSIZE_PTY
+		unsigned int head; // written only by the reader thread
+		unsigned int tail; // written only by the main thread
+		int iseof; // reader thread has stopped, set after the last head
+		int isdatawait; // main thread wants datafd written when head moves
+		int isspacewait; // reader thread wants spacefd written when tail moves
+		int datafd,spacefd; // eventfds
+		int isthread;
+		pthread_t thread;
+		unsigned int sincetrim; // bytes read since the pages were last given back
+		struct {
+			uint64_t bytes,reads,wakeups; // written by the reader thread, read with __atomic
+		} stats;
+	} ring; // the reader thread drains master into this so the child doesn't block on a full pty
 };
 int init_pty(struct pty *p, unsigned int cols, unsigned int rows, char **args);
 void deinit_pty(struct pty *p);
 int resize_pty(struct pty *p, unsigned int cols, unsigned int rows);
+unsigned char *peek_pty(unsigned int *len_out, struct pty *p);
+void release_pty(struct pty *p, unsigned int len);
+int isidle_pty(struct pty *p);
+void ack_pty(struct pty *p);
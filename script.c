@@ -25,6 +25,7 @@
 #include <sys/select.h>
 #include <termios.h>
 #include <pty.h>
+#include <pthread.h>
 #include <time.h>
 #include <Python.h>
 #include <X11/Xlib.h>
@@ -32,14 +33,19 @@
 #define DEBUG
 #include "common/conventions.h"
 #include "common/blockmem.h"
+#include "common/lazydfa.h"
 #include "common/texttap.h"
 #include "config.h"
 #include "x11info.h"
 #include "xftchar.h"
+#include "charcache.h"
 #include "vte.h"
 #include "cursor.h"
+#include "history.h"
+#include "search.h"
 #include "xclient.h"
 #include "pty.h"
+#include "logfile.h"
 
 #include "script.h"
 
@@ -403,6 +409,8 @@ if (getconfigcolors(&config->darkmode,src,"darkmode")) GOTOERROR;
 if (getconfigcolors(&config->lightmode,src,"lightmode")) GOTOERROR;
 if (getstringbyname(config->exportterm,MAX_EXPORTTERM_CONFIG,src,"exportterm")) GOTOERROR;
 if (getstringbyname(config->typeface,MAX_TYPEFACE_CONFIG,src,"typeface")) GOTOERROR;
+if (getstringbyname(config->spilldir,MAX_SPILLDIR_CONFIG,src,"spilldir")) GOTOERROR;
+if (getstringbyname(config->logfile,MAX_LOGFILE_CONFIG,src,"logfile")) GOTOERROR;
 
 {
 	unsigned int two[2]={0,0};
@@ -424,6 +432,7 @@ if (getstringbyname(config->typeface,MAX_TYPEFACE_CONFIG,src,"typeface")) GOTOER
 }
 config->columns=uintbyname_noerr(src,"columns");
 config->rows=uintbyname_noerr(src,"rows");
+config->scrollbackcount=uintbyname_noerr(src,"scrollbackcount");
 config->cursorheight=uintbyname_noerr(src,"cursorheight");
 config->cursoryoff=uintbyname_noerr(src,"cursoryoff");
 config->font0shift=intbyname_noerr(src,"font0shift");
@@ -431,6 +440,8 @@ config->font0line=intbyname_noerr(src,"font0line");
 config->fontulline=intbyname_noerr(src,"fontulline");
 config->fontullines=intbyname_noerr(src,"fontullines");
 config->charcache=uintbyname_noerr(src,"charcache");
+config->framerate=uintbyname_noerr(src,"framerate");
+config->jumpscroll=uintbyname_noerr(src,"jumpscroll");
 config->depth=uintbyname_noerr(src,"depth");
 {
 	unsigned int triple[3]={0,0,0};
@@ -451,6 +462,16 @@ config->depth=uintbyname_noerr(src,"depth");
 	config->isdarkmode=(ui)?1:0;
 	ui=uintbyname_noerr(src,"isblinkcursor");
 	config->isblinkcursor=(ui)?1:0;
+	ui=uintbyname_noerr(src,"isshmdraw");
+	config->isshmdraw=(ui)?1:0;
+	ui=uintbyname_noerr(src,"isparsethread");
+	config->isparsethread=(ui)?1:0;
+	ui=uintbyname_noerr(src,"issearchindex");
+	config->issearchindex=(ui)?1:0;
+	ui=uintbyname_noerr(src,"islogtiming");
+	config->islogtiming=(ui)?1:0;
+	ui=uintbyname_noerr(src,"islogcompress");
+	config->islogcompress=(ui)?1:0;
 	ui=uintbyname_noerr(src,"isnostart");
 	config->isnostart=(ui)?1:0;
 }
@@ -499,10 +520,13 @@ if (setconfigcolors(dest,"darkmode",&config->darkmode)) GOTOERROR;
 if (setconfigcolors(dest,"lightmode",&config->lightmode)) GOTOERROR;
 if (setstring(dest,"exportterm",config->exportterm)) GOTOERROR;
 if (setstring(dest,"typeface",config->typeface)) GOTOERROR;
+if (setstring(dest,"spilldir",config->spilldir)) GOTOERROR;
+if (setstring(dest,"logfile",config->logfile)) GOTOERROR;
 if (setuintdouble(dest,"windims",config->xwidth,config->xheight)) GOTOERROR;
 if (setuintdouble(dest,"celldims",config->cellw,config->cellh)) GOTOERROR;
 if (setuint(dest,"columns",config->columns)) GOTOERROR;
 if (setuint(dest,"rows",config->rows)) GOTOERROR;
+if (setuint(dest,"scrollbackcount",config->scrollbackcount)) GOTOERROR;
 if (setuint(dest,"cursorheight",config->cursorheight)) GOTOERROR;
 if (setuint(dest,"cursoryoff",config->cursoryoff)) GOTOERROR;
 if (setint(dest,"font0shift",config->font0shift)) GOTOERROR;
@@ -510,10 +534,17 @@ if (setint(dest,"font0line",config->font0line)) GOTOERROR;
 if (setint(dest,"fontulline",config->fontulline)) GOTOERROR;
 if (setint(dest,"fontullines",config->fontullines)) GOTOERROR;
 if (setuint(dest,"charcache",config->charcache)) GOTOERROR;
+if (setuint(dest,"framerate",config->framerate)) GOTOERROR;
+if (setuint(dest,"jumpscroll",config->jumpscroll)) GOTOERROR;
 if (setuinttriple(dest,"rgb_cursor",config->red_cursor>>8,config->green_cursor>>8,config->blue_cursor>>8)) GOTOERROR;
 if (setuint(dest,"isfullscreen",config->isfullscreen)) GOTOERROR;
 if (setuint(dest,"isdarkmode",config->isdarkmode)) GOTOERROR;
 if (setuint(dest,"isblinkcursor",config->isblinkcursor)) GOTOERROR;
+if (setuint(dest,"isshmdraw",config->isshmdraw)) GOTOERROR;
+if (setuint(dest,"isparsethread",config->isparsethread)) GOTOERROR;
+if (setuint(dest,"issearchindex",config->issearchindex)) GOTOERROR;
+if (setuint(dest,"islogtiming",config->islogtiming)) GOTOERROR;
+if (setuint(dest,"islogcompress",config->islogcompress)) GOTOERROR;
 if (setuintdouble(dest,"offset",config->xoff,config->yoff)) GOTOERROR;
 if (setuintdouble(dest,"screendims",config->screen.width,config->screen.height)) GOTOERROR;
 if (setuintdouble(dest,"mm_screendims",config->screen.widthmm,config->screen.heightmm)) GOTOERROR;
@@ -811,6 +842,51 @@ if (!look_texttap(script->texttap,&ot->handle,script->temp_tap,texttapcb_script,
 ot->next=script->taps.first;
 script->taps.first=ot;
 
+return PyLong_FromLong(0);
+error:
+	Py_XDECREF(wr);
+	if (ot) { ot->next=script->taps.firstfree; script->taps.firstfree=ot; }
+	return NULL;
+}
+static PyObject *tap_addregex(PyObject *self, PyObject *const *argv, Py_ssize_t argc) {
+PyObject *dest,*match,*code,*wr=NULL;
+struct _script **v,*script;
+struct onetap *ot=NULL;
+unsigned int uicode;
+int isbad;
+v=(struct _script **)PyModule_GetState(self);
+if (!v) return NULL;
+if (!(script=*v)) return NULL;
+if (!script->xclient) return PyLong_FromLong(-1);
+if (argc<3) return PyLong_FromLong(-2);
+dest=argv[0];
+if (!PyObject_HasAttrString(dest,"OnLook")) return PyLong_FromLong(-3);
+code=argv[1];
+if (!PyLong_Check(code)) return PyLong_FromLong(-2);
+if (!(uicode=PyLong_AsUnsignedLong(code))) return PyLong_FromLong(-2); // 0 is reserved for clear all
+match=argv[2];
+if (!PyUnicode_Check(match)) return PyLong_FromLong(-2);
+if (fill_temp_tap(script,match)) GOTOERROR;
+if (!script->temp_tap[0]) return PyLong_FromLong(-2); // use addlook for a full tap
+
+if (!(wr=PyWeakref_NewRef(dest,script->tapscheck))) GOTOERROR;
+
+if (!(ot=getonetap(script))) GOTOERROR;
+ot->script=script;
+ot->code=uicode;
+ot->receiver_ro=dest;
+ot->weakref=wr;
+
+if (!regex_look_texttap(&isbad,script->texttap,&ot->handle,script->temp_tap,texttapcb_script,ot)) {
+	if (!isbad) GOTOERROR;
+	Py_DECREF(wr);
+	ot->next=script->taps.firstfree; script->taps.firstfree=ot;
+	return PyLong_FromLong(-2);
+}
+
+ot->next=script->taps.first;
+script->taps.first=ot;
+
 return PyLong_FromLong(0);
 error:
 	Py_XDECREF(wr);
@@ -1281,6 +1357,77 @@ if (scrollback_xclient(script->xclient,delta)) return NULL;
 return PyLong_FromLong(0);
 }
 
+static PyObject *vte_scrollto(PyObject *self, PyObject *const *argv, Py_ssize_t argc) {
+struct _script **v,*script;
+unsigned int total,line=0;
+v=(struct _script **)PyModule_GetState(self);
+//	fprintf(stderr,"vte_scrollto v=%p argc=%d\n",v,argc);
+if (!v) return NULL;
+if (!(script=*v)) return NULL;
+if (!script->xclient) return PyLong_FromLong(-1);
+if ((argc<1) || (getuint(&line,argv[0]))) return PyLong_FromLong(-2);
+total=lines_history(&script->xclient->surface.scrollback);
+if (scrollto_xclient(script->xclient,(line<total)?total-line:0)) return NULL;
+return PyLong_FromLong(0);
+}
+
+static PyObject *vte_scrolltop(PyObject *self, PyObject *const *argv, Py_ssize_t argc) {
+struct _script **v,*script;
+v=(struct _script **)PyModule_GetState(self);
+if (!v) return NULL;
+if (!(script=*v)) return NULL;
+if (!script->xclient) return PyLong_FromLong(-1);
+if (scrollto_xclient(script->xclient,lines_history(&script->xclient->surface.scrollback))) return NULL;
+return PyLong_FromLong(0);
+}
+
+static PyObject *vte_scrollbottom(PyObject *self, PyObject *const *argv, Py_ssize_t argc) {
+struct _script **v,*script;
+v=(struct _script **)PyModule_GetState(self);
+if (!v) return NULL;
+if (!(script=*v)) return NULL;
+if (!script->xclient) return PyLong_FromLong(-1);
+if (scrollto_xclient(script->xclient,0)) return NULL;
+return PyLong_FromLong(0);
+}
+
+static PyObject *vte_scrollpos(PyObject *self, PyObject *const *argv, Py_ssize_t argc) {
+struct _script **v,*script;
+unsigned int total;
+v=(struct _script **)PyModule_GetState(self);
+if (!v) return NULL;
+if (!(script=*v)) return NULL;
+if (!script->xclient) return PyLong_FromLong(-1);
+total=lines_history(&script->xclient->surface.scrollback);
+return Py_BuildValue("(II)",total-script->xclient->scrollback.linesback,total);
+}
+
+static PyObject *vte_search(PyObject *self, PyObject *const *argv, Py_ssize_t argc) {
+struct _script **v,*script;
+const char *pattern;
+Py_ssize_t len;
+int direction=-1,isfold=0,isfound;
+uint64_t line;
+unsigned int col;
+
+v=(struct _script **)PyModule_GetState(self);
+//	fprintf(stderr,"vte_search v=%p argc=%d\n",v,argc);
+if (!v) return NULL;
+if (!(script=*v)) return NULL;
+if (!script->xclient) return PyLong_FromLong(-1);
+if (argc<1) return PyLong_FromLong(-2);
+if (!(pattern=PyUnicode_AsUTF8AndSize(argv[0],&len))) return NULL;
+if (argc>1) {
+	if (getint(&direction,argv[1])) return PyLong_FromLong(-2);
+}
+if (argc>2) {
+	if (getint(&isfold,argv[2])) return PyLong_FromLong(-2);
+}
+if (search_xclient(&isfound,&line,&col,script->xclient,(unsigned char *)pattern,len,direction,isfold)) return NULL;
+if (!isfound) Py_RETURN_NONE;
+return Py_BuildValue("(KI)",(unsigned long long)line,col);
+}
+
 static PyObject *vte_send(PyObject *self, PyObject *const *argv, Py_ssize_t argc) {
 struct _script **v,*script;
 const char *letters;
@@ -1345,7 +1492,52 @@ error:
 	return NULL;
 }
 
+static PyObject *vte_cachestats(PyObject *self, PyObject *const *argv, Py_ssize_t argc) {
+struct _script **v,*script;
+struct charcache *cc;
+
+v=(struct _script **)PyModule_GetState(self);
+//	fprintf(stderr,"vte_cachestats v=%p argc=%d\n",v,argc);
+if (!v) return NULL;
+if (!(script=*v)) return NULL;
+if (!script->xclient) return PyLong_FromLong(-1);
+cc=script->xclient->baggage.charcache;
+return Py_BuildValue("(KKKII)",(unsigned long long)cc->stats.hits,(unsigned long long)cc->stats.misses,
+		(unsigned long long)cc->stats.evictions,cc->used,cc->count);
+}
+
+static PyObject *vte_ptystats(PyObject *self, PyObject *const *argv, Py_ssize_t argc) {
+struct _script **v,*script;
+struct pty *pty;
+
+v=(struct _script **)PyModule_GetState(self);
+//	fprintf(stderr,"vte_ptystats v=%p argc=%d\n",v,argc);
+if (!v) return NULL;
+if (!(script=*v)) return NULL;
+if (!script->xclient) return PyLong_FromLong(-1);
+pty=script->xclient->baggage.pty;
+return Py_BuildValue("(KKK)",(unsigned long long)__atomic_load_n(&pty->ring.stats.bytes,__ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&pty->ring.stats.reads,__ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&pty->ring.stats.wakeups,__ATOMIC_RELAXED));
+}
+
+static PyObject *vte_logstats(PyObject *self, PyObject *const *argv, Py_ssize_t argc) {
+struct _script **v,*script;
+struct logfile *logfile;
+
+v=(struct _script **)PyModule_GetState(self);
+if (!v) return NULL;
+if (!(script=*v)) return NULL;
+if (!script->xclient) return PyLong_FromLong(-1);
+logfile=script->xclient->baggage.vte->baggage.logfile;
+if (!logfile) Py_RETURN_NONE;
+return Py_BuildValue("(KKi)",(unsigned long long)__atomic_load_n(&logfile->stats.bytes,__ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&logfile->stats.dropped,__ATOMIC_RELAXED),
+		__atomic_load_n(&logfile->iserror,__ATOMIC_RELAXED));
+}
+
 static PyMethodDef VteMethods[]={
+	{"cachestats",(PyCFunction)vte_cachestats,METH_FASTCALL,"Glyph cache counters."},
 	{"clear",(PyCFunction)vte_clear,METH_FASTCALL,"Clear screen."},
 	{"clearlines",(PyCFunction)vte_clearlines,METH_FASTCALL,"Clear a row on the screen."},
 	{"copy",(PyCFunction)vte_copy,METH_FASTCALL,"Copy text to a clipboard."},
@@ -1358,15 +1550,22 @@ static PyMethodDef VteMethods[]={
 	{"fetchcharpos",(PyCFunction)vte_fetchcharpos,METH_FASTCALL,"Fetch the position of the last character."},
 	{"grabpointer",(PyCFunction)vte_grabpointer,METH_FASTCALL,"Capture all events from the mouse."},
 	{"ispaused",(PyCFunction)vte_ispaused,METH_FASTCALL,"Check if the terminal is paused."},
+	{"logstats",(PyCFunction)vte_logstats,METH_FASTCALL,"Session log counters."},
 	{"milliseconds",(PyCFunction)vte_milliseconds,METH_FASTCALL,"Milliseconds since some unspecified moment."},
 	{"moveto",(PyCFunction)vte_moveto,METH_FASTCALL,"Position to draw on the screen."},
 	{"movewindow",(PyCFunction)vte_movewindow,METH_FASTCALL,"Move window on the screen."},
 	{"paste",(PyCFunction)vte_paste,METH_FASTCALL,"Fetch text from a clipboard."},
+	{"ptystats",(PyCFunction)vte_ptystats,METH_FASTCALL,"Pty reader counters."},
 	{"pause",(PyCFunction)vte_pause,METH_FASTCALL,"Pause the terminal."},
 	{"restoretext",(PyCFunction)vte_restoretext,METH_FASTCALL,"Restore the drawn text from the buffer."},
 	{"restorerect",(PyCFunction)vte_restorerect,METH_FASTCALL,"Redraw screen from last draw."},
 	{"savetext",(PyCFunction)vte_savetext,METH_FASTCALL,"Save the drawn text to a buffer."},
 	{"scrollback",(PyCFunction)vte_scrollback,METH_FASTCALL,"Scroll the history."},
+	{"scrollbottom",(PyCFunction)vte_scrollbottom,METH_FASTCALL,"Leave the history."},
+	{"scrollpos",(PyCFunction)vte_scrollpos,METH_FASTCALL,"Line on top and lines in the history."},
+	{"scrollto",(PyCFunction)vte_scrollto,METH_FASTCALL,"Scroll a line of history to the top."},
+	{"scrolltop",(PyCFunction)vte_scrolltop,METH_FASTCALL,"Scroll to the oldest line."},
+	{"search",(PyCFunction)vte_search,METH_FASTCALL,"Find text in the history and on the screen."},
 	{"select",(PyCFunction)vte_select,METH_FASTCALL,"Select text for clipboard."},
 	{"send",(PyCFunction)vte_send,METH_FASTCALL,"Send characters as if they were typed."},
 	{"setalarm",(PyCFunction)vte_setalarm,METH_FASTCALL,"Set a timer for a callback."},
@@ -1538,7 +1737,8 @@ static PyModuleDef ConfigModule={
 // snoop on incoming text. The pointer will be passed to user.OnInitEnd and user can pass it along as approval.
 static PyMethodDef TapMethods[]={
 	{"addlook",(PyCFunction)tap_addlook,METH_FASTCALL,"Set a callback for specified input."},
-	{"rmlook",(PyCFunction)tap_rmlook,METH_FASTCALL,"Remove callback(s) from addlook."},
+	{"addregex",(PyCFunction)tap_addregex,METH_FASTCALL,"Set a callback for input matching a regular expression."},
+	{"rmlook",(PyCFunction)tap_rmlook,METH_FASTCALL,"Remove callback(s) from addlook and addregex."},
 	{NULL,NULL,0,NULL}
 };
 
@@ -2034,6 +2234,11 @@ if (1!=select(fd+1,&rset,NULL,NULL,&tv)) return 0;
 return 1;
 }
 
+int insertionfd_script(void *script_in) {
+struct _script *s=(struct _script*)script_in;
+return s->iotrap.mfd;
+}
+
 char *getinsertion_script(unsigned int *len_out, void *script_in) {
 struct _script *s=(struct _script*)script_in;
 int fd,k;
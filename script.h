@@ -41,6 +41,7 @@ int onalarm_script(void *script_in, int t32);
 int onkey_script(void *script_in, int key);
 char *getinsertion_script(unsigned int *len_out, void *script_in);
 int checkinsertion_script(void *script_in);
+int insertionfd_script(void *script_in);
 int onmessage_script(void *script_in, char *str, unsigned int len);
 int onkeysym_script(void *script_in, unsigned int keysym, unsigned int modifiers);
 int onresize_script(void *script_in, unsigned int width, unsigned int height);
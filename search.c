@@ -0,0 +1,367 @@
+/*
+ * search.c - finding text in the history and on the screen
+ * Copyright (C) 2021 Sanjay Rao
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#define DEBUG
+#include "config.h"
+#include "common/conventions.h"
+#include "common/safemem.h"
+#include "common/blockmem.h"
+#include "history.h"
+
+#include "search.h"
+
+/*
+	History lines are searched in their compressed utf8 with memmem, so
+	nothing is decoded. Live rows are encoded the same way first.
+	Folding only covers ascii, it's done on bytes.
+	With the index, each block of BLOCKLINES_SEARCH history lines has a
+	bitset of the (folded) byte trigrams in it. A block is skipped unless
+	it has every trigram of the pattern.
+*/
+
+static inline unsigned int fold(unsigned int c) {
+if ((c>='A')&&(c<='Z')) return c+32;
+return c;
+}
+
+static inline unsigned int trigram(unsigned int a, unsigned int b, unsigned int c) {
+return (((a<<16)|(b<<8)|c)*2654435761u)>>20;
+}
+
+static inline unsigned int countcells(unsigned char *utf8, unsigned char *stop) {
+unsigned int count=0;
+while (utf8<stop) {
+	if ((*utf8&0xc0)!=0x80) count++;
+	utf8++;
+}
+return count;
+}
+
+static int reserve(unsigned char **buffer_inout, unsigned int *max_inout, unsigned int max) {
+unsigned char *temp;
+if (max<=*max_inout) return 0;
+if (!(temp=REALLOC(*buffer_inout,max))) GOTOERROR;
+*buffer_inout=temp;
+*max_inout=max;
+return 0;
+error:
+	return -1;
+}
+
+static int encodecells(unsigned int *len_out, struct search *search, uint32_t *cells, unsigned int len) {
+// into search->text, without trailing blanks
+unsigned char *dest;
+unsigned int ui;
+while (len) {
+	if ((cells[len-1]&UCS4_MASK_VALUE)!=32) break;
+	len--;
+}
+if (reserve(&search->text.buffer,&search->text.max,4*len+1)) GOTOERROR;
+dest=search->text.buffer;
+for (ui=0;ui<len;ui++) dest=encodeutf8_history(dest,cells[ui]&UCS4_MASK_VALUE);
+*len_out=dest-search->text.buffer;
+return 0;
+error:
+	return -1;
+}
+
+static uint64_t *getfilter(struct search *search, uint64_t block) {
+// NULL => the block isn't indexed and has to be scanned
+uint64_t offset;
+unsigned int index;
+if (!search->index.count) return NULL;
+if (block<search->index.firstblock) return NULL;
+if (block*BLOCKLINES_SEARCH<search->index.firstline) return NULL;
+offset=block-search->index.firstblock;
+if (offset>=search->index.count) return NULL;
+index=search->index.start+offset;
+if (index>=search->index.max) index-=search->index.max;
+return search->index.filters+(uint64_t)index*FILTERWORDS_SEARCH;
+}
+
+static int pushfilter(struct search *search) {
+unsigned int index;
+if (search->index.count==search->index.max) {
+	uint64_t *temp;
+	unsigned int max,first;
+	max=(search->index.max)?2*search->index.max:64;
+	if (!(temp=MALLOC((uint64_t)max*FILTERWORDS_SEARCH*sizeof(uint64_t)))) GOTOERROR;
+	first=search->index.max-search->index.start;
+	if (first>search->index.count) first=search->index.count;
+	if (search->index.count) {
+		memcpy(temp,search->index.filters+(uint64_t)search->index.start*FILTERWORDS_SEARCH,
+				(uint64_t)first*FILTERWORDS_SEARCH*sizeof(uint64_t));
+		memcpy(temp+(uint64_t)first*FILTERWORDS_SEARCH,search->index.filters,
+				(uint64_t)(search->index.count-first)*FILTERWORDS_SEARCH*sizeof(uint64_t));
+	}
+	IFFREE(search->index.filters);
+	search->index.filters=temp;
+	search->index.start=0;
+	search->index.max=max;
+}
+index=search->index.start+search->index.count;
+if (index>=search->index.max) index-=search->index.max;
+memset(search->index.filters+(uint64_t)index*FILTERWORDS_SEARCH,0,FILTERWORDS_SEARCH*sizeof(uint64_t));
+search->index.count+=1;
+return 0;
+error:
+	return -1;
+}
+
+static void dropfilters(struct search *search, uint64_t oldest) {
+while (search->index.count) {
+	if ((search->index.firstblock+1)*BLOCKLINES_SEARCH>oldest) break;
+	search->index.start+=1;
+	if (search->index.start==search->index.max) search->index.start=0;
+	search->index.count-=1;
+	search->index.firstblock+=1;
+}
+}
+
+int addline_search(struct search *search, struct history *history, uint32_t *cells, unsigned int len) {
+// call after add_history, cells is history's newest line
+uint64_t line,block,*filter;
+unsigned int ui,a,b,n;
+
+if (!search->index.isenabled) return 0;
+if (!history->added) return 0; // no history
+line=history->added-1;
+block=line/BLOCKLINES_SEARCH;
+(void)dropfilters(search,oldest_history(history));
+if (!search->index.count) {
+	if (!search->index.max) search->index.firstline=line; // the first line we see
+	search->index.firstblock=block;
+}
+while (search->index.firstblock+search->index.count<=block) {
+	if (pushfilter(search)) GOTOERROR;
+}
+filter=getfilter(search,block);
+if (!filter) return 0;
+
+while (len) {
+	if ((cells[len-1]&UCS4_MASK_VALUE)!=32) break;
+	len--;
+}
+a=b=n=0;
+for (ui=0;ui<len;ui++) {
+	unsigned char utf8[4],*cursor,*stop;
+	stop=encodeutf8_history(utf8,cells[ui]&UCS4_MASK_VALUE);
+	for (cursor=utf8;cursor<stop;cursor++) {
+		unsigned int c,bit;
+		c=fold(*cursor);
+		if (n>=2) {
+			bit=trigram(a,b,c);
+			filter[bit>>6]|=(uint64_t)1<<(bit&63);
+		}
+		n++;
+		a=b;
+		b=c;
+	}
+}
+return 0;
+error:
+	return -1;
+}
+
+int setpattern_search(int *ischanged_out, struct search *search, unsigned char *utf8, unsigned int len, int isfold) {
+unsigned int ui;
+int ischanged=0;
+
+if ((len!=search->pattern.len)||((isfold!=0)!=(search->pattern.isfold!=0))) ischanged=1;
+else {
+	for (ui=0;ui<len;ui++) {
+		unsigned int c;
+		c=(isfold)?fold(utf8[ui]):utf8[ui];
+		if (c!=search->pattern.utf8[ui]) {
+			ischanged=1;
+			break;
+		}
+	}
+}
+*ischanged_out=ischanged;
+if (!ischanged) return 0;
+
+if (reserve(&search->pattern.utf8,&search->pattern.max,len+1)) GOTOERROR;
+for (ui=0;ui<len;ui++) search->pattern.utf8[ui]=(isfold)?fold(utf8[ui]):utf8[ui];
+search->pattern.len=len;
+search->pattern.isfold=(isfold)?1:0;
+search->pattern.cells=countcells(utf8,utf8+len);
+search->pattern.trigramcount=0;
+for (ui=2;ui<len;ui++) {
+	if (search->pattern.trigramcount==MAXTRIGRAMS_SEARCH) break;
+	search->pattern.trigrams[search->pattern.trigramcount]=trigram(fold(utf8[ui-2]),fold(utf8[ui-1]),fold(utf8[ui]));
+	search->pattern.trigramcount+=1;
+}
+search->last.isvalid=0;
+return 0;
+error:
+	return -1;
+}
+
+static int isskippable(struct search *search, struct history *history, uint64_t line) {
+uint64_t *filter;
+unsigned int ui;
+if (!search->pattern.trigramcount) return 0;
+if (line>=history->added) return 0; // live
+if (!(filter=getfilter(search,line/BLOCKLINES_SEARCH))) return 0;
+for (ui=0;ui<search->pattern.trigramcount;ui++) {
+	unsigned int bit;
+	bit=search->pattern.trigrams[ui];
+	if (!(filter[bit>>6]&((uint64_t)1<<(bit&63)))) return 1;
+}
+return 0;
+}
+
+static unsigned char *getlinetext(unsigned int *len_out, struct search *search, struct history *history,
+		uint32_t *(*getlive)(void *v, unsigned int row), void *v, unsigned int columns, uint64_t line) {
+unsigned char *text;
+if (line<history->added) {
+	if (!(text=text_history(len_out,history,history->added-1-line))) {
+		*len_out=0; // spill read failed, it can't match
+		return search->text.buffer;
+	}
+	return text;
+}
+if (encodecells(len_out,search,getlive(v,line-history->added),columns)) GOTOERROR;
+return search->text.buffer;
+error:
+	return NULL;
+}
+
+static int findinline(int *col_out, struct search *search, unsigned char *text, unsigned int len, int after, int before, int direction) {
+// finds a match with after < col < before, the first if direction>0 or the last if direction<0
+unsigned char *cursor,*end,*counted;
+int col,found=-1;
+
+if (len<search->pattern.len) {
+	*col_out=-1;
+	return 0;
+}
+if (search->pattern.isfold) {
+	unsigned int ui;
+	if (reserve(&search->fold.buffer,&search->fold.max,len)) GOTOERROR;
+	for (ui=0;ui<len;ui++) search->fold.buffer[ui]=fold(text[ui]);
+	text=search->fold.buffer;
+}
+cursor=counted=text;
+end=text+len;
+col=0;
+while (1) {
+	unsigned char *match;
+	if (!(match=memmem(cursor,end-cursor,search->pattern.utf8,search->pattern.len))) break;
+	col+=countcells(counted,match);
+	counted=match;
+	if (col>=before) break;
+	if (col>after) {
+		found=col;
+		if (direction>0) break;
+	}
+	cursor=match+1;
+}
+*col_out=found;
+return 0;
+error:
+	return -1;
+}
+
+int find_search(int *isfound_out, struct search *search, struct history *history,
+		uint32_t *(*getlive)(void *v, unsigned int row), void *v, unsigned int rows, unsigned int columns,
+		uint64_t line, int col, int direction) {
+// direction<0 => the last match before (line,col), otherwise the first match after it, col can be -1 or INT_MAX
+uint64_t oldest,end;
+unsigned char *text;
+unsigned int len;
+int found;
+
+oldest=oldest_history(history);
+end=history->added+rows;
+if (!search->pattern.len) goto notfound;
+
+if (direction<0) {
+	if (line>=end) {
+		line=end-1;
+		col=INT_MAX;
+	}
+	if (line<oldest) goto notfound;
+	while (1) {
+		if (isskippable(search,history,line)) {
+			uint64_t first;
+			first=(line/BLOCKLINES_SEARCH)*BLOCKLINES_SEARCH;
+			if (first<=oldest) break;
+			line=first-1;
+			col=INT_MAX;
+			continue;
+		}
+		if (!(text=getlinetext(&len,search,history,getlive,v,columns,line))) GOTOERROR;
+		if (findinline(&found,search,text,len,-1,col,direction)) GOTOERROR;
+		if (found>=0) goto isfound;
+		if (line==oldest) break;
+		line--;
+		col=INT_MAX;
+	}
+} else {
+	if (line<oldest) {
+		line=oldest;
+		col=-1;
+	}
+	while (line<end) {
+		if (isskippable(search,history,line)) {
+			line=(line/BLOCKLINES_SEARCH+1)*BLOCKLINES_SEARCH;
+			if (line>history->added) line=history->added; // the newest block is partial
+			col=-1;
+			continue;
+		}
+		if (!(text=getlinetext(&len,search,history,getlive,v,columns,line))) GOTOERROR;
+		if (findinline(&found,search,text,len,col,INT_MAX,direction)) GOTOERROR;
+		if (found>=0) goto isfound;
+		line++;
+		col=-1;
+	}
+}
+notfound:
+	search->last.isvalid=0;
+	*isfound_out=0;
+	return 0;
+isfound:
+	search->last.isvalid=1;
+	search->last.line=line;
+	search->last.col=found;
+	*isfound_out=1;
+	return 0;
+error:
+	return -1;
+}
+
+int init_search(struct search *search, int isindex) {
+search->index.isenabled=(isindex)?1:0;
+return 0;
+}
+
+void deinit_search(struct search *search) {
+IFFREE(search->pattern.utf8);
+IFFREE(search->index.filters);
+IFFREE(search->text.buffer);
+IFFREE(search->fold.buffer);
+}
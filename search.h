@@ -0,0 +1,57 @@
+/*
+ * search.h
+ * Copyright (C) 2021 Sanjay Rao
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#define BLOCKLINES_SEARCH	256 // history lines per trigram filter
+#define FILTERBITS_SEARCH	4096
+#define FILTERWORDS_SEARCH	(FILTERBITS_SEARCH/64)
+#define MAXTRIGRAMS_SEARCH	64 // more than this in a pattern aren't checked
+
+struct search {
+	struct {
+		unsigned char *utf8; // folded if isfold
+		unsigned int len,max;
+		unsigned int cells; // width of a match
+		int isfold:1; // ascii case is ignored
+		unsigned int trigrams[MAXTRIGRAMS_SEARCH]; // filter bits that every matching line has
+		unsigned int trigramcount;
+	} pattern;
+	struct { // the match that find_search found
+		int isvalid:1;
+		uint64_t line; // same numbering as history, live row r is history->added+r
+		unsigned int col;
+	} last;
+	struct { // optional, lets a search skip blocks of history that can't match
+		int isenabled:1;
+		uint64_t *filters; // ring of [FILTERWORDS_SEARCH] bitsets
+		unsigned int start,count,max;
+		uint64_t firstblock; // block number of filters[start]
+		uint64_t firstline; // lines before this weren't indexed
+	} index;
+	struct {
+		unsigned char *buffer;
+		unsigned int max;
+	} text,fold;
+};
+
+int init_search(struct search *search, int isindex);
+void deinit_search(struct search *search);
+int addline_search(struct search *search, struct history *history, uint32_t *cells, unsigned int len);
+int setpattern_search(int *ischanged_out, struct search *search, unsigned char *utf8, unsigned int len, int isfold);
+int find_search(int *isfound_out, struct search *search, struct history *history,
+		uint32_t *(*getlive)(void *v, unsigned int row), void *v, unsigned int rows, unsigned int columns,
+		uint64_t line, int col, int direction);
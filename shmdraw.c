@@ -0,0 +1,245 @@
+/*
+ * shmdraw.c
+ * Copyright (C) 2021 Sanjay Rao
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#define DEBUG
+#include "common/conventions.h"
+#include "common/safemem.h"
+#include "x11info.h"
+
+#include "shmdraw.h"
+
+static int isbytemask(unsigned long mask) {
+return (mask==0xff)||(mask==0xff00)||(mask==0xff0000)||(mask==0xff000000);
+}
+
+static int initmasks(struct shmdraw *sd) {
+IFFREE(sd->masks.data);
+if (!(sd->masks.data=MALLOC(sd->masks.count*sd->cellw*sd->cellh))) GOTOERROR;
+memset(sd->masks.isvalid,0,sd->masks.count);
+return 0;
+error:
+	return -1;
+}
+
+static int initframe(struct shmdraw *sd) {
+XImage *image;
+if (init_image_x11info(&sd->image,sd->x,sd->columns*sd->cellw,sd->rows*sd->cellh,NULL)) GOTOERROR;
+image=sd->image.image;
+// blending is done per byte, so every channel has to be a whole byte
+if (!isbytemask(image->red_mask) || !isbytemask(image->green_mask) || !isbytemask(image->blue_mask)) {
+	fprintf(stderr,"%s:%d unsupported visual for software drawing\n",__FILE__,__LINE__);
+	GOTOERROR;
+}
+return 0;
+error:
+	return -1;
+}
+
+int init_shmdraw(struct shmdraw *sd, struct x11info *x, unsigned int maskcount, unsigned int rows, unsigned int columns,
+		unsigned int cellw, unsigned int cellh) {
+sd->x=x;
+sd->rows=rows;
+sd->columns=columns;
+sd->cellw=cellw;
+sd->cellh=cellh;
+if (!maskcount) maskcount=1; // matches init_charcache
+sd->masks.count=maskcount;
+if (!(sd->masks.isvalid=MALLOC(maskcount))) GOTOERROR;
+if (initmasks(sd)) GOTOERROR;
+if (initframe(sd)) GOTOERROR;
+return 0;
+error:
+	return -1;
+}
+
+void deinit_shmdraw(struct shmdraw *sd) {
+if (sd->image.x) deinit_image_x11info(&sd->image);
+IFFREE(sd->masks.data);
+IFFREE(sd->masks.isvalid);
+}
+
+SICLEARFUNC(image_x11info);
+int resize_shmdraw(struct shmdraw *sd, unsigned int rows, unsigned int columns, unsigned int cellw, unsigned int cellh) {
+int iscell;
+if ((rows==sd->rows)&&(columns==sd->columns)&&(cellw==sd->cellw)&&(cellh==sd->cellh)) return 0;
+iscell=(cellw!=sd->cellw)||(cellh!=sd->cellh);
+(void)deinit_image_x11info(&sd->image);
+clear_image_x11info(&sd->image);
+sd->rows=rows;
+sd->columns=columns;
+sd->cellw=cellw;
+sd->cellh=cellh;
+if (iscell) {
+	if (initmasks(sd)) GOTOERROR;
+}
+if (initframe(sd)) GOTOERROR;
+return 0;
+error:
+	return -1;
+}
+
+void forgetmask_shmdraw(struct shmdraw *sd, unsigned int index) {
+sd->masks.isvalid[index]=0;
+}
+
+unsigned char *getmask_shmdraw(struct shmdraw *sd, unsigned int index, Pixmap atlas, unsigned int ax, unsigned int ay) {
+// returns the cell's A8 coverage, copied from the server atlas the first time
+unsigned int cellw=sd->cellw,cellh=sd->cellh;
+unsigned char *mask;
+XImage *xi;
+unsigned int x,y;
+
+mask=sd->masks.data+index*cellw*cellh;
+if (sd->masks.isvalid[index]) return mask;
+if (!(xi=XGetImage(sd->x->display,atlas,ax,ay,cellw,cellh,AllPlanes,ZPixmap))) GOTOERROR;
+if (xi->bits_per_pixel==8) {
+	for (y=0;y<cellh;y++) memcpy(mask+y*cellw,xi->data+y*xi->bytes_per_line,cellw);
+} else {
+	for (y=0;y<cellh;y++) for (x=0;x<cellw;x++) mask[y*cellw+x]=XGetPixel(xi,x,y);
+}
+XDestroyImage(xi);
+sd->masks.isvalid[index]=1;
+return mask;
+error:
+	return NULL;
+}
+
+void sync_shmdraw(struct shmdraw *sd) {
+// call before drawing into the frame
+(void)sync_image_x11info(&sd->image);
+}
+
+static inline void fillpixels(uint32_t *dest, unsigned int count, uint32_t pixel) {
+#ifdef __SSE2__
+__m128i p;
+p=_mm_set1_epi32(pixel);
+while (count>=4) {
+	_mm_storeu_si128((__m128i*)dest,p);
+	dest+=4;
+	count-=4;
+}
+#endif
+while (count) {
+	*dest=pixel;
+	dest++;
+	count--;
+}
+}
+
+static inline uint32_t blendpixel(uint32_t fg, uint32_t bg, unsigned int a) {
+// per byte: (fg*a+bg*(255-a))/255, rounded
+uint32_t r=0;
+unsigned int shift;
+for (shift=0;shift<32;shift+=8) {
+	unsigned int t;
+	t=((fg>>shift)&0xff)*a+((bg>>shift)&0xff)*(255-a)+128;
+	t=(t+(t>>8))>>8;
+	r|=t<<shift;
+}
+return r;
+}
+
+static inline void blendpixels(uint32_t *dest, unsigned char *mask, unsigned int count, uint32_t fg, uint32_t bg) {
+#ifdef __SSE2__
+__m128i zero,fg16,bg16,c255,c128;
+zero=_mm_setzero_si128();
+fg16=_mm_unpacklo_epi8(_mm_set1_epi32(fg),zero); // 2 pixels, 16 bits per channel
+bg16=_mm_unpacklo_epi8(_mm_set1_epi32(bg),zero);
+c255=_mm_set1_epi16(255);
+c128=_mm_set1_epi16(128);
+while (count>=4) {
+	__m128i a,alo,ahi,lo,hi;
+	uint32_t m;
+	memcpy(&m,mask,4);
+	if (!m) {
+		fillpixels(dest,4,bg);
+	} else if (m==0xffffffff) {
+		fillpixels(dest,4,fg);
+	} else {
+		a=_mm_cvtsi32_si128(m);
+		a=_mm_unpacklo_epi8(a,a);
+		a=_mm_unpacklo_epi16(a,a); // each alpha byte x4
+		alo=_mm_unpacklo_epi8(a,zero);
+		ahi=_mm_unpackhi_epi8(a,zero);
+		lo=_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(fg16,alo),_mm_mullo_epi16(bg16,_mm_sub_epi16(c255,alo))),c128);
+		hi=_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(fg16,ahi),_mm_mullo_epi16(bg16,_mm_sub_epi16(c255,ahi))),c128);
+		lo=_mm_srli_epi16(_mm_add_epi16(lo,_mm_srli_epi16(lo,8)),8);
+		hi=_mm_srli_epi16(_mm_add_epi16(hi,_mm_srli_epi16(hi,8)),8);
+		_mm_storeu_si128((__m128i*)dest,_mm_packus_epi16(lo,hi));
+	}
+	dest+=4;
+	mask+=4;
+	count-=4;
+}
+#endif
+while (count) {
+	switch (*mask) {
+		case 0: *dest=bg; break;
+		case 255: *dest=fg; break;
+		default: *dest=blendpixel(fg,bg,*mask); break;
+	}
+	dest++;
+	mask++;
+	count--;
+}
+}
+
+void fill_shmdraw(struct shmdraw *sd, unsigned int row, unsigned int col, unsigned int count, uint32_t pixel) {
+// fills count cells with one color
+unsigned char *frame;
+unsigned int y,width;
+frame=sd->image.frame+row*sd->cellh*sd->image.stride+col*sd->cellw*4;
+width=count*sd->cellw;
+for (y=0;y<sd->cellh;y++) {
+	(void)fillpixels((uint32_t*)frame,width,pixel);
+	frame+=sd->image.stride;
+}
+}
+
+void blend_shmdraw(struct shmdraw *sd, unsigned int row, unsigned int col, unsigned char *mask, uint32_t fg, uint32_t bg) {
+unsigned char *frame;
+unsigned int y;
+frame=sd->image.frame+row*sd->cellh*sd->image.stride+col*sd->cellw*4;
+for (y=0;y<sd->cellh;y++) {
+	(void)blendpixels((uint32_t*)frame,mask,sd->cellw,fg,bg);
+	frame+=sd->image.stride;
+	mask+=sd->cellw;
+}
+}
+
+int put_shmdraw(struct shmdraw *sd, unsigned int row, unsigned int col, unsigned int rows, unsigned int cols,
+		unsigned int xoff, unsigned int yoff) {
+// sends a rectangle of cells to the window, xoff,yoff is the window position of cell 0,0
+unsigned int sx,sy;
+sx=col*sd->cellw;
+sy=row*sd->cellh;
+if (paint2_image_x11info(&sd->image,sx,sy,xoff+sx,yoff+sy,cols*sd->cellw,rows*sd->cellh)) GOTOERROR;
+return 0;
+error:
+	return -1;
+}
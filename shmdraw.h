@@ -0,0 +1,42 @@
+/*
+ * shmdraw.h
+ * Copyright (C) 2021 Sanjay Rao
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+struct shmdraw {
+	struct x11info *x;
+	struct image_x11info image; // rows*cellh by columns*cellw
+	unsigned int rows,columns;
+	unsigned int cellw,cellh;
+	struct { // copies of maskcache slots, fetched on first use
+		unsigned char *data; // cellw*cellh bytes per slot
+		unsigned char *isvalid;
+		unsigned int count;
+	} masks;
+};
+
+int init_shmdraw(struct shmdraw *sd, struct x11info *x, unsigned int maskcount, unsigned int rows, unsigned int columns,
+		unsigned int cellw, unsigned int cellh);
+void deinit_shmdraw(struct shmdraw *sd);
+int resize_shmdraw(struct shmdraw *sd, unsigned int rows, unsigned int columns, unsigned int cellw, unsigned int cellh);
+void forgetmask_shmdraw(struct shmdraw *sd, unsigned int index);
+unsigned char *getmask_shmdraw(struct shmdraw *sd, unsigned int index, Pixmap atlas, unsigned int ax, unsigned int ay);
+void sync_shmdraw(struct shmdraw *sd);
+void fill_shmdraw(struct shmdraw *sd, unsigned int row, unsigned int col, unsigned int count, uint32_t pixel);
+void blend_shmdraw(struct shmdraw *sd, unsigned int row, unsigned int col, unsigned char *mask, uint32_t fg, uint32_t bg);
+int put_shmdraw(struct shmdraw *sd, unsigned int row, unsigned int col, unsigned int rows, unsigned int cols,
+		unsigned int xoff, unsigned int yoff);
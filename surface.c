@@ -25,6 +25,7 @@
 #include <ctype.h>
 #include <time.h>
 #include <sys/select.h>
+#include <pthread.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xft/Xft.h>
@@ -33,6 +34,7 @@
 #include "config.h" 
 #include "common/conventions.h"
 #include "common/safemem.h"
+#include "common/blockmem.h"
 #include "x11info.h"
 #include "xftchar.h"
 #include "charcache.h"
@@ -40,6 +42,8 @@
 #include "vte.h"
 #include "cursor.h"
 #include "keysym.h"
+#include "history.h"
+#include "search.h"
 #include "xclient.h"
 
 #include "surface.h"
@@ -54,50 +58,31 @@ while (1) {
 }
 }
 
-static inline int init_scrollback(struct surface_xclient *s, unsigned int sbcount, unsigned int columns, uint32_t *backing) {
-struct sbline_xclient *sbline;
-
-if (!sbcount) return 0;
-if (!(s->tofree.sblines=MALLOC(sbcount*sizeof(struct sbline_xclient)))) GOTOERROR;
-
-sbline=s->tofree.sblines;
-while (1) {
-	sbline->backing=backing;
-	sbline->next=s->scrollback.firstfree;
-	s->scrollback.firstfree=sbline;
-	backing+=columns;
-	sbline++;
-	sbcount--;
-	if (!sbcount) break;
-}
-
-return 0;
-error:
-	return -1;
-}
-
 int init_surface_xclient(struct surface_xclient *s, unsigned int rows, unsigned int columns, uint32_t bvalue, unsigned int sbcount) {
 unsigned int ui,backcount;
 uint32_t *backing;
 
-backcount=columns*(1+2*rows+sbcount);
+backcount=columns*(1+3*rows);
 if (!(backing=s->tofree.backing=MALLOC(backcount*sizeof(uint32_t)))) GOTOERROR;
 s->tofree.backcount=backcount;
 s->numinline=columns;
 
 s->maxlines=rows;
-if (!(s->tofree.lines=MALLOC(3*rows*sizeof(struct line_xclient)))) GOTOERROR;
+if (!(s->tofree.lines=MALLOC(4*rows*sizeof(struct line_xclient)))) GOTOERROR;
 s->lines=s->tofree.lines;
 s->sparelines=s->tofree.lines+rows;
 s->savedlines=s->sparelines+rows;
+s->livelines=s->savedlines+rows;
 for (ui=0;ui<rows;ui++) {
 	memset4(backing,bvalue,columns);
 	s->lines[ui].backing=backing; backing+=columns;
+	s->lines[ui].damage.isdirty=0;
 	s->savedlines[ui].backing=backing; backing+=columns;
+	s->livelines[ui].backing=backing; backing+=columns;
 }
 s->spareline=backing; backing+=columns;
 
-if (init_scrollback(s,sbcount,columns,backing)) GOTOERROR;
+if (init_history(&s->scrollback,sbcount)) GOTOERROR;
 
 return 0;
 error:
@@ -106,7 +91,7 @@ error:
 void deinit_surface_xclient(struct surface_xclient *surface) {
 IFFREE(surface->tofree.backing);
 IFFREE(surface->tofree.lines);
-IFFREE(surface->tofree.sblines);
+deinit_history(&surface->scrollback);
 }
 
 /*
@@ -143,21 +128,23 @@ error:
 	return -1;
 }
 
-static inline int reallocmemory(struct surface_xclient *s, unsigned int newrows, unsigned int newcolumns, unsigned int sbcount) {
+static inline int reallocmemory(struct surface_xclient *s, unsigned int newrows, unsigned int newcolumns) {
 unsigned int oldrows=s->maxlines;
 if (newrows>s->maxlines) {
 	struct line_xclient *temp;
 //	fprintf(stderr,"%s:%d resizing lines from %u to %u\n",__FILE__,__LINE__,s->maxlines,newrows);
-	temp=realloc(s->tofree.lines,3*newrows*sizeof(struct line_xclient));
+	temp=realloc(s->tofree.lines,4*newrows*sizeof(struct line_xclient));
 	if (!temp) GOTOERROR;
 	s->tofree.lines=temp;
 	if (oldrows) {
+		memmove(temp+3*newrows,temp+3*oldrows,oldrows*sizeof(struct line_xclient));
 		memmove(temp+2*newrows,temp+2*oldrows,oldrows*sizeof(struct line_xclient));
 		memmove(temp+newrows,temp+oldrows,oldrows*sizeof(struct line_xclient));
 	}
 	s->lines=temp;
 	s->sparelines=temp+newrows;
 	s->savedlines=s->sparelines+newrows;
+	s->livelines=s->savedlines+newrows;
 	s->maxlines=newrows;
 }
 if ((newrows>oldrows)||(newcolumns>s->numinline)) {
@@ -166,7 +153,7 @@ if ((newrows>oldrows)||(newcolumns>s->numinline)) {
 	unsigned int backcount;
 	maxnil=_BADMAX(oldnil,newcolumns);
 //	fprintf(stderr,"%s:%d resizing backing from %u.%u->%u.%u\n",__FILE__,__LINE__,oldrows,s->numinline,newrows,newcolumns);
-	backcount=(1+2*s->maxlines+sbcount)*maxnil;
+	backcount=(1+3*s->maxlines)*maxnil;
 	temp=realloc(s->tofree.backing,backcount*sizeof(uint32_t));
 	if (!temp) GOTOERROR;
 	s->tofree.backing=temp;
@@ -178,11 +165,11 @@ error:
 	return -1;
 }
 
-static inline void blanknewlines(struct surface_xclient *s, unsigned int oldrows, unsigned int oldmaxlines, unsigned int newcolumns,
+static inline void blanknewlines(struct surface_xclient *s, unsigned int oldmaxlines, unsigned int newcolumns,
 		uint32_t blankvalue) {
 unsigned int maxlines,ui,numinline;
 uint32_t *newstart;
-struct line_xclient *newline,*newsaved;
+struct line_xclient *newline,*newsaved,*newlive;
 
 maxlines=s->maxlines;
 if (maxlines<=oldmaxlines) return;
@@ -191,25 +178,31 @@ if (maxlines<=oldmaxlines) return;
 
 ui=maxlines-oldmaxlines;
 numinline=s->numinline;
-newstart=s->tofree.backing+(1+2*oldrows)*numinline;
+newstart=s->tofree.backing+(1+3*oldmaxlines)*numinline;
 newline=s->lines+oldmaxlines;
-newsaved=s->savedlines+oldrows;
+newsaved=s->savedlines+oldmaxlines;
+newlive=s->livelines+oldmaxlines;
 while (1) {
 	memset4(newstart,blankvalue,newcolumns);
 	newline->backing=newstart;
+	newline->damage.isdirty=0;
 	newstart+=numinline;
 	memset4(newstart,blankvalue,newcolumns);
 	newsaved->backing=newstart;
+	newstart+=numinline;
+	memset4(newstart,blankvalue,newcolumns);
+	newlive->backing=newstart;
 	ui--;
 	if (!ui) break;
 	newstart+=numinline;
 	newline++;
 	newsaved++;
+	newlive++;
 }
 }
 
 static inline void shiftoldbacking(struct surface_xclient *s, unsigned int oldmaxlines, unsigned int oldnuminline,
-		unsigned int oldcols, unsigned int newcols, unsigned int sbcount, uint32_t blankvalue) {
+		unsigned int oldcols, unsigned int newcols, uint32_t blankvalue) {
 unsigned int newnuminline;
 uint32_t *oldptr,*newptr,*backing;
 unsigned int count,tail;
@@ -223,7 +216,7 @@ if (!oldmaxlines) return;
 tail=0;
 if (newcols>oldcols) tail=newcols-oldcols;
 backing=s->tofree.backing;
-count=1+2*oldmaxlines+sbcount;
+count=1+3*oldmaxlines;
 oldptr=backing+count*oldnuminline;
 newptr=backing+count*newnuminline;
 while (1) {
@@ -241,7 +234,6 @@ return newb+newnum*((b-oldb)/oldnum);
 }
 #define CHANGE(a) a=updatepointersB(a,oldbacking,oldnuminline,newbacking,newnuminline)
 static void updatepointers(struct surface_xclient *s, unsigned int oldnuminline, unsigned int oldmaxlines, uint32_t *oldbacking) {
-struct sbline_xclient *sb;
 unsigned int ui;
 unsigned int newnuminline;
 uint32_t *newbacking;
@@ -258,16 +250,7 @@ CHANGE(s->spareline);
 for (ui=0;ui<oldmaxlines;ui++) {
 	CHANGE(s->lines[ui].backing);
 	CHANGE(s->savedlines[ui].backing);
-}
-sb=s->scrollback.first;
-while (sb) {
-	CHANGE(sb->backing);
-	sb=sb->next;
-}
-sb=s->scrollback.firstfree;
-while (sb) {
-	CHANGE(sb->backing);
-	sb=sb->next;
+	CHANGE(s->livelines[ui].backing);
 }
 blist=s->selection.backings.list;
 ui=s->selection.backings.len;
@@ -279,7 +262,7 @@ while (ui) {
 }
 #undef CHANGE
 int resize_surface_xclient(struct surface_xclient *s, struct x11info *x, unsigned int oldrows, unsigned int oldcolumns,
-		unsigned int newrows, unsigned int newcolumns, uint32_t blankvalue, unsigned int sbcount, unsigned int cellw, unsigned int cellh,
+		unsigned int newrows, unsigned int newcolumns, uint32_t blankvalue, unsigned int cellw, unsigned int cellh,
 		long fillcolor, int isremap) {
 // caller should set xc.config values afterward
 uint32_t *oldbacking;
@@ -288,9 +271,9 @@ oldbacking=s->tofree.backing;
 oldnuminline=s->numinline;
 oldmaxlines=s->maxlines;
 if (blackoutshrinkage(x,oldrows,oldcolumns,newrows,newcolumns,cellw,cellh,fillcolor,isremap)) GOTOERROR;
-if (reallocmemory(s,newrows,newcolumns,sbcount)) GOTOERROR;
-(void)blanknewlines(s,oldrows,oldmaxlines,newcolumns,blankvalue);
-(void)shiftoldbacking(s,oldmaxlines,oldnuminline,oldcolumns,newcolumns,sbcount,blankvalue);
+if (reallocmemory(s,newrows,newcolumns)) GOTOERROR;
+(void)blanknewlines(s,oldmaxlines,newcolumns,blankvalue);
+(void)shiftoldbacking(s,oldmaxlines,oldnuminline,oldcolumns,newcolumns,blankvalue);
 (void)updatepointers(s,oldnuminline,oldmaxlines,oldbacking);
 // (void)blankoldlines(s,oldrows,newrows,oldcolumns,blankvalue); // is there any need for this?
 return 0;
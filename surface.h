@@ -19,5 +19,5 @@
 void deinit_surface_xclient(struct surface_xclient *surface);
 int init_surface_xclient(struct surface_xclient *s, unsigned int rows, unsigned int columns, uint32_t bvalue, unsigned int sbcount);
 int resize_surface_xclient(struct surface_xclient *s, struct x11info *x, unsigned int oldrows, unsigned int oldcolumns,
-		unsigned int newrows, unsigned int newcolumns, uint32_t blankvalue, unsigned int sbcount, unsigned int cellw, unsigned int cellh,
+		unsigned int newrows, unsigned int newcolumns, uint32_t blankvalue, unsigned int cellw, unsigned int cellh,
 		long fillcolor, int isremap);
@@ -167,6 +167,9 @@ def OnInitBegin(*args):
 	config.rows=int(config.windims[1]/config.celldims[1])
 
 	config.charcache=200 # number of drawn characters to cache, 200 is default
+	# config.framerate=120 # max screen updates per second, 60 is default, 0 => no limit
+	# config.jumpscroll=0 # bytes per frame to start skipping frames during floods, 16384 is default, 0 => never
+	# config.isshmdraw=1 # draw cells locally and send images, can help with slow X servers
 
 def checkissynched():
 	vte.stderr("config.issynched: "+str(config.issynched()))
@@ -343,6 +346,8 @@ def OnKeySym(key,mods):
 	elif mods&2: # Control
 		if key==0xff52: vte.scrollback(int(config.rows*.8)) # Ctrl-Up
 		elif key==0xff54: vte.scrollback(-int(config.rows*.8)) # Ctrl-Down
+		elif key==0xff50: vte.scrolltop() # Ctrl-Home
+		elif key==0xff57: vte.scrollbottom() # Ctrl-End
 	elif mods&1: # Shift
 		if key==0xff52: vte.scrollback(1) # Shift-Up
 		elif key==0xff54: vte.scrollback(-1) # Shift-Down
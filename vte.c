@@ -23,15 +23,23 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <pty.h>
+#include <pthread.h>
+#include <signal.h>
 #include <ctype.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #define DEBUG
 #include "common/conventions.h"
 #include "common/safemem.h"
 #include "common/blockmem.h"
+#include "common/lazydfa.h"
 #include "common/texttap.h"
 #include "config.h"
 #include "pty.h"
 #include "event.h"
+#include "logfile.h"
 
 #include "vte.h"
 
@@ -128,6 +136,7 @@ vte->baggage.events=events;
 vte->baggage.texttap=texttap;
 
 vte->readqueue.max_buffer=inputbuffersize;
+vte->readqueue.budgetus=BUDGETUS_VTE;
 vte->input.escape.max_buffer=escapebuffersize;
 vte->input.message.max_buffer=messagebuffersize;
 vte->input.message.max_bufferm1=messagebuffersize-1;
@@ -162,10 +171,27 @@ error:
 	return -1;
 }
 void deinit_vte(struct vte *vte) {
+if (vte->parser.isthread) {
+	(ignore)pthread_mutex_lock(&vte->parser.mutex);
+	vte->parser.isquit=1;
+	(ignore)pthread_cond_broadcast(&vte->parser.cond);
+	(ignore)pthread_mutex_unlock(&vte->parser.mutex);
+	(ignore)pthread_join(vte->parser.thread,NULL);
+	(ignore)pthread_cond_destroy(&vte->parser.cond);
+	(ignore)pthread_mutex_destroy(&vte->parser.mutex);
+}
 IFFREE(vte->tofree.buffer);
 IFFREE(vte->tofree.writeq);
 }
 
+static inline uint32_t ucs4tovalue(struct vte *v, uint32_t ucs4, uint32_t mask) {
+// mask is underline|bg|fg from the current sgr, addchar and the run paths all go through here
+#ifndef SPACEHASFG
+if ((ucs4|(mask&UNDERLINEBIT_VALUE))==32) return ucs4|(mask&~v->curfgcolor->fgvaluemask); // whitespace gets foreground 0
+#endif
+return ucs4|mask;
+}
+
 static uint32_t utf8tovalue(struct vte *v, unsigned char *utf8, unsigned int utf8len) {
 uint32_t value;
 
@@ -193,20 +219,7 @@ switch (utf8len) {
 		break;
 	default: value=0; // can't happen
 }
-value|=v->sgr.underlinemask; // bit 30
-#ifndef SPACEHASFG
-if (value==32) { // whitespace gets foreground 0
-	value|=v->curbgcolor->bgvaluemask; // bits 22..25
-} else {
-	value|=v->curbgcolor->bgvaluemask; // bits 22..25
-	value|=v->curfgcolor->fgvaluemask; // bits 26..29
-}
-#else
-value|=v->curbgcolor->bgvaluemask; // bits 22..25
-value|=v->curfgcolor->fgvaluemask; // bits 26..29
-#endif
-
-return value;
+return ucs4tovalue(v,value,v->sgr.underlinemask|v->curbgcolor->bgvaluemask|v->curfgcolor->fgvaluemask);
 }
 
 #ifndef SPACEHASFG
@@ -377,6 +390,15 @@ data[len]='\0';
 // P... is ansi DCS
 }
 
+static inline void startescape(struct vte *v, unsigned int lastmode) {
+v->input.mode=ESCAPE_MODE_INPUT_VTE;
+v->input.escape.state=ESCAPE_STATE_VTE;
+v->input.escape.isoverrun=0;
+v->input.escape.len=0;
+v->input.escape.cur=v->input.escape.buffer;
+v->input.escape.lastmode=lastmode;
+}
+
 static inline void buildpalette(int *isbugout_inout, struct vte *v, unsigned char c) {
 switch (c) {
 	case 24: // CAN
@@ -384,9 +406,7 @@ switch (c) {
 		v->input.mode=0;
 		break;
 	case 27: // ESC
-		v->input.mode=ESCAPE_MODE_INPUT_VTE;
-		v->input.escape.len=0;
-		v->input.escape.lastmode=PALETTE_MODE_INPUT_VTE;
+		(void)startescape(v,PALETTE_MODE_INPUT_VTE);
 		break;
 	case 17: // XON
 	case 19: // XOFF
@@ -439,9 +459,7 @@ switch (c) {
 		v->input.mode=0;
 		break;
 	case 27: // ESC
-		v->input.mode=ESCAPE_MODE_INPUT_VTE;
-		v->input.escape.len=0;
-		v->input.escape.lastmode=MESSAGE_MODE_INPUT_VTE;
+		(void)startescape(v,MESSAGE_MODE_INPUT_VTE);
 		break;
 	case 17: // XON
 	case 19: // XOFF
@@ -453,79 +471,6 @@ switch (c) {
 }
 }
 
-static inline void buildescape(int *isdone_inout, struct vte *v, unsigned char c) {
-if (!v->input.escape.len) {
-	v->input.escape.isoverrun=0;
-	v->input.escape.cur=v->input.escape.buffer+1;
-	v->input.escape.len=1;
-#if 0
-	fprintf(stderr,"%s:%d Buildescape character: 0x%02x\n",__FILE__,__LINE__,c);
-#endif
-	switch ( (v->input.escape.buffer[0]=c) ) {
-		case ']': // OSC
-		case '_': case 'P': case '^': case 'X': // wants ST terminator, no BEL
-			v->input.mode=MESSAGE_MODE_INPUT_VTE;
-			v->input.message.isosc=(c==']');
-			v->input.message.len=1;
-			v->input.message.buffer[0]=c;
-			v->input.message.cur=v->input.message.buffer+1;
-			break;
-		case 24: case 26: // one letter escapes
-		case '#':
-		case '7': // DECSC
-		case '8': // DECRC
-		case '=': case '>': 
-		case 'D': case 'E': case 'H': case 'M':
-		case 'Q': // PU1 private use 1
-		case 'R': // PU2 private use 2
-		case 'Z':
-		case '\\': // ST
-		case 'b': // EMI enable manual input
-		case 'c': 
-			*isdone_inout=1;
-			break;
-		case '(': case ')': // linux
-		case '%': break; // linux iso8859/utf8
-		default:
-			if ( (c < 0x40) || (c > 0x5f) ) { // wikipedia has 0x40..0x5f, expand this as we find more
-#if 1
-				fprintf(stderr,"%s:%d Unexpected character: 0x%02x\n",__FILE__,__LINE__,c);
-#endif
-// what should we do here? lots of terms do this (discard esc, discard c)
-				v->input.mode=0;
-				return;
-			}
-			break;
-	}
-} else {
-	if (v->input.escape.len==v->input.escape.max_buffer) { // overrun
-#if 1
-				fprintf(stderr,"%s:%d Escape sequence too long: %u",__FILE__,__LINE__,v->input.escape.len);
-#endif
-		v->input.escape.isoverrun=1;
-		v->input.escape.cur=v->input.escape.buffer+1;
-		v->input.escape.len=1;
-	} 
-	switch (c) {
-		case 24: // CAN
-		case 26: // SUB
-			v->input.mode=0;
-			break;
-		case 27: // ESC, ignore existing and start new escape 
-			v->input.escape.len=0;
-			break;
-		case 17: // XON
-		case 19: // XOFF
-			break;
-		default:
-			*(v->input.escape.cur)=c;
-			v->input.escape.len+=1;
-			v->input.escape.cur+=1;
-			if ((c>=0x40)&&(c<=0x7e)) *isdone_inout=1;
-	}
-}
-}
-
 #define tab(a) cursorhorizontaltab_ansi(a,1)
 #if 0
 static void tab(struct vte *v) {
@@ -574,28 +519,20 @@ return ret;
 }
 #endif
 
-static void getparam(unsigned int *p_out, unsigned char **data_inout, unsigned char term, unsigned int def) {
-unsigned int p=0;
-unsigned char *data=*data_inout;
-switch (*data) {
-	case '0': p=0; break; case '1': p=1; break; case '2': p=2; break; case '3': p=3; break; case '4': p=4; break;
-	case '5': p=5; break; case '6': p=6; break; case '7': p=7; break; case '8': p=8; break; case '9': p=9; break;
-	case ';': *p_out=def; *data_inout=data+1; return;
-	default: if (*data==term) { *p_out=def; *data_inout=NULL; return; }
-}
-while (1) {
-	data++;
-	switch (*data) {
-		case'0':p=p*10+0;break;case'1':p=p*10+1;break;case'2':p=p*10+2;break;case'3':p=p*10+3;break;case'4':p=p*10+4;break;
-		case'5':p=p*10+5;break;case'6':p=p*10+6;break;case'7':p=p*10+7;break;case'8':p=p*10+8;break;case'9':p=p*10+9;break;
-		case ';': *p_out=p; *data_inout=data+1; return;
-		default: if (*data==term) { *p_out=p; *data_inout=NULL; return; }
-	}
+static inline unsigned int csiparam(struct vte *v, unsigned int i, unsigned int def) {
+// params are accumulated by buildescape, unset and missing params get def
+if (i>v->input.escape.csi.count) return def;
+if (!(v->input.escape.csi.setmask&(1<<i))) return def;
+return v->input.escape.csi.params[i];
 }
+
+static void unknowncsi(struct vte *v, char *label) {
+if (v->input.escape.isoverrun) return;
+printhex2(label,v->input.escape.buffer+1,v->input.escape.len-1,__LINE__);
 }
 
 
-static void sgr_ansi(struct vte *v, unsigned char *data_in, unsigned int len) {
+static void sgr_ansi(struct vte *v) {
 // ends in m
 // m=>0m
 // 0:reset,1:bright,4:underline,7:reverse,22:notbright,24:notunderline,27:notreverse,39:deffg,49:defbg
@@ -605,14 +542,15 @@ static void sgr_ansi(struct vte *v, unsigned char *data_in, unsigned int len) {
 // 40-47:bg=
 // 100-107:bg+bright
 int fgindex,bgindex;
-unsigned char *data=data_in;
-unsigned int p;
+unsigned int i,nparams;
 
 fgindex=v->sgr.fgindex;
 bgindex=v->sgr.bgindex;
 
-while (1) {
-	(void)getparam(&p,&data,'m',0);
+nparams=v->input.escape.csi.count+1;
+for (i=0;i<nparams;i++) {
+	unsigned int p;
+	p=csiparam(v,i,0);
 	switch (p) {
 		case 0:
 			fgindex=FGCOLOR_VTE;
@@ -652,21 +590,20 @@ while (1) {
 		case 100: bgindex=8; break; case 101: bgindex=9; break; case 102: bgindex=10; break; case 103: bgindex=11; break;
 		case 104: bgindex=12; break; case 105: bgindex=13; break; case 106: bgindex=14; break; case 107: bgindex=15; break;
 		default:
-			printhex2("Unhandled SGR",data_in,len,__LINE__);
+			(void)unknowncsi(v,"Unhandled SGR");
 			fprintf(stderr,"%s:%d SGR ignoring unknown %u\n",__FILE__,__LINE__,p);
 			break;
 	}
-	if (!data) {
-		unsigned int isreverse;
-		isreverse=v->sgr.isreverse ^ v->sgr.issuperreverse;
-		if ((v->sgr.isbright)&&(fgindex<8)) fgindex|=8; // maybe bright comes after reverse?
-		if (isreverse)  { v->curfgcolor=&v->colors[bgindex]; v->curbgcolor=&v->colors[fgindex]; }
-		else { v->curfgcolor=&v->colors[fgindex]; v->curbgcolor=&v->colors[bgindex]; }
-		v->sgr.fgindex=fgindex;
-		v->sgr.bgindex=bgindex;
-		if (v->sgr.isinvisible) v->curfgcolor=v->curbgcolor;
-		break;
-	}
+}
+{
+	unsigned int isreverse;
+	isreverse=v->sgr.isreverse ^ v->sgr.issuperreverse;
+	if ((v->sgr.isbright)&&(fgindex<8)) fgindex|=8; // maybe bright comes after reverse?
+	if (isreverse)  { v->curfgcolor=&v->colors[bgindex]; v->curbgcolor=&v->colors[fgindex]; }
+	else { v->curfgcolor=&v->colors[fgindex]; v->curbgcolor=&v->colors[bgindex]; }
+	v->sgr.fgindex=fgindex;
+	v->sgr.bgindex=bgindex;
+	if (v->sgr.isinvisible) v->curfgcolor=v->curbgcolor;
 }
 }
 
@@ -766,13 +703,13 @@ v->input.mode=REPEAT_MODE_INPUT_VTE;
 }
 
 
-static inline void setcursorposition_ansi(struct vte *v, unsigned char *data, unsigned int len, unsigned char terminator) {
+static inline void setcursorposition_ansi(struct vte *v, unsigned int p, unsigned int q) {
 // n;mH: row n, col m, 1-based, n=''=>1, set to 1,1 until overwritten
-unsigned int p;
 
 v->cur.isovercol=0;
 
-(void)getparam(&p,&data,terminator,1);
+if (!p) p=1;
+if (!q) q=1;
 #if 0
 	fprintf(stderr,"%s:%d CUP to %u, istopleft:%u scrolling.top:%u\n",__FILE__,__LINE__,p,v->scrolling.istopleft,v->scrolling.top); 
 #endif
@@ -783,10 +720,7 @@ if (v->scrolling.istopleft) {
 } else {
 	v->cur.row=(p-1)%v->config.rows;
 }
-if (data) {
-	(void)getparam(&p,&data,terminator,1);
-	v->cur.col=(p-1)%v->config.columns;
-} else v->cur.col=0;
+v->cur.col=(q-1)%v->config.columns;
 }
 
 static void dsr_ansi(struct vte *v, unsigned int p) {
@@ -804,7 +738,7 @@ switch (p) {
 }
 }
 
-static inline void deviceattributes_ansi(struct vte *v, unsigned char *data, unsigned int len) {
+static inline void deviceattributes_ansi(struct vte *v) {
 (void)generic_event(v->baggage.events,vt102_decid);
 }
 
@@ -868,14 +802,10 @@ v->curbgcolor=temp;
 (void)reverse_event(v->baggage.events);
 }
 
-static void scrollingregion(struct vte *v, unsigned char *data, unsigned int len) {
+static void scrollingregion(struct vte *v, unsigned int top, unsigned int bottom) {
 // N;Mr, top:N, bottom:M
-unsigned int top,bottom=v->config.rows;
-(void)getparam(&top,&data,'r',1);
 if (top) top-=1;
-if (data) {
-	(void)getparam(&bottom,&data,'r',bottom);
-}
+if (!bottom) bottom=v->config.rows;
 v->scrolling.top=top;
 v->scrolling.bottom=bottom-1;
 #if 0
@@ -914,239 +844,177 @@ row=_BADMIN(row,v->config.rowsm1);
 v->cur.row=row;
 }
 
-static void processcsi(struct vte *v, unsigned char *data_in, unsigned int len) {
-unsigned char *data=data_in;
-unsigned int p;
-int unk=1;
-
-#if 0
-printhex2("Received csi escape",data,len,__LINE__);
-#endif
-
-switch (data[len-1]) {
-	case '@': // ansi ICH
-		(void)getparam(&p,&data,'@',1);
-		(void)insertchar_ansi(v,p);
-		break;
-	case 'A': // ansi CUU
-		(void)getparam(&p,&data,'A',1);
-		(void)cursorup_ansi(v,p);
-		break;
-	case 'B': // ansi CUD
-		(void)getparam(&p,&data,'B',1);
-		(void)cursordown_ansi(v,p);
-		break;
-	case 'C': // ansi CUF
-		(void)getparam(&p,&data,'C',1);
-		(void)cursorforward_ansi(v,p);
-		break;
-	case 'D': // ansi CUB
-		(void)getparam(&p,&data,'D',1);
-		(void)cursorbackward_ansi(v,p);
-		break;
-	case 'E': // ansi CNL
-		(void)getparam(&p,&data,'E',1);
-		(void)cursornextline_ansi(v,p);
-		break;
-	case 'F': // ansi CPL
-		(void)getparam(&p,&data,'F',1);
-		(void)cursorprecedingline_ansi(v,p);
-		break;
-	case 'G': // ansi CHA
-		(void)getparam(&p,&data,'G',1);
-		(void)cursorhorizontalabsolute_ansi(v,p);
-		break;
-	case 'H': // ansi CUP
-		(void)setcursorposition_ansi(v,data,len,'H');
-//		printhex2("Set cursor position",data_in,len,__LINE__);
-		break;
-	case 'I': // ansi CHT
-		(void)getparam(&p,&data,'I',1);
-		(void)cursorhorizontaltab_ansi(v,p);
-		break;
-	case 'J': // ansi ED
-		(void)getparam(&p,&data,'J',0);
-		(void)eraseindisplay(v,p);
-//		printhex2("Erase in display",data_in,len,__LINE__);
-		break;
-	case 'K': // ansi EL
-		(void)getparam(&p,&data,'K',0);
-		switch (p) {
-			case 0:
-				(void)eraseinline(v,v->cur.col,v->config.columns-v->cur.col);
-				break;
-			case 1:
-				(void)eraseinline(v,0,v->cur.col);
-				break;
-			case 2:
-				(void)eraseline(v,v->cur.row,1);
-			default: printhex2("Erase in line",data_in,len,__LINE__); break;
-		}
-		break;
-	case 'L': // ansi IL
-		(void)getparam(&p,&data,'L',1);
-		p=_BADMIN(p,v->config.rows);
-		(void)insertlines(v,p);
-//		printhex2("Insert lines",data_in,len,__LINE__);
-		break;
-	case 'M': // ansi DL
-		(void)getparam(&p,&data,'M',1);
-		p=_BADMIN(p,v->config.rows);
-		(void)deleteline_ansi(v,p);
-		break;
-	case 'P': // ansi DCH
-		(void)getparam(&p,&data,'P',1);
-		(void)dch_ansi(v,p);
-		break;
-	case 'R': // ansi CPR
-//		(void)cursorpositionreport_ansi(v,data,len);
-		break;
-	case 'W': // ansi CTC
-//		(void)cursortabcontrol_ansi(v,data,len);
-		break;
-	case 'X': // ansi ECH
-		(void)getparam(&p,&data,'X',1);
-		(void)ech_ansi(v,p);
-		break;
-	case 'Y': // ansi CVT
-//		(void)cursorverticaltab_ansi(v,data,len);
-		break;
-	case 'Z': // ansi CBT
-		(void)getparam(&p,&data,'Z',1);
-		(void)cursorbackwardtab_ansi(v,p);
+static void el_ansi(struct vte *v, unsigned int p) {
+switch (p) {
+	case 0:
+		(void)eraseinline(v,v->cur.col,v->config.columns-v->cur.col);
 		break;
-	case ']': // TODO support linux private csi
+	case 1:
+		(void)eraseinline(v,0,v->cur.col);
 		break;
-	case 'a': // ansi HPR, format effector of CUF
-		(void)getparam(&p,&data,'a',1);
-		(void)cursorforward_ansi(v,p);
+	case 2:
+		(void)eraseline(v,v->cur.row,1);
 		break;
-	case 'b': // ansi REP
-		(void)getparam(&p,&data,'b',1);
-		(void)repeatchar_ansi(v,p);
+	default: (void)unknowncsi(v,"Erase in line"); break;
+}
+}
+
+static int setmode_ansi(struct vte *v, unsigned int p, unsigned int isset) {
+// returns 0 if p is unknown
+switch (p) {
+	case 3: v->config.isshowcontrol=isset; break; // DECCRM
+	case 4: v->config.isinsertmode=isset; break; // DECIM
+	default: return 0;
+}
+return 1;
+}
+
+static int setprivatemode_ansi(struct vte *v, unsigned int p, unsigned int isset) {
+// returns 0 if p is unknown
+switch (p) {
+	case 1: v->keyboardstates.iscursorappmode=isset; (void)appcursor_event(v->baggage.events,isset); break;
+	case 3: break; // DECCOLM set 132 (h) or 80 (l) columns
+	case 5: (void)setreverse_sgr(v,isset); break; // DECSCNM reverse video
+	case 6: v->scrolling.istopleft=isset; break; // DECOM
+	case 7: v->config.isautowrap=isset; break; // DECAWM
+	case 8: v->config.isautorepeat=isset; (void)autorepeat_event(v->baggage.events,isset); break; // DECARM
+	case 9: break; // X10 mouse reporting
+	case 25: // cursor on/off
+		(void)smessage2_event(v->baggage.events,(unsigned char *)(isset?"[?25h":"[?25l"),5);
 		break;
-	case 'c': // ansi DA
-		if (len==1) (void)deviceattributes_ansi(v,data,len);
-		else if ( (len==3) && (data[0]=='?') ) { // data[1]: 0=>reset,1=>hide,2..9=>height
+	case 1000: return 0; // TODO X11 mouse reporting
+	case 1049: return 0; // disable/re-enable history // TODO
+	default: return 0;
+}
+return 1;
+}
+
+static void modes_ansi(struct vte *v, unsigned int isset) {
+// h and l, every param is a mode
+unsigned int i,nparams;
+int unk=0;
+nparams=v->input.escape.csi.count+1;
+for (i=0;i<nparams;i++) {
+	unsigned int p;
+	p=csiparam(v,i,0);
+	if (v->input.escape.csi.private=='?') {
+		if (!setprivatemode_ansi(v,p,isset)) unk=1;
+	} else if (!v->input.escape.csi.private) {
+		if (!setmode_ansi(v,p,isset)) unk=1;
+	} else unk=1;
+}
+if (!unk) return;
+#ifndef DEBUG2
+if (!isset) return; // there's no real need to print unrecognized disabling
+#endif
+(void)unknowncsi(v,"Unknown csi escape");
+}
+
+// CSI handlers, one per final byte, params come from v->input.escape.csi
+static void ich_csi(struct vte *v) { (void)insertchar_ansi(v,csiparam(v,0,1)); } // ansi ICH
+static void cuu_csi(struct vte *v) { (void)cursorup_ansi(v,csiparam(v,0,1)); } // ansi CUU
+static void cud_csi(struct vte *v) { (void)cursordown_ansi(v,csiparam(v,0,1)); } // ansi CUD, also VPR
+static void cuf_csi(struct vte *v) { (void)cursorforward_ansi(v,csiparam(v,0,1)); } // ansi CUF, also HPR
+static void cub_csi(struct vte *v) { (void)cursorbackward_ansi(v,csiparam(v,0,1)); } // ansi CUB
+static void cnl_csi(struct vte *v) { (void)cursornextline_ansi(v,csiparam(v,0,1)); } // ansi CNL
+static void cpl_csi(struct vte *v) { (void)cursorprecedingline_ansi(v,csiparam(v,0,1)); } // ansi CPL
+static void cha_csi(struct vte *v) { (void)cursorhorizontalabsolute_ansi(v,csiparam(v,0,1)); } // ansi CHA
+static void cup_csi(struct vte *v) { (void)setcursorposition_ansi(v,csiparam(v,0,1),csiparam(v,1,1)); } // ansi CUP, also HVP
+static void cht_csi(struct vte *v) { (void)cursorhorizontaltab_ansi(v,csiparam(v,0,1)); } // ansi CHT
+static void ed_csi(struct vte *v) { (void)eraseindisplay(v,csiparam(v,0,0)); } // ansi ED
+static void el_csi(struct vte *v) { (void)el_ansi(v,csiparam(v,0,0)); } // ansi EL
+static void il_csi(struct vte *v) { (void)insertlines(v,_BADMIN(csiparam(v,0,1),v->config.rows)); } // ansi IL
+static void dl_csi(struct vte *v) { (void)deleteline_ansi(v,_BADMIN(csiparam(v,0,1),v->config.rows)); } // ansi DL
+static void dch_csi(struct vte *v) { (void)dch_ansi(v,csiparam(v,0,1)); } // ansi DCH
+static void ech_csi(struct vte *v) { (void)ech_ansi(v,csiparam(v,0,1)); } // ansi ECH
+static void cbt_csi(struct vte *v) { (void)cursorbackwardtab_ansi(v,csiparam(v,0,1)); } // ansi CBT
+static void rep_csi(struct vte *v) { (void)repeatchar_ansi(v,csiparam(v,0,1)); } // ansi REP
+static void vpa_csi(struct vte *v) { (void)vpa_ansi(v,csiparam(v,0,1)); } // ansi VPA
+static void tbc_csi(struct vte *v) { (void)tabclear_ansi(v,csiparam(v,0,0)); } // ansi TBC
+static void sm_csi(struct vte *v) { (void)modes_ansi(v,1); } // ansi SM, DECSET
+static void rm_csi(struct vte *v) { (void)modes_ansi(v,0); } // ansi RM, DECRST
+static void sgr_csi(struct vte *v) { (void)sgr_ansi(v); } // ansi SGR
+static void dsr_csi(struct vte *v) { (void)dsr_ansi(v,csiparam(v,0,0)); } // ansi DSR
+static void decstbm_csi(struct vte *v) { (void)scrollingregion(v,csiparam(v,0,1),csiparam(v,1,0)); } // linux DECSTBM
+static void ignore_csi(struct vte *v) { } // recognized, nothing to do
+static void da_csi(struct vte *v) { // ansi DA
+unsigned int p;
+switch (v->input.escape.csi.private) {
+	case 0: (void)deviceattributes_ansi(v); return;
+	case '?': // linux cursor, 0=>reset,1=>hide,2..9=>height
+		p=csiparam(v,0,0);
+		if ((!v->input.escape.csi.count)&&(p<10)) {
 			unsigned char temp[4]={'[','?','0','c'};
-			temp[2]=data[1];
+			temp[2]='0'+p;
 			(void)smessage2_event(v->baggage.events,temp,4);
-		} else {
-			printhex2("Unknown csi escape",data,len,__LINE__);
+			return;
 		}
 		break;
-	case 'd': // ansi VPA
-		(void)getparam(&p,&data,'d',1);
-		(void)vpa_ansi(v,p);
-		break;
-	case 'e': // ansi VPR, format effector version of CUD
-		(void)getparam(&p,&data,'d',1);
-		(void)cursordown_ansi(v,p);
-		break;
-	case 'f': // ansi HVP, format effector version of CUP
-		(void)setcursorposition_ansi(v,data,len,'f');
-		break;
-	case 'g': // ansi TBC
-		(void)getparam(&p,&data,'g',0);
-		(void)tabclear_ansi(v,p);
-		break;
-	case 'h':
-		switch (len) {
-			case 2:
-				switch (data[0]) {
-					case '3': v->config.isshowcontrol=1; unk=0; break; // DECCRM on
-					case '4': v->config.isinsertmode=1; unk=0; break; // DECIM
-				}
-				break;
-			case 3:
-				if (data[0]=='?') {
-					switch (data[1]) {
-						case '1': v->keyboardstates.iscursorappmode=1; (void)appcursor_event(v->baggage.events,1); unk=0; break;
-						case '3': unk=0; break; // DECCOLM set 132 columns
-						case '5': (void)setreverse_sgr(v,1); unk=0; break; // DECSCNM reverse video
-						case '6': v->scrolling.istopleft=1; unk=0; break; // DECOM
-						case '7': v->config.isautowrap=1; unk=0; break; // DECAWM
-						case '8': v->config.isautorepeat=1; (void)autorepeat_event(v->baggage.events,1); unk=0; break; // DECARM
-						case '9': unk=0; break; // X10 mouse reporting
-					}
-				}
-				break;
-			case 4:
-				if (!memcmp(data,"?25h",4)) { // cursor on
-					(void)smessage2_event(v->baggage.events,(unsigned char *)"[?25h",5);
-					unk=0;
-				} 
-				break;
-			case 6:
-				if (!memcmp(data,"?1000h",6)) { // TODO X11 mouse reporting
-				} else if (!memcmp(data,"?1049h",6)) { // disable history // TODO
-				}
-				break;
-			}
-			if (unk) printhex2("Unknown csi escape",data,len,__LINE__);
-		break;
-	case 'l':
-		switch (len) {
-			case 2:
-				switch (data[0]) {
-					case '3': v->config.isshowcontrol=0; unk=0; break; // DECCRM off
-					case '4': v->config.isinsertmode=0; unk=0; break; // DECIM
-				}
-				break;
-			case 3:
-				if (data[0]=='?') {
-					switch (data[1]) {
-						case '1': v->keyboardstates.iscursorappmode=0; (void)appcursor_event(v->baggage.events,0); unk=0; break;
-						case '3': unk=0; break; // DECCOLM set 80 columns
-						case '5': (void)setreverse_sgr(v,0); unk=0; break; // DECSCNM restore reverse video
-						case '6': v->scrolling.istopleft=0; unk=0; break; // DECOM
-						case '7': v->config.isautowrap=0; unk=0; break; // DECAWM
-						case '8': v->config.isautorepeat=0; (void)autorepeat_event(v->baggage.events,0); unk=0; break; // DECARM
-						case '9': unk=0; break; // X10 mouse reporting
-					}
-				}
-				break;
-			case 4:
-				if (!memcmp(data,"?25l",4)) { // cursor off
-					(void)smessage2_event(v->baggage.events,(unsigned char *)"[?25l",5);
-					unk=0;
-				} 
-				break;
-			case 6:
-				if (!memcmp(data,"?1000l",6)) { // TODO X11 mouse reporting
-				} else if (!memcmp(data,"?1049l",6)) { // re-enable history // TODO
-				}
-				break;
-			} 
-#ifdef DEBUG2
-// there's no real need to print recognized disabling
-			if (unk) printhex2("Unknown csi escape",data,len,__LINE__);
+}
+(void)unknowncsi(v,"Unknown csi escape");
+}
+static void windowops_csi(struct vte *v) {
+switch (csiparam(v,0,0)) {
+	case 22: break; // store window and title
+	case 23: break; // restore window and title
+	default: (void)unknowncsi(v,"Unknown csi escape"); break;
+}
+}
+
+#define FINAL_CSI(a)	((a)-'@')
+static void (* const functions_csi[FINAL_CSI('~')+1])(struct vte *)={
+	[FINAL_CSI('@')]=ich_csi,
+	[FINAL_CSI('A')]=cuu_csi,
+	[FINAL_CSI('B')]=cud_csi,
+	[FINAL_CSI('C')]=cuf_csi,
+	[FINAL_CSI('D')]=cub_csi,
+	[FINAL_CSI('E')]=cnl_csi,
+	[FINAL_CSI('F')]=cpl_csi,
+	[FINAL_CSI('G')]=cha_csi,
+	[FINAL_CSI('H')]=cup_csi,
+	[FINAL_CSI('I')]=cht_csi,
+	[FINAL_CSI('J')]=ed_csi,
+	[FINAL_CSI('K')]=el_csi,
+	[FINAL_CSI('L')]=il_csi,
+	[FINAL_CSI('M')]=dl_csi,
+	[FINAL_CSI('P')]=dch_csi,
+	[FINAL_CSI('R')]=ignore_csi, // ansi CPR
+	[FINAL_CSI('W')]=ignore_csi, // ansi CTC
+	[FINAL_CSI('X')]=ech_csi,
+	[FINAL_CSI('Y')]=ignore_csi, // ansi CVT
+	[FINAL_CSI('Z')]=cbt_csi,
+	[FINAL_CSI(']')]=ignore_csi, // TODO support linux private csi
+	[FINAL_CSI('a')]=cuf_csi, // ansi HPR, format effector of CUF
+	[FINAL_CSI('b')]=rep_csi,
+	[FINAL_CSI('c')]=da_csi,
+	[FINAL_CSI('d')]=vpa_csi,
+	[FINAL_CSI('e')]=cud_csi, // ansi VPR, format effector version of CUD
+	[FINAL_CSI('f')]=cup_csi, // ansi HVP, format effector version of CUP
+	[FINAL_CSI('g')]=tbc_csi,
+	[FINAL_CSI('h')]=sm_csi,
+	[FINAL_CSI('l')]=rm_csi,
+	[FINAL_CSI('m')]=sgr_csi,
+	[FINAL_CSI('n')]=dsr_csi,
+	[FINAL_CSI('o')]=ignore_csi, // ansi DAQ
+	[FINAL_CSI('q')]=ignore_csi, // linux DECLL keyboard LEDs, not much we can do, we could tell python though
+	[FINAL_CSI('r')]=decstbm_csi,
+	[FINAL_CSI('t')]=windowops_csi,
+};
+
+static void processcsi(struct vte *v, unsigned char final) {
+// final is 0x40..0x7e, guaranteed by transitions_escape
+void (*fn)(struct vte *);
+
+#if 0
+printhex2("Received csi escape",v->input.escape.buffer,v->input.escape.len,__LINE__);
 #endif
-		break;
-	case 'm': //		printhex2("Color change",data,len,__LINE__);
-		(void)sgr_ansi(v,data,len);
-		break;
-	case 'n': // ansi DSR
-		(void)getparam(&p,&data,'n',0);
-		(void)dsr_ansi(v,p);
-		break;
-	case 'o': // ansi DAQ
-//		(void)defineareaqualification(v,data,len);
-		break;
-	case 'q': break; // linux DECLL keyboard LEDs, not much we can do, we could tell python though
-	case 'r': // linux DECSTBM
-		(void)scrollingregion(v,data,len);
-		break;
-	case 't':
-		if ((len==7)&&(!memcmp(data,"22;0;0t",7))) {
-			// store window and title
-		} else if ((len==7)&&(!memcmp(data,"23;0;0t",7))) {
-			// restore window and title
-		} else printhex2("Unknown csi escape",data,len,__LINE__);
-		break;
-	default:
-		printhex2("Unknown csi escape",data,len,__LINE__);
+
+fn=functions_csi[FINAL_CSI(final)];
+if ((!fn)||(v->input.escape.csi.intermediate)) {
+	(void)unknowncsi(v,"Unknown csi escape");
+	return;
 }
+(void)fn(v);
 }
 
 
@@ -1189,10 +1057,11 @@ static void processescape(int *isbugout_inout, struct vte *v) {
 unsigned char *data;
 unsigned int len;
 
-if (v->input.escape.isoverrun) return; // data is overwritten
+data=v->input.escape.buffer;
+len=v->input.escape.len; // len >= 1, ESC is clipped off, last byte is the final
+if (*data=='[') { (void)processcsi(v,data[len-1]); return; } // params are already parsed, overrun doesn't matter
 
-data=v->input.escape.buffer; // data is 0-term
-len=v->input.escape.len; // len > 1, needed ESC+START+END to get here, ESC is clipped off, TERM is clipped off
+if (v->input.escape.isoverrun) return; // data is overwritten
 #if 0
 printhex3("escape",data,len,__LINE__);
 #endif
@@ -1221,8 +1090,7 @@ switch (*data) {
 			(void)cancelpreviouscharacter_ansi(v,data,len);
 		break;
 #endif
-	case 'Z': (void)deviceattributes_ansi(v,NULL,0); break;
-	case '[': (void)processcsi(v,data+1,len-1); break;
+	case 'Z': (void)deviceattributes_ansi(v); break;
 	case '\\': 
 		if (v->input.escape.lastmode==MESSAGE_MODE_INPUT_VTE) { // ansi ST, message is finished
 			v->input.mode=0;
@@ -1237,20 +1105,460 @@ switch (*data) {
 }
 }
 
+// dec/vt500 style escape parser, see vt100.net/emu/dec_ansi_parser
+// ground is handled by processreadqueue_vte, other string states by buildmessage and buildpalette
+#define C0_CLASS_ESCAPE		0
+#define CANSUB_CLASS_ESCAPE	1
+#define ESC_CLASS_ESCAPE	2
+#define INTER_CLASS_ESCAPE	3 // 0x20..0x2f
+#define DIGIT_CLASS_ESCAPE	4
+#define COLON_CLASS_ESCAPE	5
+#define SEMI_CLASS_ESCAPE	6
+#define PRIVATE_CLASS_ESCAPE	7 // 0x3c..0x3f
+#define FINAL_CLASS_ESCAPE	8 // 0x40..0x7e except below
+#define CSI_CLASS_ESCAPE	9 // '['
+#define STRING_CLASS_ESCAPE	10 // ']','P','X','^','_'
+#define DEL_CLASS_ESCAPE	11
+#define HIGH_CLASS_ESCAPE	12 // 0x80..0xff
+#define COUNT_CLASS_ESCAPE	13
+
+static const unsigned char classes_escape[256]={
+	[0x00 ... 0x17]=C0_CLASS_ESCAPE,
+	[0x18]=CANSUB_CLASS_ESCAPE,
+	[0x19]=C0_CLASS_ESCAPE,
+	[0x1a]=CANSUB_CLASS_ESCAPE,
+	[0x1b]=ESC_CLASS_ESCAPE,
+	[0x1c ... 0x1f]=C0_CLASS_ESCAPE,
+	[0x20 ... 0x2f]=INTER_CLASS_ESCAPE,
+	[0x30 ... 0x39]=DIGIT_CLASS_ESCAPE,
+	[0x3a]=COLON_CLASS_ESCAPE,
+	[0x3b]=SEMI_CLASS_ESCAPE,
+	[0x3c ... 0x3f]=PRIVATE_CLASS_ESCAPE,
+	[0x40 ... 0x7e]=FINAL_CLASS_ESCAPE,
+	['[']=CSI_CLASS_ESCAPE,
+	[']']=STRING_CLASS_ESCAPE, ['P']=STRING_CLASS_ESCAPE, ['X']=STRING_CLASS_ESCAPE,
+	['^']=STRING_CLASS_ESCAPE, ['_']=STRING_CLASS_ESCAPE,
+	[0x7f]=DEL_CLASS_ESCAPE,
+	[0x80 ... 0xff]=HIGH_CLASS_ESCAPE,
+};
+
+// transitions are (action<<4)|nextstate
+#define IGNORE_ACTION_ESCAPE		(0<<4)
+#define EXECUTE_ACTION_ESCAPE		(1<<4) // C0 inside a sequence
+#define CANCEL_ACTION_ESCAPE		(2<<4)
+#define RESTART_ACTION_ESCAPE		(3<<4) // ESC inside a sequence
+#define COLLECT_ACTION_ESCAPE		(4<<4)
+#define ESCDISPATCH_ACTION_ESCAPE	(5<<4)
+#define CSIENTER_ACTION_ESCAPE		(6<<4)
+#define PARAM_ACTION_ESCAPE		(7<<4)
+#define SEPARATOR_ACTION_ESCAPE		(8<<4)
+#define PRIVATE_ACTION_ESCAPE		(9<<4)
+#define CSIINTER_ACTION_ESCAPE		(10<<4)
+#define CSIDISPATCH_ACTION_ESCAPE	(11<<4)
+#define STRING_ACTION_ESCAPE		(12<<4)
+#define END_ACTION_ESCAPE		(13<<4) // end of an ignored sequence
+
+#define ROW_ESCAPE(c0,inter,digit,colon,semi,private,final,csi,string,high) { \
+	[C0_CLASS_ESCAPE]=c0, [CANSUB_CLASS_ESCAPE]=CANCEL_ACTION_ESCAPE, [ESC_CLASS_ESCAPE]=RESTART_ACTION_ESCAPE, \
+	[INTER_CLASS_ESCAPE]=inter, [DIGIT_CLASS_ESCAPE]=digit, [COLON_CLASS_ESCAPE]=colon, [SEMI_CLASS_ESCAPE]=semi, \
+	[PRIVATE_CLASS_ESCAPE]=private, [FINAL_CLASS_ESCAPE]=final, [CSI_CLASS_ESCAPE]=csi, [STRING_CLASS_ESCAPE]=string, \
+	[DEL_CLASS_ESCAPE]=c0, [HIGH_CLASS_ESCAPE]=high }
+
+static const unsigned char transitions_escape[CSIIGNORE_STATE_VTE+1][COUNT_CLASS_ESCAPE]={
+// DEL is ignored like C0 here, but EXECUTE_ACTION_ESCAPE ignores 0x7f anyway
+	[ESCAPE_STATE_VTE]=ROW_ESCAPE(
+		EXECUTE_ACTION_ESCAPE|ESCAPE_STATE_VTE,
+		COLLECT_ACTION_ESCAPE|ESCINTER_STATE_VTE,
+		ESCDISPATCH_ACTION_ESCAPE, ESCDISPATCH_ACTION_ESCAPE, ESCDISPATCH_ACTION_ESCAPE, ESCDISPATCH_ACTION_ESCAPE,
+		ESCDISPATCH_ACTION_ESCAPE,
+		CSIENTER_ACTION_ESCAPE|CSIENTRY_STATE_VTE,
+		STRING_ACTION_ESCAPE,
+		CANCEL_ACTION_ESCAPE),
+	[ESCINTER_STATE_VTE]=ROW_ESCAPE(
+		EXECUTE_ACTION_ESCAPE|ESCINTER_STATE_VTE,
+		COLLECT_ACTION_ESCAPE|ESCINTER_STATE_VTE,
+		ESCDISPATCH_ACTION_ESCAPE, ESCDISPATCH_ACTION_ESCAPE, ESCDISPATCH_ACTION_ESCAPE, ESCDISPATCH_ACTION_ESCAPE,
+		ESCDISPATCH_ACTION_ESCAPE, ESCDISPATCH_ACTION_ESCAPE, ESCDISPATCH_ACTION_ESCAPE,
+		IGNORE_ACTION_ESCAPE|ESCINTER_STATE_VTE),
+	[CSIENTRY_STATE_VTE]=ROW_ESCAPE(
+		EXECUTE_ACTION_ESCAPE|CSIENTRY_STATE_VTE,
+		CSIINTER_ACTION_ESCAPE|CSIINTER_STATE_VTE,
+		PARAM_ACTION_ESCAPE|CSIPARAM_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		SEPARATOR_ACTION_ESCAPE|CSIPARAM_STATE_VTE,
+		PRIVATE_ACTION_ESCAPE|CSIPARAM_STATE_VTE,
+		CSIDISPATCH_ACTION_ESCAPE, CSIDISPATCH_ACTION_ESCAPE, CSIDISPATCH_ACTION_ESCAPE,
+		IGNORE_ACTION_ESCAPE|CSIENTRY_STATE_VTE),
+	[CSIPARAM_STATE_VTE]=ROW_ESCAPE(
+		EXECUTE_ACTION_ESCAPE|CSIPARAM_STATE_VTE,
+		CSIINTER_ACTION_ESCAPE|CSIINTER_STATE_VTE,
+		PARAM_ACTION_ESCAPE|CSIPARAM_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		SEPARATOR_ACTION_ESCAPE|CSIPARAM_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		CSIDISPATCH_ACTION_ESCAPE, CSIDISPATCH_ACTION_ESCAPE, CSIDISPATCH_ACTION_ESCAPE,
+		IGNORE_ACTION_ESCAPE|CSIPARAM_STATE_VTE),
+	[CSIINTER_STATE_VTE]=ROW_ESCAPE(
+		EXECUTE_ACTION_ESCAPE|CSIINTER_STATE_VTE,
+		CSIINTER_ACTION_ESCAPE|CSIINTER_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		CSIDISPATCH_ACTION_ESCAPE, CSIDISPATCH_ACTION_ESCAPE, CSIDISPATCH_ACTION_ESCAPE,
+		IGNORE_ACTION_ESCAPE|CSIINTER_STATE_VTE),
+	[CSIIGNORE_STATE_VTE]=ROW_ESCAPE(
+		EXECUTE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE,
+		END_ACTION_ESCAPE, END_ACTION_ESCAPE, END_ACTION_ESCAPE,
+		IGNORE_ACTION_ESCAPE|CSIIGNORE_STATE_VTE),
+};
+
+static void executec0(struct vte *v, unsigned char c) {
+// C0 inside a sequence is executed without interrupting it, vt100 allows it in CSI
+switch (c) {
+	case 8: (void)cursorbackward_ansi(v,1); break;
+	case 9: (void)tab(v); break;
+	case 10: case 11: case 12: (void)lf(v); break;
+	case 13: (void)cr(v); break;
+	// XON, XOFF and the rest are ignored
+}
+}
+
+static inline void collectescape(struct vte *v, unsigned char c) {
+// raw bytes are kept for non-CSI dispatch and for printing unknown sequences
+if (v->input.escape.len==v->input.escape.max_buffer) { // overrun
+#if 1
+	fprintf(stderr,"%s:%d Escape sequence too long: %u",__FILE__,__LINE__,v->input.escape.len);
+#endif
+	v->input.escape.isoverrun=1;
+	v->input.escape.cur=v->input.escape.buffer+1;
+	v->input.escape.len=1;
+}
+*(v->input.escape.cur)=c;
+v->input.escape.len+=1;
+v->input.escape.cur+=1;
+}
+
+static inline void buildescape(int *isdone_inout, struct vte *v, unsigned char c) {
+unsigned int t;
+
+#if 0
+fprintf(stderr,"%s:%d Buildescape character: 0x%02x state:%u\n",__FILE__,__LINE__,c,v->input.escape.state);
+#endif
+t=transitions_escape[v->input.escape.state][classes_escape[c]];
+v->input.escape.state=t&15;
+switch (t&~15) {
+	case IGNORE_ACTION_ESCAPE: break;
+	case EXECUTE_ACTION_ESCAPE: (void)executec0(v,c); break;
+	case CANCEL_ACTION_ESCAPE: v->input.mode=0; break;
+	case RESTART_ACTION_ESCAPE: (void)startescape(v,v->input.escape.lastmode); break; // ignore existing and start new escape
+	case COLLECT_ACTION_ESCAPE: (void)collectescape(v,c); break;
+	case ESCDISPATCH_ACTION_ESCAPE:
+		(void)collectescape(v,c);
+		*isdone_inout=1;
+		break;
+	case CSIENTER_ACTION_ESCAPE:
+		(void)collectescape(v,c);
+		v->input.escape.csi.isoverflow=0;
+		v->input.escape.csi.count=0;
+		v->input.escape.csi.setmask=0;
+		v->input.escape.csi.params[0]=0;
+		v->input.escape.csi.private=0;
+		v->input.escape.csi.intermediate=0;
+		break;
+	case PARAM_ACTION_ESCAPE:
+		(void)collectescape(v,c);
+		if (!v->input.escape.csi.isoverflow) {
+			unsigned int i,p;
+			i=v->input.escape.csi.count;
+			p=v->input.escape.csi.params[i];
+			if (p<100000) p=p*10+(c-'0'); // saturate, every param we use is small
+			v->input.escape.csi.params[i]=p;
+			v->input.escape.csi.setmask|=1<<i;
+		}
+		break;
+	case SEPARATOR_ACTION_ESCAPE:
+		(void)collectescape(v,c);
+		if (v->input.escape.csi.count==MAX_PARAMS_CSI_VTE-1) v->input.escape.csi.isoverflow=1; // extra params are dropped
+		else {
+			v->input.escape.csi.count+=1;
+			v->input.escape.csi.params[v->input.escape.csi.count]=0;
+		}
+		break;
+	case PRIVATE_ACTION_ESCAPE:
+		(void)collectescape(v,c);
+		v->input.escape.csi.private=c;
+		break;
+	case CSIINTER_ACTION_ESCAPE:
+		(void)collectescape(v,c);
+		v->input.escape.csi.intermediate=c;
+		break;
+	case CSIDISPATCH_ACTION_ESCAPE:
+		(void)collectescape(v,c);
+		*isdone_inout=1;
+		break;
+	case STRING_ACTION_ESCAPE: // ]: OSC, _P^X: want ST terminator, no BEL
+		v->input.mode=MESSAGE_MODE_INPUT_VTE;
+		v->input.message.isosc=(c==']');
+		v->input.message.isoverrun=0;
+		v->input.message.len=1;
+		v->input.message.buffer[0]=c;
+		v->input.message.cur=v->input.message.buffer+1;
+		break;
+	case END_ACTION_ESCAPE:
+		v->input.mode=v->input.escape.lastmode;
+		break;
+}
+}
+
 static int isaddtapevent(struct vte *v, unsigned int value) {
-if (isnocbadd_texttap(v->baggage.texttap,value)) return 0;
-(void)tap_event(v->baggage.events,value);
-return 1;
+// returns 1 if value got a tap event of its own, the parse stops after it
+// values for full taps only are batched into the slice's taprun event
+struct texttap *texttap=v->baggage.texttap;
+if (texttap->fulltap.first) {
+	uint32_t *dest;
+	if (!reservetaps_event(v->baggage.events,1)) goto tap;
+	if (!isnocbadd_texttap(texttap,value)) goto tap;
+	if ((dest=taprun_event(v->baggage.events,1))) *dest=value;
+	return 0;
+}
+if (isnocbadd_texttap(texttap,value)) return 0;
+tap:
+	(void)tap_event(v->baggage.events,value);
+	return 1;
 }
 
 // TODO change 5 to actual, perhaps 4: 1: cursor, 1: eraselines, 1: eraseinline, 1: tapevent
 #define MINUNUSEDEVENTS	5
+#define FUSE_BUDGET_VTE	256 // loops between clock checks
+
+static uint64_t getmicroseconds(void) {
+struct timespec ts;
+(ignore)clock_gettime(CLOCK_MONOTONIC,&ts);
+return (uint64_t)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+static inline unsigned int printablerun(unsigned char *data, unsigned int len) {
+// returns count of leading bytes in 32..126
+unsigned int n=0;
+#ifdef __SSE2__
+__m128i flip,lo,hi;
+flip=_mm_set1_epi8((char)0x80); // compare unsigned bytes as signed
+lo=_mm_set1_epi8((char)(31^0x80));
+hi=_mm_set1_epi8((char)(127^0x80));
+while (len-n>=16) {
+	__m128i x;
+	unsigned int mask;
+	x=_mm_xor_si128(_mm_loadu_si128((__m128i*)(data+n)),flip);
+	mask=_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(x,lo),_mm_cmplt_epi8(x,hi)));
+	if (mask!=0xffff) return n+__builtin_ctz(~mask);
+	n+=16;
+}
+#endif
+while (n<len) {
+	if ((data[n]<32)||(data[n]>126)) break;
+	n++;
+}
+return n;
+}
+
+static unsigned int addstring(int *istap_out, struct vte *v, unsigned char *data, unsigned int len) {
+// data[0..len) are printable 7bit, this is addchar() for a run, one addstring event per row
+// returns the number of bytes used, stops after a char that needs a tap event
+struct all_event *events=v->baggage.events;
+uint32_t mask;
+unsigned int used=0;
+int istap=0,isfulltap;
+
+isfulltap=(v->baggage.texttap->fulltap.first!=NULL);
+mask=v->sgr.underlinemask|v->curbgcolor->bgvaluemask|v->curfgcolor->fgvaluemask;
+while (len) {
+	uint32_t *cells;
+	unsigned int n,i;
+	if (!isroom_event(events,MINUNUSEDEVENTS)) break;
+	(void)advanceovercol(v);
+	n=_BADMIN(len,v->config.columns-v->cur.col);
+	if (!(n=reservecells_event(events,n))) break;
+	if (isfulltap && !(n=reservetaps_event(events,n))) break;
+	i=nocbaddbytes_texttap(v->baggage.texttap,data,n);
+	if (i<n) { n=i+1; istap=1; }
+	if (isfulltap && i) {
+		uint32_t *taps;
+		unsigned int j;
+		if ((taps=taprun_event(events,i))) for (j=0;j<i;j++) taps[j]=data[j];
+	}
+	if (!(cells=addstring_event(events,v->cur.row,v->cur.col,n))) break;
+	for (i=0;i<n;i++) cells[i]=ucs4tovalue(v,data[i],mask);
+	v->input.repeat.value=cells[n-1];
+	v->cur.col+=n-1;
+	(void)incrcursor(v);
+	data+=n;
+	len-=n;
+	used+=n;
+	if (istap) {
+		(void)tap_event(events,data[-1]);
+		break;
+	}
+}
+*istap_out=istap;
+return used;
+}
+
+static inline unsigned int textrun(unsigned char *data, unsigned int len) {
+// returns count of leading bytes that aren't C0 or DEL, i.e. printable 7bit and all 8bit
+unsigned int n=0;
+#ifdef __SSE2__
+__m128i flip,lo,del;
+flip=_mm_set1_epi8((char)0x80);
+lo=_mm_set1_epi8((char)(32^0x80));
+del=_mm_set1_epi8((char)127);
+while (len-n>=16) {
+	__m128i x;
+	unsigned int mask;
+	x=_mm_loadu_si128((__m128i*)(data+n));
+	mask=_mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(_mm_xor_si128(x,flip),lo),_mm_cmpeq_epi8(x,del)));
+	if (mask) return n+__builtin_ctz(mask);
+	n+=16;
+}
+#endif
+while (n<len) {
+	if ((data[n]<32)||(data[n]==127)) break;
+	n++;
+}
+return n;
+}
+
+static unsigned int decodeutf8(uint32_t *ucs4, unsigned int max, unsigned int *used_out, unsigned char *data, unsigned int len) {
+// decodes up to max codepoints from data[0..len), returns the count, data is from textrun
+// invalid bytes and overlongs become U+FFFD (one per maximal subpart)
+// stops before a sequence that is cut off by len, UTF8_MODE_INPUT_VTE finishes those
+unsigned int n=0,i=0;
+while ((n<max)&&(i<len)) {
+	unsigned int c,need,cp,lower,upper,j;
+#ifdef __SSE2__
+	if ((len-i>=16)&&(max-n>=16)) {
+		__m128i x,zero,lo,hi;
+		x=_mm_loadu_si128((__m128i*)(data+i));
+		if (!_mm_movemask_epi8(x)) { // 16 7bit chars, widen to 32bit
+			zero=_mm_setzero_si128();
+			lo=_mm_unpacklo_epi8(x,zero);
+			hi=_mm_unpackhi_epi8(x,zero);
+			_mm_storeu_si128((__m128i*)(ucs4+n),_mm_unpacklo_epi16(lo,zero));
+			_mm_storeu_si128((__m128i*)(ucs4+n+4),_mm_unpackhi_epi16(lo,zero));
+			_mm_storeu_si128((__m128i*)(ucs4+n+8),_mm_unpacklo_epi16(hi,zero));
+			_mm_storeu_si128((__m128i*)(ucs4+n+12),_mm_unpackhi_epi16(hi,zero));
+			n+=16; i+=16;
+			continue;
+		}
+	}
+	if ((len-i>=16)&&(max-n>=4)&&((data[i]&0xf0)==0xe0)) { // 4 3-byte chars in 12 bytes, cjk is mostly this
+		static const unsigned char masks[16]={0xf0,0xc0,0xc0,0xf0,0xc0,0xc0,0xf0,0xc0,0xc0,0xf0,0xc0,0xc0,0,0,0,0};
+		static const unsigned char values[16]={0xe0,0x80,0x80,0xe0,0x80,0x80,0xe0,0x80,0x80,0xe0,0x80,0x80,0,0,0,0};
+		__m128i x;
+		x=_mm_and_si128(_mm_loadu_si128((__m128i*)(data+i)),_mm_loadu_si128((__m128i*)masks));
+		if (0xffff==_mm_movemask_epi8(_mm_cmpeq_epi8(x,_mm_loadu_si128((__m128i*)values)))) {
+			unsigned char *d=data+i;
+			for (j=0;j<4;j++,d+=3) {
+				if ((d[0]==0xe0)&&(d[1]<0xa0)) break; // overlong
+				if ((d[0]==0xed)&&(d[1]>=0xa0)) break; // surrogate
+				ucs4[n+j]=((d[0]&0xf)<<12)|((d[1]&0x3f)<<6)|(d[2]&0x3f);
+			}
+			n+=j; i+=3*j;
+			if (j==4) continue;
+		}
+	}
+#endif
+	c=data[i];
+	if (c<0x80) { ucs4[n++]=c; i++; continue; }
+	lower=0x80; upper=0xbf;
+	if (c<0xc2) { ucs4[n++]=0xfffd; i++; continue; } // continuation or overlong lead
+	else if (c<0xe0) { need=1; cp=c&0x1f; }
+	else if (c<0xf0) { need=2; cp=c&0xf; if (c==0xe0) lower=0xa0; else if (c==0xed) upper=0x9f; }
+	else if (c<0xf5) { need=3; cp=c&0x7; if (c==0xf0) lower=0x90; else if (c==0xf4) upper=0x8f; }
+	else { ucs4[n++]=0xfffd; i++; continue; }
+	for (j=1;j<=need;j++) {
+		unsigned int b;
+		if (i+j==len) { *used_out=i; return n; } // cut off
+		b=data[i+j];
+		if ((b<lower)||(b>upper)) break;
+		cp=(cp<<6)|(b&0x3f);
+		lower=0x80; upper=0xbf;
+	}
+	if (j<=need) { ucs4[n++]=0xfffd; i+=j; continue; }
+	ucs4[n++]=cp;
+	i+=need+1;
+}
+*used_out=i;
+return n;
+}
+
+static unsigned int addutf8(int *istap_out, struct vte *v, unsigned char *data, unsigned int len) {
+// data[0..len) is from textrun, this is addstring() for utf8, one addstring event per row
+// returns the number of bytes used, 0 if the first sequence is cut off
+struct all_event *events=v->baggage.events;
+uint32_t mask;
+unsigned int used=0;
+int istap=0,isfulltap;
+
+isfulltap=(v->baggage.texttap->fulltap.first!=NULL);
+mask=v->sgr.underlinemask|v->curbgcolor->bgvaluemask|v->curfgcolor->fgvaluemask;
+while (len) {
+	uint32_t ucs4[256],*cells;
+	unsigned int n,i,k;
+	if (!isroom_event(events,MINUNUSEDEVENTS)) break;
+	(void)advanceovercol(v);
+	n=_BADMIN(256,v->config.columns-v->cur.col);
+	if (!(n=reservecells_event(events,n))) break;
+	if (isfulltap && !(n=reservetaps_event(events,n))) break;
+	if (!(n=decodeutf8(ucs4,n,&k,data,len))) break;
+	i=nocbaddrun_texttap(v->baggage.texttap,ucs4,n);
+	if (i<n) {
+		n=decodeutf8(ucs4,i+1,&k,data,len); // find the byte count for the shorter run
+		istap=1;
+	}
+	if (isfulltap && i) {
+		uint32_t *taps;
+		if ((taps=taprun_event(events,i))) memcpy(taps,ucs4,i*sizeof(uint32_t));
+	}
+	if (!(cells=addstring_event(events,v->cur.row,v->cur.col,n))) break;
+	for (i=0;i<n;i++) cells[i]=ucs4tovalue(v,ucs4[i],mask);
+	v->input.repeat.value=cells[n-1];
+	v->cur.col+=n-1;
+	(void)incrcursor(v);
+	data+=k;
+	len-=k;
+	used+=k;
+	if (istap) {
+		(void)tap_event(events,ucs4[n-1]);
+		break;
+	}
+}
+*istap_out=istap;
+return used;
+}
+
+static void releasering(struct vte *v, unsigned char *start) {
+// pty ring bytes up to readqueue.q are parsed, nothing points into them
+if (!v->readqueue.isring) return;
+(void)release_pty(v->baggage.pty,v->readqueue.q-start);
+if (v->readqueue.qlen) return;
+v->readqueue.isring=0;
+v->readqueue.q=v->readqueue.buffer;
+}
+
 int processreadqueue_vte(struct vte *v) {
-unsigned char *data;
-unsigned int len;
+unsigned char *data,*first;
+unsigned int len,fuse=FUSE_BUDGET_VTE;
+uint64_t start;
 
-data=v->readqueue.q;
+first=data=v->readqueue.q;
 len=v->readqueue.qlen;
+start=getmicroseconds();
 
 #if 0
 printhex3("vte read",data,len,__LINE__);
@@ -1259,7 +1567,11 @@ printhex3("vte read",data,len,__LINE__);
 while (1) {
 // fprintf(stderr,"%s:%d Processing character 0x%02x(%c) mode is %u\n",__FILE__,__LINE__,*data, isprint(*data)?*data:'?', v->input.mode);
 //	fprintf(stderr,"%s:%d cursor is currently row:%u col:%u\n",__FILE__,__LINE__,v->cur.row,v->cur.col);
-	if ( (v->baggage.events->unused.count < MINUNUSEDEVENTS)) goto endearly;
+	if (!isroom_event(v->baggage.events,MINUNUSEDEVENTS)) goto endearly;
+	if (!--fuse) { // the pool can be large, this keeps keys from waiting on a long parse
+		if (getmicroseconds()-start>=v->readqueue.budgetus) goto endearly;
+		fuse=FUSE_BUDGET_VTE;
+	}
 	switch (v->input.mode) {
 		case UTF8_MODE_INPUT_VTE:
 			if (!v->input.utf8.isdone) {
@@ -1309,12 +1621,19 @@ while (1) {
 			}
 			break;
 		default: // if we wanted to, we could unwind this for all 8bit values
+			if ((*data>=32)&&(*data<127)&&(!v->config.isinsertmode)) {
+				int istap=0;
+				unsigned int k;
+				k=addstring(&istap,v,data,printablerun(data,len));
+				if (!k) goto endearly;
+				if (istap) { data+=k; len-=k; goto endearly; }
+				data+=k-1; len-=k-1; // last byte is consumed below
+				break;
+			}
 			if (*data&128) {
 				if (v->config.is8859) { // TODO do other 8bit escapes
 					if (*data==0x9b) { // CSI
-						v->input.mode=ESCAPE_MODE_INPUT_VTE;
-						v->input.escape.len=0;
-						v->input.escape.lastmode=0;
+						(void)startescape(v,0);
 						(void)buildescape(NULL,v,'[');
 					} else {
 						unsigned char utf82[2];
@@ -1325,6 +1644,14 @@ while (1) {
 						if (isaddtapevent(v,d)) { data++; len--; goto endearly; }
 					}
 				} else {
+					if (!v->config.isinsertmode) {
+						int istap=0;
+						unsigned int k;
+						k=addutf8(&istap,v,data,textrun(data,len));
+						if (istap) { data+=k; len-=k; goto endearly; }
+						if (k) { data+=k-1; len-=k-1; break; } // last byte is consumed below
+						// k==0 => cut off by the read or no room, go a byte at a time
+					}
 					v->input.mode=UTF8_MODE_INPUT_VTE;
 					if ((*data&(64+32))==64) { // two
 						v->input.utf8.len=2; v->input.utf8.bytesleft=1;
@@ -1362,7 +1689,7 @@ while (1) {
 				case 15: break; // SI (Shift-In)
 				case 24: break; // CAN, ignored here
 				case 26: break; // SUB, ignored here
-				case 27: v->input.mode=ESCAPE_MODE_INPUT_VTE; v->input.escape.len=0; v->input.escape.lastmode=0; break;
+				case 27: (void)startescape(v,0); break;
 				case 127: break;
 				case 1: case 2: case 3: case 4:
 				case 6:
@@ -1386,25 +1713,103 @@ while (1) {
 	data++;
 }
 // fprintf(stderr,"%s:%d setting cursor to row:%u col:%u\n",__FILE__,__LINE__,v->cur.row,v->cur.col);
+v->readqueue.q=data+1;
 v->readqueue.qlen=0;
+(void)releasering(v,first);
 (void)setcursor_event(v->baggage.events,v->cur.row,v->cur.col);
+(void)endtaprun_event(v->baggage.events);
 return 0;
 endearly: // A note on bugout: it lets events/xclient use vte buffers w/o worrying about overwriting buffer
 // BUT, the main reasons for bugout is: 1> so script can pause immediately, 2> script can resize surface immediately
 	v->readqueue.q=data;
 	v->readqueue.qlen=len;
+	(void)releasering(v,first);
 	(void)setcursor_event(v->baggage.events,v->cur.row,v->cur.col);
+	(void)endtaprun_event(v->baggage.events);
 	return 0;
 }
 
+static void *parser_vte(void *v_in) {
+// runs processreadqueue_vte when beginparse_vte hands over the vte
+struct vte *v=(struct vte *)v_in;
+sigset_t set;
+(ignore)sigfillset(&set);
+(ignore)pthread_sigmask(SIG_BLOCK,&set,NULL); // signals stay with the main thread
+(ignore)pthread_mutex_lock(&v->parser.mutex);
+while (1) {
+	unsigned int qlen;
+	int r;
+	while (!v->parser.isbusy && !v->parser.isquit) (ignore)pthread_cond_wait(&v->parser.cond,&v->parser.mutex);
+	if (v->parser.isquit) break;
+	(ignore)pthread_mutex_unlock(&v->parser.mutex);
+	qlen=v->readqueue.qlen;
+	r=processreadqueue_vte(v);
+	(ignore)pthread_mutex_lock(&v->parser.mutex);
+	v->parser.bytes=qlen-v->readqueue.qlen;
+	v->parser.result=r;
+	v->parser.isbusy=0;
+	(ignore)pthread_cond_broadcast(&v->parser.cond);
+}
+(ignore)pthread_mutex_unlock(&v->parser.mutex);
+return NULL;
+}
+
+int startparser_vte(struct vte *vte, struct all_event *spare) {
+// spare should be initialized like baggage.events
+if (pthread_mutex_init(&vte->parser.mutex,NULL)) GOTOERROR;
+if (pthread_cond_init(&vte->parser.cond,NULL)) {
+	(ignore)pthread_mutex_destroy(&vte->parser.mutex);
+	GOTOERROR;
+}
+if (pthread_create(&vte->parser.thread,NULL,parser_vte,vte)) {
+	(ignore)pthread_cond_destroy(&vte->parser.cond);
+	(ignore)pthread_mutex_destroy(&vte->parser.mutex);
+	GOTOERROR;
+}
+vte->parser.spare=spare;
+vte->parser.isthread=1;
+return 0;
+error:
+	return -1;
+}
+
+void beginparse_vte(struct vte *vte) {
+// parses the next slice into the spare pool, nothing may touch vte until endparse_vte
+// the caller keeps drawing baggage.events from before the call
+struct all_event *events;
+events=vte->baggage.events;
+vte->baggage.events=vte->parser.spare;
+vte->parser.spare=events;
+(ignore)pthread_mutex_lock(&vte->parser.mutex);
+vte->parser.isbusy=1;
+(ignore)pthread_cond_broadcast(&vte->parser.cond);
+(ignore)pthread_mutex_unlock(&vte->parser.mutex);
+}
+
+int endparse_vte(unsigned int *bytes_out, struct vte *vte) {
+// waits for beginparse_vte's slice, its events are in baggage.events
+int r;
+(ignore)pthread_mutex_lock(&vte->parser.mutex);
+while (vte->parser.isbusy) (ignore)pthread_cond_wait(&vte->parser.cond,&vte->parser.mutex);
+*bytes_out=vte->parser.bytes;
+r=vte->parser.result;
+(ignore)pthread_mutex_unlock(&vte->parser.mutex);
+return r;
+}
+
 int fillreadqueue_vte(struct vte *vte) {
+// points the readqueue at what the pty's reader thread has, returns -1 after the child is gone
 struct pty *pty=vte->baggage.pty;
-int k;
-k=read(pty->master,vte->readqueue.buffer,vte->readqueue.max_buffer);
-if (k<1) return -1;
-vte->readqueue.q=vte->readqueue.buffer;
-vte->readqueue.qlen=k;
-// fprintf(stderr,"%s:%d:%s %d bytes read\n",__FILE__,__LINE__,__FUNCTION__,k);
+unsigned char *data;
+unsigned int len;
+if (vte->readqueue.qlen) return 0;
+if (!(data=peek_pty(&len,pty))) return -1;
+if (!len) return 0;
+if (vte->baggage.logfile) write_logfile(vte->baggage.logfile,data,len);
+vte->readqueue.q=data;
+vte->readqueue.qlen=len;
+vte->readqueue.isring=1;
+// fprintf(stderr,"%s:%d:%s %u bytes read\n",__FILE__,__LINE__,__FUNCTION__,len);
 return 0;
 }
 
@@ -1412,6 +1817,8 @@ int insert_readqueue_vte(struct vte *vte, char *str, unsigned int len) {
 unsigned char *dest;
 unsigned int destlen,ui;
 if (vte->input.mode) return -1;
+if (vte->readqueue.isring) return -1;
+if (!vte->readqueue.qlen) vte->readqueue.q=vte->readqueue.buffer;
 ui=vte->readqueue.qlen;
 dest=vte->readqueue.q+ui;
 destlen=vte->readqueue.max_buffer-ui;
@@ -24,6 +24,7 @@ struct rgb_vte {
 #define FGCOLOR_VTE	15
 #define BGCOLOR_VTE	0
 #define CURSORCOLOR_VTE	9
+#define BUDGETUS_VTE	4000 // how long processreadqueue_vte parses before returning to the main loop
 
 struct vte {
 	struct {
@@ -46,10 +47,12 @@ struct vte {
 		unsigned int top,bottom;
 	} scrolling;
 	struct {
-		unsigned char *buffer;
+		unsigned char *buffer; // for insertions, pty data is parsed in place in pty.ring
 		unsigned int max_buffer;
 		unsigned char *q;
 		unsigned int qlen; // !0 => vte is waiting on .waitline to be drawn
+		unsigned int budgetus;
+		int isring:1; // q points into pty.ring
 	} readqueue;
 	struct {
 // we want it to be large enough to take a dsr and anything a script will send
@@ -76,11 +79,27 @@ struct vte {
 			unsigned char four[4],*cur;
 		} utf8;
 		struct {
+#define ESCAPE_STATE_VTE	0
+#define ESCINTER_STATE_VTE	1
+#define CSIENTRY_STATE_VTE	2
+#define CSIPARAM_STATE_VTE	3
+#define CSIINTER_STATE_VTE	4
+#define CSIIGNORE_STATE_VTE	5
 			int isoverrun:1;
+			unsigned int state; // dec/vt500 parser state, see transitions_escape in vte.c
 			unsigned int len;
 			unsigned int max_buffer;
 			unsigned char *buffer,*cur;
 			unsigned int lastmode; // where escape came from
+			struct {
+#define MAX_PARAMS_CSI_VTE	16
+				int isoverflow:1;
+				unsigned int count; // index of param being built, nparams is count+1
+				uint32_t setmask; // bit i => params[i] was given, otherwise use default
+				unsigned int params[MAX_PARAMS_CSI_VTE];
+				unsigned char private; // '<','=','>','?' or 0
+				unsigned char intermediate; // last of 0x20..0x2f or 0
+			} csi;
 		} escape;
 		struct {
 			unsigned int fuse;
@@ -125,10 +144,20 @@ struct vte {
 		unsigned char *buffer;
 		unsigned char *writeq;
 	} tofree;
+	struct {
+		int isthread:1;
+		int isbusy,isquit,result; // guarded by mutex
+		unsigned int bytes; // consumed by the last slice
+		struct all_event *spare; // the pool xclient is drawing while we parse
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		pthread_t thread;
+	} parser; // config.isparsethread, a slice is parsed while the last one is drawn
 	struct {
 		struct pty *pty;
 		struct all_event *events;
 		struct texttap *texttap;
+		struct logfile *logfile; // NULL unless config.logfile is set
 	} baggage;
 };
 
@@ -143,3 +172,6 @@ int flush_vte(struct vte *vte);
 void setcolor_vte(struct vte *vte, unsigned int index, unsigned char r, unsigned char g, unsigned char b);
 int insert_readqueue_vte(struct vte *vte, char *str, unsigned int len);
 int resize_vte(struct vte *vte, unsigned int rows, unsigned int cols);
+int startparser_vte(struct vte *vte, struct all_event *spare);
+void beginparse_vte(struct vte *vte);
+int endparse_vte(unsigned int *bytes_out, struct vte *vte);
@@ -29,11 +29,12 @@
 #include <sys/socket.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
-// #include <X11/extensions/XShm.h>
+#include <X11/extensions/XShm.h>
 #include <time.h>
 #include <netinet/in.h>
 #define DEBUG
 #include "common/conventions.h"
+#include "common/safemem.h"
 
 #include "x11info.h"
 
@@ -52,126 +53,101 @@ return paint2_image_x11info(ix,0,stop,0,dtop,ix->width,height,1);
 }
 #endif
 
-#if 0
+static int isshmusable(struct x11info *x) {
+char *disable;
+int isfound;
+disable=getenv("_X11_NO_MITSHM");
+if (disable && !strcmp(disable,"1")) return 0;
+if (!XShmQueryExtension(x->display)) return 0;
+if (testforshm_x11info(&isfound,x)) return 0;
+return isfound;
+}
+
 int init_image_x11info(struct image_x11info *ix, struct x11info *x, unsigned int w, unsigned int h, unsigned char *bgbgra) {
+// frame is 32bpp, shared with the server if possible
+XShmSegmentInfo *shminfo;
 ix->x=x;
 ix->width=w;
 ix->height=h;
-#if 0
-if (tryshm && x->hasxshmext) {
+if (isshmusable(x)) {
+	if (!(shminfo=ix->shminfo=MALLOC(sizeof(XShmSegmentInfo)))) GOTOERROR;
+	shminfo->shmaddr=NULL;
+	shminfo->shmid=-1;
 	ix->image=XShmCreateImage(x->display,
 			x->visual,
-			x->depth,ZPixmap,NULL,&ix->shminfo,w,h);
+			x->depth,ZPixmap,NULL,shminfo,w,h);
 	if (!ix->image) GOTOERROR;
-	if (ix->image->bytes_per_line!=4*w) GOTOERROR;
-	if (ix->image->height!=h) GOTOERROR;
-	if (0>(ix->shminfo.shmid=shmget(IPC_PRIVATE,ix->image->bytes_per_line * ix->image->height, IPC_CREAT|0777))) GOTOERROR;
-	ix->shminfo.shmaddr=NULL;
+	if (0>(shminfo->shmid=shmget(IPC_PRIVATE,ix->image->bytes_per_line * ix->image->height, IPC_CREAT|0600))) GOTOERROR;
+	if ((void *)-1==(shminfo->shmaddr=ix->image->data=shmat(shminfo->shmid,NULL,0))) {
+		shminfo->shmaddr=ix->image->data=NULL;
+		GOTOERROR;
+	}
+	ix->frame=(unsigned char *)shminfo->shmaddr;
+	shminfo->readOnly=True;
+	if (!XShmAttach(x->display,shminfo)) GOTOERROR;
 	ix->isxshm=1;
-	if (!(ix->shminfo.shmaddr=ix->image->data=shmat(ix->shminfo.shmid,NULL,0))) GOTOERROR;
-	ix->frame=(unsigned char *)ix->shminfo.shmaddr;
-	ix->shminfo.readOnly=True;
-	if (!XShmAttach(x->display,&ix->shminfo)) GOTOERROR;
-//	if (!XInitImage(ix->image)) GOTOERROR; // this confuses XDestroyImage do a bad free
-	XFlush(x->display);
+	XSync(x->display,False);
+	(ignore)shmctl(shminfo->shmid,IPC_RMID,0); // freed after both sides detach
 } else {
-#endif
-	if (x->Bpp!=4) GOTOERROR;
-	if (!(ix->frame=malloc(w*h*4))) GOTOERROR;
+	if (!(ix->frame=MALLOC(w*h*4))) GOTOERROR;
 	ix->image=XCreateImage(x->display,
 			x->visual,
 			x->depth,ZPixmap,0,(char *)ix->frame,w,h,
 			32,0);
 	if (!ix->image) GOTOERROR;
 	if (!XInitImage(ix->image)) GOTOERROR;
-#if 0
 }
-#endif
-(void)fillframe(ix->frame,bgbgra,w*h);
+if (ix->image->bits_per_pixel!=32) GOTOERROR;
+ix->stride=ix->image->bytes_per_line;
+if (bgbgra) (void)fillframe(ix->frame,bgbgra,(ix->stride/4)*h);
 return 0;
 error:
 	return -1;
 }
-#endif
 
-#if 0
 void deinit_image_x11info(struct image_x11info *ix) {
-#if 0
+XShmSegmentInfo *shminfo=ix->shminfo;
 if (ix->isxshm) {
-	XShmDetach(ix->x->display,&ix->shminfo);
+	XShmDetach(ix->x->display,shminfo);
+	XSync(ix->x->display,False);
 }
-#endif
-if (ix->image) XDestroyImage(ix->image);
-else iffree(ix->frame);
-#if 0
-if (ix->isxshm) {
-	if (ix->shminfo.shmaddr) shmdt(ix->shminfo.shmaddr);
-	shmctl(ix->shminfo.shmid,IPC_RMID,0);
+if (ix->image) {
+	ix->image->data=NULL; // we free the frame ourselves
+	XDestroyImage(ix->image);
+}
+if (shminfo) {
+	if (shminfo->shmaddr) (ignore)shmdt(shminfo->shmaddr);
+	if (!ix->isxshm && (shminfo->shmid>=0)) (ignore)shmctl(shminfo->shmid,IPC_RMID,0);
+	FREE(shminfo);
+} else {
+	IFFREE(ix->frame);
 }
-#endif
 }
-#endif
 
-#if 0
-int paint_image_x11info(struct image_x11info *ix, unsigned int left, unsigned int top) {
-#if 0
-if (ix->isxshm) {
-	int evtype;
-	if (!XShmPutImage(ix->x->display,ix->x->window,ix->x->context,ix->image,0,0,left,top,ix->width,ix->height,True)) GOTOERROR;
-	evtype=XShmGetEventBase(ix->x->display)+ShmCompletion;
-	if (waitforevent(ix->x,evtype,__LINE__,1)) GOTOERROR;
-} else {
-#endif
-	if (XPutImage(ix->x->display,ix->x->window,
-			ix->x->context,
-			ix->image,
-			0,0,left,top,ix->width,ix->height)) GOTOERROR;
-	XFlush(ix->x->display);
-// }
-return 0;
-error:
-	return -1;
+void sync_image_x11info(struct image_x11info *ix) {
+// shm puts read the frame later, wait before changing it
+if (!ix->isputpending) return;
+ix->isputpending=0;
+if ((long)(ix->putseq-LastKnownRequestProcessed(ix->x->display))<=0) return; // already done
+XSync(ix->x->display,False);
 }
 
 int paint2_image_x11info(struct image_x11info *ix, unsigned int sleft, unsigned int stop, unsigned int dleft, unsigned int dtop,
 		unsigned int width, unsigned int height) {
-#if 0
 if (ix->isxshm) {
 	if (!XShmPutImage(ix->x->display,ix->x->window,ix->x->context,ix->image,sleft,stop,dleft,dtop,width,height,False)) GOTOERROR;
+	ix->isputpending=1;
+	ix->putseq=NextRequest(ix->x->display)-1;
 } else {
-#endif
 	if (XPutImage(ix->x->display,ix->x->window,
 			ix->x->context,
 			ix->image,
 			sleft,stop,dleft,dtop,width,height)) GOTOERROR;
-// }
-return 0;
-error:
-	return -1;
-}
-#endif
-#if 0
-int paint2_image_x11info(struct image_x11info *ix, unsigned int sleft, unsigned int stop, unsigned int dleft, unsigned int dtop,
-		unsigned int width, unsigned int height, int iswait) {
-if (ix->isxshm) {
-	if (!XShmPutImage(ix->x->display,ix->x->window,ix->x->context,ix->image,sleft,stop,dleft,dtop,width,height,iswait)) GOTOERROR;
-	if (iswait) {
-		int evtype;
-		evtype=XShmGetEventBase(ix->x->display)+ShmCompletion;
-		if (waitforevent(ix->x,evtype,__LINE__,1)) GOTOERROR;
-	}
-} else {
-	if (XPutImage(ix->x->display,ix->x->window,
-			ix->x->context,
-			ix->image,
-			sleft,stop,dleft,dtop,width,height)) GOTOERROR;
-	if (iswait) XFlush(ix->x->display);
 }
 return 0;
 error:
 	return -1;
 }
-#endif
 
 #if 0
 static char *errorcodetostring(int error_code, char *def) {
@@ -198,7 +174,6 @@ return def;
 }
 #endif
 
-#if 0
 static unsigned long goterror_global;
 
 static int nullerrorhandler(Display *d, XErrorEvent *ev) {
@@ -211,7 +186,6 @@ fprintf(stderr,"Received error from X server (%d:%s) serial:%lu\n",
 goterror_global=ev->serial;
 return 0;
 }
-#endif
 
 char *evtypetostring_x11info(int type, char *def) {
 switch (type) {
@@ -444,7 +418,7 @@ x->attr.border_pixel=WhitePixel(x->display,x->screen);
 	x->attr.background_pixel=xc.pixel;
 }
 x->attr.event_mask= ExposureMask| ButtonPressMask | ButtonReleaseMask | Button1MotionMask |
-		Button3MotionMask | KeyPressMask | KeyReleaseMask | FocusChangeMask  | StructureNotifyMask;
+		Button3MotionMask | KeyPressMask | KeyReleaseMask | FocusChangeMask  | StructureNotifyMask | PropertyChangeMask;
 awidth=width;aheight=height;
 if (isfs) {
 	awidth=x->defscreen.width/2;
@@ -570,13 +544,11 @@ error:
 #endif
 
 
-#if 0
 int testforshm_x11info(int *isfound_out, struct x11info *x) {
 XImage *image=NULL;
 XShmSegmentInfo shminfo;
 int isfound=1;
 
-if (!x->hasxshmext) { *isfound_out=0; return 0; }
 shminfo.shmaddr=NULL;
 shminfo.shmid=-1;
 
@@ -584,8 +556,8 @@ XSetErrorHandler(nullerrorhandler);
 goterror_global=0;
 image=XShmCreateImage(x->display,x->visual,x->depth,ZPixmap,NULL,&shminfo,1,1);
 if (!image) GOTOERROR;
-if (0>(shminfo.shmid=shmget(IPC_PRIVATE,image->bytes_per_line*image->height,IPC_CREAT|0777))) GOTOERROR;
-if (!(shminfo.shmaddr=image->data=shmat(shminfo.shmid,NULL,0))) GOTOERROR;
+if (0>(shminfo.shmid=shmget(IPC_PRIVATE,image->bytes_per_line*image->height,IPC_CREAT|0600))) GOTOERROR;
+if ((void *)-1==(shminfo.shmaddr=image->data=shmat(shminfo.shmid,NULL,0))) { shminfo.shmaddr=NULL; GOTOERROR; }
 if (!XShmAttach(x->display,&shminfo)) GOTOERROR;
 XSync(x->display,False);
 XShmDetach(x->display,&shminfo);
@@ -607,7 +579,6 @@ error:
 	XSetErrorHandler(NULL);
 	return -1;
 }
-#endif
 
 
 int resizewindow_x11info(struct x11info *x, unsigned int width, unsigned int height) {
@@ -35,25 +35,26 @@ struct x11info {
 	} defscreen;
 };
 
-#if 0
 struct image_x11info {
 	struct x11info *x;
 	XImage *image;
+	void *shminfo; // XShmSegmentInfo, NULL without shm
 	unsigned char *frame;
-	unsigned int width,height;
+	unsigned int width,height,stride;
+	unsigned int isxshm:1;
+	unsigned int isputpending:1;
+	unsigned long putseq; // request number of the last shm put
 };
-#endif
 
 int init_x11info(struct x11info *x, unsigned int width, unsigned int height, char *display, unsigned char *bgra_bg, int isfs,
 		char *wintitle);
 int halfinit_x11info(struct x11info *x, char *display);
 void deinit_x11info(struct x11info *x);
-#if 0
 int init_image_x11info(struct image_x11info *ix, struct x11info *x, unsigned int w, unsigned int h, unsigned char *bgbgra);
 void deinit_image_x11info(struct image_x11info *b);
+void sync_image_x11info(struct image_x11info *ix);
 int paint2_image_x11info(struct image_x11info *ix, unsigned int sleft, unsigned int stop, unsigned int dleft, unsigned int dtop,
 		unsigned int width, unsigned int height);
-#endif
 int testforshm_x11info(int *isfound_out, struct x11info *x);
 char *evtypetostring_x11info(int type, char *def);
 int resizewindow_x11info(struct x11info *x, unsigned int width, unsigned int height);
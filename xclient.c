@@ -22,11 +22,17 @@
 #include <string.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <ctype.h>
 #include <time.h>
+#include <errno.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/Xatom.h>
 #include <X11/cursorfont.h>
 #include <X11/Xft/Xft.h>
 #include <X11/XKBlib.h>
@@ -35,16 +41,20 @@
 #include "common/conventions.h"
 #include "common/safemem.h"
 #include "common/blockmem.h"
+#include "common/lazydfa.h"
 #include "common/texttap.h"
 #include "pty.h"
 #include "x11info.h"
 #include "xftchar.h"
 #include "charcache.h"
+#include "shmdraw.h"
 #include "event.h"
 #include "vte.h"
 #include "cursor.h"
 #include "keysym.h"
 #include "xclipboard.h"
+#include "history.h"
+#include "search.h"
 
 #include "xclient.h"
 #include "surface.h"
@@ -767,6 +777,7 @@ static int noop3_hook(void *v, char *ign2, unsigned int ign) { return 0; }
 static int noop4_hook(void *v, unsigned int ign2, unsigned int ign) { return 0; }
 static int noop5_hook(void *v,unsigned int ign5,unsigned int ign4,unsigned int ign3,unsigned int ign2,unsigned int ign) { return 0; }
 static char *noopstrpuint_hook(unsigned int *p, void *v) { return NULL; }
+static int nofd_hook(void *v) { return -1; }
 
 static inline void init_hooks(struct xclient *xc) {
 xc->hooks.control_s=noop2_hook;
@@ -777,6 +788,7 @@ xc->hooks.bell=noop_hook;
 xc->hooks.alarmcall=noop2_hook;
 xc->hooks.getinsertion=noopstrpuint_hook;
 xc->hooks.checkinsertion=noop_hook;
+xc->hooks.insertionfd=nofd_hook;
 xc->hooks.message=noop3_hook;
 xc->hooks.keysym=noop4_hook;
 xc->hooks.unkeysym=noop4_hook;
@@ -785,7 +797,8 @@ xc->hooks.pointer=noop5_hook;
 }
 
 int init_xclient(struct xclient *xc, struct config *config, struct x11info *x, struct xftchar *xftchar,
-		struct charcache *charcache, struct texttap *texttap, struct pty *pty, struct all_event *events, struct vte *vte,
+		struct charcache *charcache, struct charcache *maskcache, struct shmdraw *shmdraw, struct texttap *texttap, struct pty *pty,
+		struct all_event *events, struct vte *vte,
 		struct cursor *cursor, struct xclipboard *xclipboard, void *script) {
 uint32_t blankval;
 unsigned int rows,columns;
@@ -808,13 +821,18 @@ xc->config.rowsm1=rows-1;
 xc->config.rowwidth=config->rowwidth;
 xc->config.colheight=config->colheight;
 xc->config.scrollbackcount=config->scrollbackcount;
-if (xc->config.scrollbackcount==1) xc->config.scrollbackcount=2; // 1 => crashy crashy
 xc->config.movepixels=(x->defscreen.height*x->defscreen.height) / (x->defscreen.heightmm*x->defscreen.heightmm);
 xc->config.isautorepeat=1;
+if (config->framerate) xc->damage.frameus=1000000/config->framerate;
+xc->jump.threshold=config->jumpscroll;
+xc->jump.frameus=(xc->damage.frameus)?xc->damage.frameus:JUMPFRAMEUS_XCLIENT;
+if (!(xc->damage.fenceatom=XInternAtom(x->display,"_XAPTERM_FENCE",False))) GOTOERROR;
 
 xc->baggage.x=x;
 xc->baggage.xftchar=xftchar;
 xc->baggage.charcache=charcache;
+xc->baggage.maskcache=maskcache;
+xc->baggage.shmdraw=shmdraw;
 xc->baggage.texttap=texttap;
 xc->baggage.pty=pty;
 xc->baggage.events=events;
@@ -833,6 +851,11 @@ blankval=32|vte->curbgcolor->bgvaluemask|vte->curfgcolor->fgvaluemask;
 (void)init_hooks(xc);
 
 if (init_surface_xclient(&xc->surface,rows,columns,blankval,xc->config.scrollbackcount)) GOTOERROR;
+if (init_search(&xc->search,config->issearchindex)) GOTOERROR;
+if (config->spilldir[0]) {
+	if (spill_history(&xc->surface.scrollback,config->spilldir))
+		fprintf(stderr,"Unable to spill scrollback into %s, keeping %u lines\n",config->spilldir,xc->config.scrollbackcount);
+}
 
 if (setxcolors(xc,vte)) GOTOERROR;
 return 0;
@@ -842,6 +865,7 @@ error:
 
 void deinit_xclient(struct xclient *xc) {
 deinit_surface_xclient(&xc->surface);
+deinit_search(&xc->search);
 // iffree(xc->tofree.pastebuffer);
 if (xc->baggage.x) {
 	struct x11info *x=xc->baggage.x;
@@ -853,7 +877,7 @@ if (xc->baggage.x) {
 }
 }
 
-static void drawvalue(Pixmap dest, struct xftchar *xftchar, struct vte *vte, unsigned int value) {
+static void drawvalue(Pixmap dest, int x, int y, struct xftchar *xftchar, struct vte *vte, unsigned int value) {
 // unsigned char utf8[4];
 // unsigned int utf8len;
 unsigned int fgindex,bgindex,ucs4;
@@ -862,53 +886,177 @@ unsigned int fgindex,bgindex,ucs4;
 fgindex=(value>>25)&0xf;
 bgindex=(value>>21)&0xf;
 ucs4=value&UCS4_MASK_VALUE;
-(void)drawchar2_xftchar(dest,xftchar,ucs4,bgindex,fgindex,(value&UNDERLINEBIT_VALUE));
+(void)drawchar2_xftchar(dest,x,y,xftchar,ucs4,bgindex,fgindex,(value&UNDERLINEBIT_VALUE));
 }
 
-static inline void paintpixmap(struct xclient *xc, uint32_t *backing, unsigned int yoff, unsigned int col,
-		unsigned int value, Pixmap pixmap) {
-struct x11info *x=xc->baggage.x;
-unsigned int cellw,cellh;
-if (backing[col]==value) return;
-cellw=xc->config.cellw;
-cellh=xc->config.cellh;
-backing[col]=value;
-if (!xc->isnodraw)
-	XCopyArea(x->display,pixmap,x->window,x->context,0,0,cellw,cellh,xc->config.xoff+col*cellw,xc->config.yoff+yoff);
+static inline void damagecells(struct xclient *xc, struct line_xclient *line, unsigned int first, unsigned int last) {
+if (xc->isnodraw) return; // drawon_ will redraw everything
+if (!line->damage.isdirty) {
+	line->damage.isdirty=1;
+	line->damage.first=first;
+	line->damage.last=last;
+} else {
+	if (first<line->damage.first) line->damage.first=first;
+	if (last>line->damage.last) line->damage.last=last;
+}
+xc->damage.ispending=1;
+}
+
+static inline void paintcell(struct xclient *xc, struct line_xclient *line, unsigned int col, unsigned int value) {
+if (line->backing[col]==value) return;
+line->backing[col]=value;
+(void)damagecells(xc,line,col,col);
 }
 
-static Pixmap getpixmap(struct xclient *xc, unsigned int value) {
+static struct one_charcache *getmask(struct xclient *xc, unsigned int value) {
+// masks are shared by every color combination
+struct charcache *maskcache=xc->baggage.maskcache;
+struct one_charcache *occ;
+
+value&=UCS4_MASK_VALUE|UNDERLINEBIT_VALUE;
+occ=find_charcache(maskcache,value);
+if (!occ) {
+	occ=add_charcache(maskcache,value);
+	if (!occ) GOTOERROR;
+	if (drawmask_xftchar(maskcache->atlas,occ->x,occ->y,xc->baggage.xftchar,value&UCS4_MASK_VALUE,(value&UNDERLINEBIT_VALUE)))
+		GOTOERROR;
+	if (xc->baggage.shmdraw) (void)forgetmask_shmdraw(xc->baggage.shmdraw,occ-maskcache->list);
+}
+return occ;
+error:
+	return NULL;
+}
+
+static struct one_charcache *getglyph(struct xclient *xc, unsigned int value) {
 struct xftchar *xftchar=xc->baggage.xftchar;
 struct charcache *charcache=xc->baggage.charcache;
 struct vte *vte=xc->baggage.vte;
-Pixmap pixmap;
+struct one_charcache *occ;
 
-pixmap=find_charcache(charcache,value);
-if (!pixmap) {
-	struct one_charcache *occ;
+occ=find_charcache(charcache,value);
+if (!occ) {
 	occ=add_charcache(charcache,value);
 	if (!occ) GOTOERROR;
-	pixmap=occ->pixmap;
-	(void)drawvalue(occ->pixmap, xftchar,vte,value);
+	if (xc->baggage.maskcache) {
+		struct one_charcache *mask;
+		if (!(mask=getmask(xc,value))) GOTOERROR;
+		if (composite_xftchar(charcache->picture,occ->x,occ->y,xftchar,xc->baggage.maskcache->picture,mask->x,mask->y,
+				(value>>21)&0xf,(value>>25)&0xf)) GOTOERROR;
+	} else {
+		(void)drawvalue(charcache->atlas,occ->x,occ->y,xftchar,vte,value);
+	}
 }
-return pixmap;
+return occ;
 error:
-	return 0;
+	return NULL;
 }
 
-static int paintvalue(struct xclient *xc, unsigned int row, unsigned int col, unsigned int value) {
-uint32_t *backing;
-Pixmap pixmap;
+static inline void copyglyph(struct xclient *xc, struct one_charcache *occ, unsigned int x, unsigned int y) {
+struct x11info *xi=xc->baggage.x;
+XCopyArea(xi->display,xc->baggage.charcache->atlas,xi->window,xi->context,occ->x,occ->y,xc->config.cellw,xc->config.cellh,x,y);
+}
 
-backing=xc->surface.lines[row].backing;
-if (!(pixmap=getpixmap(xc,value))) GOTOERROR;
-(void)paintpixmap(xc,backing,row*xc->config.cellh,col,value,pixmap);
-// fprintf(stderr,"%s:%d painted value %u (%u) to %u[%u]\n",__FILE__,__LINE__,value,value&0xff,row,col);
+#define isblank_value(a) (((a)&(UCS4_MASK_VALUE|UNDERLINEBIT_VALUE))==32)
+static int paintrun(struct xclient *xc, uint32_t *backing, unsigned int row, unsigned int col, unsigned int last) {
+// draws backing[col..last], runs of identical blanks are a single fill
+struct x11info *x=xc->baggage.x;
+struct one_charcache *occ=NULL;
+unsigned int xo,yo,cellw,cellh;
+uint32_t lastvalue=0;
+
+cellw=xc->config.cellw;
+cellh=xc->config.cellh;
+xo=xc->config.xoff+col*cellw;
+yo=xc->config.yoff+row*cellh;
+while (1) {
+	uint32_t value;
+	value=backing[col];
+	if (isblank_value(value) && (col!=last) && (backing[col+1]==value)) {
+		unsigned int first=col;
+		while ((col!=last) && (backing[col+1]==value)) col++;
+		if (!XSetForeground(x->display,x->context,xc->xcolors[(value>>21)&0xf].pixel)) GOTOERROR;
+		if (!XFillRectangle(x->display,x->window,x->context,xo,yo,(col-first+1)*cellw,cellh)) GOTOERROR;
+		xo+=(col-first)*cellw;
+	} else {
+		if ((!occ)||(value!=lastvalue)) {
+			lastvalue=value;
+			if (!(occ=getglyph(xc,value))) GOTOERROR;
+		}
+		(void)copyglyph(xc,occ,xo,yo);
+	}
+	if (col==last) break;
+	col++;
+	xo+=cellw;
+}
+return 0;
+error:
+	return -1;
+}
+
+static int shmrun(struct xclient *xc, uint32_t *backing, unsigned int row, unsigned int col, unsigned int last) {
+// paintrun for shmdraw, draws into the frame and the caller sends it
+struct shmdraw *sd=xc->baggage.shmdraw;
+struct charcache *maskcache=xc->baggage.maskcache;
+
+while (1) {
+	uint32_t value,bg;
+	value=backing[col];
+	bg=xc->xcolors[(value>>21)&0xf].pixel;
+	if (isblank_value(value)) {
+		unsigned int first=col;
+		while ((col!=last) && (backing[col+1]==value)) col++;
+		(void)fill_shmdraw(sd,row,first,col-first+1,bg);
+	} else {
+		struct one_charcache *occ;
+		unsigned char *mask;
+		if (!(occ=getmask(xc,value))) GOTOERROR;
+		if (!(mask=getmask_shmdraw(sd,occ-maskcache->list,maskcache->atlas,occ->x,occ->y))) GOTOERROR;
+		(void)blend_shmdraw(sd,row,col,mask,xc->xcolors[(value>>25)&0xf].pixel,bg);
+	}
+	if (col==last) break;
+	col++;
+}
+return 0;
+error:
+	return -1;
+}
+
+static int shmflush(struct xclient *xc) {
+// adjacent dirty rows are drawn over their combined span and sent with one put
+struct shmdraw *sd=xc->baggage.shmdraw;
+struct line_xclient *lines=xc->surface.lines;
+unsigned int row,rows;
+
+rows=xc->config.rows;
+(void)sync_shmdraw(sd);
+row=0;
+while (row<rows) {
+	unsigned int first,last,end,r;
+	if (!lines[row].damage.isdirty) { row++; continue; }
+	first=lines[row].damage.first;
+	last=lines[row].damage.last;
+	for (end=row+1;(end<rows)&&lines[end].damage.isdirty;end++) {
+		if (lines[end].damage.first<first) first=lines[end].damage.first;
+		if (lines[end].damage.last>last) last=lines[end].damage.last;
+	}
+	for (r=row;r<end;r++) {
+		lines[r].damage.isdirty=0;
+		if (shmrun(xc,lines[r].backing,r,first,last)) GOTOERROR;
+	}
+	if (put_shmdraw(sd,row,first,end-row,last-first+1,xc->config.xoff,xc->config.yoff)) GOTOERROR;
+	row=end;
+}
 return 0;
 error:
 	return -1;
 }
 
+static int paintvalue(struct xclient *xc, unsigned int row, unsigned int col, unsigned int value) {
+(void)paintcell(xc,xc->surface.lines+row,col,value);
+// fprintf(stderr,"%s:%d painted value %u (%u) to %u[%u]\n",__FILE__,__LINE__,value,value&0xff,row,col);
+return 0;
+}
+
 static int addchar_draw(struct xclient *xc, struct one_event *e) {
 xc->status.lastaddchar.row=e->addchar.row;
 xc->status.lastaddchar.col=e->addchar.col;
@@ -917,6 +1065,32 @@ if (!e->addchar.col) fprintf(stderr,"%s:%d addchar(%u,%u)\n",__FILE__,__LINE__,e
 #endif
 return paintvalue(xc,e->addchar.row,e->addchar.col,e->addchar.value);
 }
+static int addstring_draw(struct xclient *xc, struct one_event *e) {
+struct line_xclient *line;
+uint32_t *backing,*cells;
+unsigned int col,count,first=0,last=0;
+int ischanged=0;
+
+line=xc->surface.lines+e->addstring.row;
+backing=line->backing;
+cells=e->addstring.cells;
+col=e->addstring.col;
+count=e->addstring.count;
+xc->status.lastaddchar.row=e->addstring.row;
+xc->status.lastaddchar.col=col+count-1;
+while (count) {
+	if (backing[col]!=*cells) {
+		backing[col]=*cells;
+		if (!ischanged) { ischanged=1; first=col; }
+		last=col;
+	}
+	cells++;
+	col++;
+	count--;
+}
+if (ischanged) (void)damagecells(xc,line,first,last);
+return 0;
+}
 int addchar_xclient(struct xclient *xc, uint32_t value, unsigned int row, unsigned int col) {
 return paintvalue(xc,row,col,value);
 }
@@ -951,8 +1125,11 @@ if (!xc->isnodraw) {
 }
 
 while (1) {
-	backing=xc->surface.lines[row].backing;
+	struct line_xclient *line;
+	line=xc->surface.lines+row;
+	backing=line->backing;
 	memset4(backing+col,value,colcount);
+	if (line->damage.isdirty && (line->damage.first>=col) && (line->damage.last<col+colcount)) line->damage.isdirty=0;
 	rowcount--;
 	if (!rowcount) break;
 	row++;
@@ -963,12 +1140,12 @@ error:
 	return -1;
 }
 static int setcursor(struct xclient *xc, unsigned int row, unsigned int col) {
+struct one_charcache *occ;
 uint32_t value;
-Pixmap pixmap;
 
 value=xc->surface.lines[row].backing[col];
-if (!(pixmap=getpixmap(xc,value))) GOTOERROR;
-if (set_cursor(xc->baggage.cursor,value,pixmap,row,col)) GOTOERROR;
+if (!(occ=getglyph(xc,value))) GOTOERROR;
+if (set_cursor(xc->baggage.cursor,value,xc->baggage.charcache->atlas,occ->x,occ->y,row,col)) GOTOERROR;
 return 0;
 error:
 	return -1;
@@ -979,48 +1156,20 @@ if (xc->isnodraw) {
 	xc->baggage.cursor->row=e->setcursor.row;
 	return 0;
 }
-return setcursor(xc,e->setcursor.row,e->setcursor.col);
+// placed at the next flushdamage
+xc->damage.iscursor=1;
+xc->damage.row=e->setcursor.row;
+xc->damage.col=e->setcursor.col;
+xc->damage.ispending=1;
+return 0;
 }
-static void scrollbackline(struct xclient *xc, struct line_xclient *line) {
-// this assumes xc->config.scrollbackcount!=1
-struct sbline_xclient *sb,*node;
-unsigned int *backing;
-
-#if 0
-fprintf(stderr,"%s:%d %s\n",__FILE__,__LINE__,__FUNCTION__);
-#endif
-
-if ((sb=xc->surface.scrollback.firstfree)) {
-	xc->surface.scrollback.firstfree=sb->next;
-	if (!xc->surface.scrollback.first) {
-		xc->surface.scrollback.first=xc->surface.scrollback.last=sb;
-		sb->previous=sb->next=NULL;
-// fprintf(stderr,"%s:%d sb->backing:%p\n",__FILE__,__LINE__,sb->backing);
-// fprintf(stderr,"%s:%d line->backing:%p\n",__FILE__,__LINE__,line->backing);
-		backing=sb->backing;
-		sb->backing=line->backing;
-		line->backing=backing;
-		return;
-	}
-} else if ((sb=xc->surface.scrollback.last)) {
-	node=sb->previous;
-	node->next=NULL;
-	xc->surface.scrollback.last=node;
-} else return; // no scrollback
-
-node=xc->surface.scrollback.first;
-sb->next=node;
-sb->previous=NULL;
-node->previous=sb;
-xc->surface.scrollback.first=sb;
-
-// fprintf(stderr,"%s:%d sb->backing:%p\n",__FILE__,__LINE__,sb->backing);
-// fprintf(stderr,"%s:%d line->backing:%p\n",__FILE__,__LINE__,line->backing);
-backing=sb->backing;
-sb->backing=line->backing;
-line->backing=backing;
-
-// sb->len=xc->config.columns;
+static inline int scrollbackline(struct xclient *xc, struct line_xclient *line) {
+// the line keeps its backing, only the compressed copy goes to history
+if (add_history(&xc->surface.scrollback,line->backing,xc->config.columns)) GOTOERROR;
+if (addline_search(&xc->search,&xc->surface.scrollback,line->backing,xc->config.columns)) GOTOERROR;
+return 0;
+error:
+	return -1;
 }
 
 static inline int scroll1up(struct xclient *xc, unsigned int toprow, unsigned int bottomrow, uint32_t erasevalue) {
@@ -1045,7 +1194,9 @@ if (!xc->isnodraw)
 	XCopyArea(x->display,x->window,x->window,x->context,xoff,yoff2+cellh,rowwidth,yoff-yoff2,xoff,yoff2);
 
 line=xc->surface.lines[toprow];
-if (!toprow) (void)scrollbackline(xc,&line);
+if (!toprow) {
+	if (scrollbackline(xc,&line)) GOTOERROR;
+}
 memmove(xc->surface.lines+toprow,xc->surface.lines+toprow+1,numrows*sizeof(struct line_xclient));
 xc->surface.lines[bottomrow]=line;
 if (!xc->isnodraw) {
@@ -1053,6 +1204,7 @@ if (!xc->isnodraw) {
 	if (!XFillRectangle(x->display,x->window,x->context,xoff,yoff,rowwidth,cellh)) GOTOERROR;
 }
 memset4(line.backing,erasevalue,xc->surface.numinline);
+xc->surface.lines[bottomrow].damage.isdirty=0;
 
 #if 0
 if (redrawrect(xc,xc->config.xoff,xc->config.yoff,xc->config.rowwidth,xc->config.cellh*xc->config.rows)) GOTOERROR;
@@ -1089,7 +1241,9 @@ if (linestomove) {
 }
 
 ptopline=xc->surface.lines+toprow;
-if (!toprow) for (ui=0;ui<scrollcount;ui++) (void)scrollbackline(xc,&ptopline[ui]);
+if (!toprow) for (ui=0;ui<scrollcount;ui++) {
+	if (scrollbackline(xc,&ptopline[ui])) GOTOERROR;
+}
 memcpy(xc->surface.sparelines,ptopline,scrollcount*sizeof(*ptopline));
 memmove(ptopline,ptopline+scrollcount,linestomove*sizeof(*ptopline));
 memcpy(ptopline+linestomove,xc->surface.sparelines,scrollcount*sizeof(*ptopline));
@@ -1104,6 +1258,7 @@ if (!xc->isnodraw) {
 	for (ui=0;ui<scrollcount;ui++) {
 		backing=xc->surface.lines[firstblankrow+ui].backing;
 		memset4(backing,erasevalue,xc->surface.numinline);
+		xc->surface.lines[firstblankrow+ui].damage.isdirty=0;
 	}
 }
 
@@ -1151,6 +1306,7 @@ if (!xc->isnodraw) {
 	if (!XFillRectangle(x->display,x->window,x->context,xoff,topyoff,rowwidth,cellh)) GOTOERROR;
 }
 memset4(bottomline.backing,erasevalue,xc->surface.numinline);
+xc->surface.lines[toprow].damage.isdirty=0;
 
 #if 0
 if (redrawrect(xc,xc->config.xoff,xc->config.yoff,xc->config.rowwidth,xc->config.cellh*xc->config.rows)) GOTOERROR;
@@ -1199,6 +1355,7 @@ if (!xc->isnodraw) {
 	for (ui=0;ui<scrollcount;ui++) {
 		backing=xc->surface.lines[toprow+ui].backing;
 		memset4(backing,erasevalue,xc->surface.numinline);
+		xc->surface.lines[toprow+ui].damage.isdirty=0;
 	}
 }
 
@@ -1237,8 +1394,8 @@ return scrollup(xc,e->deleteline.row,xc->config.rowsm1,e->deleteline.erasevalue,
 static int dch_draw(struct xclient *xc, struct one_event *e) {
 struct x11info *x=xc->baggage.x;
 unsigned int row,col,value,count;
+struct line_xclient *line;
 uint32_t *backing;
-Pixmap pixmap;
 unsigned int yoff,xoff;
 unsigned int cellh,cellw,columns,shiftcells;
 
@@ -1250,7 +1407,8 @@ row=e->dch.row;
 col=e->dch.col;
 value=e->dch.erasevalue;
 count=e->dch.count;
-backing=xc->surface.lines[row].backing;
+line=xc->surface.lines+row;
+backing=line->backing;
 yoff=row*cellh+xc->config.yoff;
 xoff=xc->config.xoff;
 shiftcells=columns-col-count;
@@ -1259,26 +1417,24 @@ memmove(backing+col,backing+col+count,shiftcells*sizeof(*backing));
 if (!xc->isnodraw)
 	XCopyArea(x->display,x->window,x->window,x->context,xoff+(col+count)*cellw,yoff,shiftcells*cellw,cellh,
 			xoff+col*cellw,yoff);
+if (line->damage.isdirty) (void)damagecells(xc,line,col,columns-1); // undrawn cells were shifted
 
 col=columns-count;
 
-if (!(pixmap=getpixmap(xc,value))) GOTOERROR;
 while (1) {
-	(void)paintpixmap(xc,backing,yoff,col,value,pixmap);
+	(void)paintcell(xc,line,col,value);
 	col++;
 	if (col==columns) break;
 }
 
 // fprintf(stderr,"dch row: %u col: %u, count: %u, erasevalue: 0x%02x\n",row,col,count,value);
 return 0;
-error:
-	return -1;
 }
 static int ich_draw(struct xclient *xc, struct one_event *e) {
 struct x11info *x=xc->baggage.x;
 unsigned int row,col,value,count;
+struct line_xclient *line;
 uint32_t *backing;
-Pixmap pixmap;
 unsigned int yoff,xoff;
 unsigned int cellh,cellw,columns,lastcol,shiftcells;
 
@@ -1290,7 +1446,8 @@ row=e->ich.row;
 col=e->ich.col;
 value=e->ich.erasevalue;
 count=e->ich.count;
-backing=xc->surface.lines[row].backing;
+line=xc->surface.lines+row;
+backing=line->backing;
 yoff=row*cellh+xc->config.yoff;
 xoff=xc->config.xoff;
 shiftcells=columns-col-count;
@@ -1300,18 +1457,16 @@ memmove(backing+col+count,backing+col,shiftcells*sizeof(*backing));
 if (!xc->isnodraw)
 	XCopyArea(x->display,x->window,x->window,x->context,xoff+col*cellw,yoff,shiftcells*cellw,cellh,
 			xoff+(col+count)*cellw,yoff);
+if (line->damage.isdirty) (void)damagecells(xc,line,col,columns-1); // undrawn cells were shifted
 
-if (!(pixmap=getpixmap(xc,value))) GOTOERROR;
 while (1) {
-	(void)paintpixmap(xc,backing,yoff,col,value,pixmap);
+	(void)paintcell(xc,line,col,value);
 	col++;
 	if (col==lastcol) break;
 }
 
 // fprintf(stderr,"ich row: %u col: %u, count: %u, erasevalue: 0x%02x\n",row,col,count,value);
 return 0;
-error:
-	return -1;
 }
 
 static int title_draw(struct xclient *xc, struct one_event *e) {
@@ -1424,6 +1579,14 @@ error:
 	return -1;
 }
 
+static int taprun_draw(struct xclient *xc, struct one_event *e) {
+unsigned int count;
+if (fulltap_texttap(&count,xc->baggage.texttap,e->taprun.values,e->taprun.count)) GOTOERROR;
+return 0;
+error:
+	return -1;
+}
+
 static int reverse_draw(struct xclient *xc, struct one_event *e) {
 unsigned int count;
 uint32_t *backing;
@@ -1465,6 +1628,83 @@ error:
 	return -1;
 }
 
+#define BACKLOGUS_DAMAGE	50000
+static uint64_t getmicroseconds(void) {
+struct timespec ts;
+(ignore)clock_gettime(CLOCK_MONOTONIC,&ts);
+return (uint64_t)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+static void sendfence(struct xclient *xc) {
+// an empty append still sends PropertyNotify, its arrival means X has done everything before it
+struct x11info *x=xc->baggage.x;
+(ignore)XChangeProperty(x->display,x->window,xc->damage.fenceatom,XA_CARDINAL,32,PropModeAppend,NULL,0);
+xc->damage.fences[xc->damage.fenceindex]=NextRequest(x->display)-1;
+xc->damage.fenceindex=(xc->damage.fenceindex+1)%INFLIGHT_DAMAGE_XCLIENT;
+}
+
+static int isbacklogged(struct xclient *xc) {
+// true if X hasn't caught up with the last INFLIGHT_DAMAGE_XCLIENT flushes
+// this doesn't need a round trip, any event or reply updates LastKnownRequestProcessed
+struct x11info *x=xc->baggage.x;
+unsigned long oldest;
+oldest=xc->damage.fences[xc->damage.fenceindex];
+if (!oldest) return 0;
+if ((long)(oldest-LastKnownRequestProcessed(x->display))<=0) return 0;
+return 1;
+}
+
+static int flushdamage(struct xclient *xc) {
+// send dirty cells to X, at most once per frame
+struct x11info *x=xc->baggage.x;
+struct cursor *cursor=xc->baggage.cursor;
+struct line_xclient *line;
+unsigned int row,rows;
+int iscurset=0;
+
+if (!xc->damage.ispending) return 0;
+xc->damage.ispending=0;
+xc->damage.lastflush=getmicroseconds();
+rows=xc->config.rows;
+if (xc->isnodraw) {
+	for (row=0;row<rows;row++) xc->surface.lines[row].damage.isdirty=0;
+	xc->damage.iscursor=0;
+	return 0;
+}
+if (cursor->isplaced) {
+	iscurset=1;
+	if (unset_cursor(cursor)) GOTOERROR;
+}
+if (xc->baggage.shmdraw) {
+	if (shmflush(xc)) GOTOERROR;
+} else {
+	line=xc->surface.lines;
+	for (row=0;row<rows;row++,line++) {
+		if (!line->damage.isdirty) continue;
+		line->damage.isdirty=0;
+		if (paintrun(xc,line->backing,row,line->damage.first,line->damage.last)) GOTOERROR;
+	}
+}
+if (xc->damage.iscursor) {
+	xc->damage.iscursor=0;
+	if (setcursor(xc,xc->damage.row,xc->damage.col)) GOTOERROR;
+} else if (iscurset) {
+	if (setcursor(xc,cursor->row,cursor->col)) GOTOERROR;
+}
+(void)sendfence(xc);
+XFlush(x->display);
+return 0;
+error:
+	return -1;
+}
+
+static inline int isdamagedue(struct xclient *xc) {
+if (!xc->damage.ispending) return 0;
+if (getmicroseconds()-xc->damage.lastflush < xc->damage.frameus) return 0;
+if (isbacklogged(xc)) return 0;
+return 1;
+}
+
 static int drawvteevent(struct xclient *xc, struct one_event *e) {
 // fprintf(stderr,"%s:%d drawing event %u\n",__FILE__,__LINE__,e->type);
 switch (e->type) {
@@ -1491,6 +1731,8 @@ switch (e->type) {
 	case APPCURSOR_TYPE_EVENT: return appcursor_draw(xc,e);
 	case AUTOREPEAT_TYPE_EVENT: return autorepeat_draw(xc,e);
 	case RESET_TYPE_EVENT: return reset_draw(xc,e);
+	case ADDSTRING_TYPE_EVENT: return addstring_draw(xc,e);
+	case TAPRUN_TYPE_EVENT: return taprun_draw(xc,e);
 }
 return 0;
 }
@@ -1501,6 +1743,7 @@ struct all_event *events=xc->baggage.events;
 struct one_event *e;
 
 if (unset_cursor(xc->baggage.cursor)) GOTOERROR;
+(void)peephole_event(events);
 e=events->first;
 while (e) {
 	struct one_event *next;
@@ -1510,52 +1753,66 @@ while (e) {
 	(void)recycle_event(events,e);
 	e=next;
 }
-// XFlush(xc->baggage.x->display);
-XSync(xc->baggage.x->display,False); // without this, draws can queue up fast and delay user input
+if (!xc->damage.frameus && !isbacklogged(xc)) return flushdamage(xc);
 return 0;
 error:
 	return -1;
 }
 
-static int redrawrect(struct xclient *xc, unsigned int ex, unsigned int ey, unsigned int ew, unsigned int eh) {
-// this is a primitive redraw, TODO draw just the rectangle
-struct x11info *x=xc->baggage.x;
-Display *display;
-Window window;
-GC context;
-unsigned int rownum,rows,firstx,firsty;
-unsigned int cellh,cellw,columnsm1;
-
-display=x->display;
-window=x->window;
-context=x->context;
-rows=xc->config.rows;
-columnsm1=xc->config.columnsm1;
-firstx=xc->config.xoff;
-firsty=xc->config.yoff;
-cellw=xc->config.cellw;
-cellh=xc->config.cellh;
+static int getcellrect(unsigned int *firstrow_out, unsigned int *lastrow_out, unsigned int *firstcol_out, unsigned int *lastcol_out,
+		int *ispadding_out, struct xclient *xc, unsigned int ex, unsigned int ey, unsigned int ew, unsigned int eh) {
+// finds cells touched by a window rectangle, returns 0 if there are none
+int x0,y0,x1,y1;
 
-{ XEvent ign; while (XCheckTypedEvent(display,Expose,&ign)); }
+x0=(int)ex-(int)xc->config.xoff;
+y0=(int)ey-(int)xc->config.yoff;
+x1=x0+(int)ew;
+y1=y0+(int)eh;
+*ispadding_out=((x0<0)||(y0<0)||(x1>(int)xc->config.rowwidth)||(y1>(int)xc->config.colheight));
+x0=_BADMAX(x0,0);
+y0=_BADMAX(y0,0);
+x1=_BADMIN(x1,(int)xc->config.rowwidth);
+y1=_BADMIN(y1,(int)xc->config.colheight);
+if ((x0>=x1)||(y0>=y1)) return 0;
+*firstcol_out=x0/xc->config.cellw;
+*lastcol_out=(x1-1)/xc->config.cellw;
+*firstrow_out=y0/xc->config.cellh;
+*lastrow_out=(y1-1)/xc->config.cellh;
+return 1;
+}
 
-if (fillpadding(xc,0)) GOTOERROR;
-for (rownum=0;rownum<rows;rownum++) {
-	unsigned int c,*backing;
-	unsigned int xo;
-	Pixmap pixmap;
+static int redrawrect(struct xclient *xc, unsigned int ex, unsigned int ey, unsigned int ew, unsigned int eh) {
+// repaints the cells and padding under a window rectangle
+unsigned int rownum,firstrow,lastrow,firstcol,lastcol;
+int ispadding;
 
-	backing=xc->surface.lines[rownum].backing;
-	c=0;
-	xo=firstx;
-	while (1) {
-		if (!(pixmap=getpixmap(xc,*backing))) GOTOERROR;
-		XCopyArea(display,pixmap,window,context,0,0,cellw,cellh,xo,firsty);
-		if (c==columnsm1) break;
-		c+=1;
-		xo+=cellw;
-		backing+=1;
+if (!getcellrect(&firstrow,&lastrow,&firstcol,&lastcol,&ispadding,xc,ex,ey,ew,eh)) {
+	if (ispadding) return fillpadding(xc,0);
+	return 0;
+}
+if (ispadding) {
+	if (fillpadding(xc,0)) GOTOERROR;
+}
+if (xc->isnodraw) return 0;
+if (xc->baggage.shmdraw) {
+	for (rownum=firstrow;rownum<=lastrow;rownum++) {
+		struct line_xclient *line=xc->surface.lines+rownum;
+		if (!line->damage.isdirty) {
+			line->damage.isdirty=1;
+			line->damage.first=firstcol;
+			line->damage.last=lastcol;
+		} else {
+			if (firstcol<line->damage.first) line->damage.first=firstcol;
+			if (lastcol>line->damage.last) line->damage.last=lastcol;
+		}
+	}
+	if (shmflush(xc)) GOTOERROR;
+} else {
+	for (rownum=firstrow;rownum<=lastrow;rownum++) {
+		struct line_xclient *line=xc->surface.lines+rownum;
+		if (line->damage.isdirty && (firstcol<=line->damage.first) && (lastcol>=line->damage.last)) line->damage.isdirty=0;
+		if (paintrun(xc,line->backing,rownum,firstcol,lastcol)) GOTOERROR;
 	}
-	firsty+=cellh;
 }
 
 return 0;
@@ -1563,80 +1820,26 @@ error:
 	return -1;
 }
 
-#if 0
-// this should be redone, with mismatched sizes in mind (entire area could be outside lines)
-static int redrawrect(struct xclient *xc, unsigned int ex, unsigned int ey, unsigned int ew, unsigned int eh) {
-struct x11info *x=xc->baggage.x;
-unsigned int firstrow,lastrowp1;
-unsigned int firstcol,lastcol;
-unsigned int rownum,firsty,firstx;
-Display *display;
-Window window;
-GC context;
-unsigned int cellh,cellw;
-int isoverflow=0;
-
-cellh=xc->config.cellh;
-cellw=xc->config.cellw;
+static void exposerect(struct xclient *xc, unsigned int ex, unsigned int ey, unsigned int ew, unsigned int eh) {
+// adds a rectangle to the damage, it's painted when the series of exposes ends
+unsigned int rownum,firstrow,lastrow,firstcol,lastcol;
+int ispadding;
 
-// fprintf(stderr,"%s:%d Redraw rectangle %u %u %u %u\n",__FILE__,__LINE__,ex,ey,ew,eh);
-
-display=x->display;
-window=x->window;
-context=x->context;
-
-firstrow=(ey+cellh-1-xc->config.yoff)/cellh;
-lastrowp1=(ey+eh+cellh-1-xc->config.yoff)/cellh;
-firstcol=(ex+cellw-1-xc->config.xoff)/cellw;
-firsty=firstrow*cellh+xc->config.yoff;
-firstx=firstcol*cellw+xc->config.xoff;
-lastcol=(ex+ew-1-xc->config.xoff)/cellw;
-if (lastcol>xc->config.columnsm1) {
-	isoverflow=1;
-	lastcol=xc->config.columnsm1;
-	if (firstcol>lastcol) return 0;
-}
-if (lastrowp1>xc->config.rows) {
-	isoverflow=1;
-	lastrowp1=xc->config.rows;
-}
-if (isoverflow) { // we could be a LOT more precise about this
-	unsigned long fillcolor;
-	fillcolor=xc->xcolors[0];
-	if (!XSetForeground(x->display,x->context,fillcolor)) GOTOERROR;
-	if (!XFillRectangle(x->display,x->window,x->context,ex,ey,ew,eh)) GOTOERROR;
+if (getcellrect(&firstrow,&lastrow,&firstcol,&lastcol,&ispadding,xc,ex,ey,ew,eh)) {
+	for (rownum=firstrow;rownum<=lastrow;rownum++) (void)damagecells(xc,xc->surface.lines+rownum,firstcol,lastcol);
 }
-
-for (rownum=firstrow;rownum<lastrowp1;rownum++) {
-	unsigned int c,*backing;
-	unsigned int x;
-	Pixmap pixmap;
-
-	backing=&xc->surface.lines[rownum].backing[firstcol];
-	c=firstcol;
-	x=firstx;
-	while (1) {
-		if (!(pixmap=getpixmap(xc,*backing))) GOTOERROR;
-		XCopyArea(display,pixmap,window,context,0,0,cellw,cellh,x,firsty);
-		if (c==lastcol) break;
-		c+=1;
-		x+=cellw;
-		backing+=1;
-	}
-	firsty+=cellh;
+if (ispadding) xc->damage.ispadding=1;
 }
 
-return 0;
-error:
-	return -1;
+static int handlexpose(struct xclient *xc, unsigned int ex, unsigned int ey, unsigned int ew, unsigned int eh, int count) {
+// count is the number of exposes still to come in this series
+(void)exposerect(xc,ex,ey,ew,eh);
+if (count) return 0;
+if (xc->damage.ispadding) {
+	xc->damage.ispadding=0;
+	if (fillpadding(xc,0)) GOTOERROR;
 }
-#endif
-
-static int handlexpose(struct xclient *xc, XEvent *e) {
-XExposeEvent *ee;
-
-ee=&e->xexpose;
-if (redrawrect(xc,ee->x,ee->y,ee->width,ee->height)) GOTOERROR;
+if (flushdamage(xc)) GOTOERROR;
 XFlush(xc->baggage.x->display);
 return 0;
 error:
@@ -1663,7 +1866,13 @@ XNextEvent(x->display,&e);
 switch (e.type) {
 	case FocusIn: x->isfocused=1; break;
 	case FocusOut: x->isfocused=0; break;
-	case Expose: if (handlexpose(xc,&e)) GOTOERROR; break;
+	case Expose:
+		if (handlexpose(xc,e.xexpose.x,e.xexpose.y,e.xexpose.width,e.xexpose.height,e.xexpose.count)) GOTOERROR;
+		break;
+	case GraphicsExpose:
+		if (handlexpose(xc,e.xgraphicsexpose.x,e.xgraphicsexpose.y,e.xgraphicsexpose.width,e.xgraphicsexpose.height,
+				e.xgraphicsexpose.count)) GOTOERROR;
+		break;
 	case KeyRelease: if (handlekeyrelease(xc,&e)) GOTOERROR; break;
 	case KeyPress:
 #if 0
@@ -1681,6 +1890,7 @@ switch (e.type) {
 			if (handlemotion(xc,&e.xmotion)) GOTOERROR;
 			break;
 	case ReparentNotify: break;
+	case PropertyNotify: break; // including fences from sendfence()
 	case ConfigureNotify: if (handleconfigure(xc,&e)) GOTOERROR; break;
 	case SelectionClear: (void)onselectionclear_xclipboard(xc->baggage.xclipboard); break;
 	case SelectionRequest:
@@ -1705,7 +1915,13 @@ XNextEvent(x->display,&e);
 switch (e.type) {
 	case FocusIn: x->isfocused=1; break;
 	case FocusOut: x->isfocused=0; break;
-	case Expose: if (handlexpose(xc,&e)) GOTOERROR; break;
+	case Expose:
+		if (handlexpose(xc,e.xexpose.x,e.xexpose.y,e.xexpose.width,e.xexpose.height,e.xexpose.count)) GOTOERROR;
+		break;
+	case GraphicsExpose:
+		if (handlexpose(xc,e.xgraphicsexpose.x,e.xgraphicsexpose.y,e.xgraphicsexpose.width,e.xgraphicsexpose.height,
+				e.xgraphicsexpose.count)) GOTOERROR;
+		break;
 	case KeyRelease: if (handlekeyrelease(xc,&e)) GOTOERROR; break;
 	case KeyPress: 
 #if 0
@@ -1723,6 +1939,7 @@ switch (e.type) {
 			if (handlemotion(xc,&e.xmotion)) GOTOERROR;
 			break;
 	case ReparentNotify: break;
+	case PropertyNotify: break; // including fences from sendfence()
 	case ConfigureNotify: if (handleconfigure(xc,&e)) GOTOERROR; break;
 	case SelectionClear: (void)onselectionclear_xclipboard(xc->baggage.xclipboard); break;
 	case SelectionRequest:
@@ -1747,19 +1964,15 @@ char *msg;
 #if 0
 if (!xc->nextalarm) fprintf(stderr,"%s:%d no nextalarm\n",__FILE__,__LINE__);
 #endif
-if (xc->nextalarm) {
-	uint64_t t;
-	t=time(NULL);
-	if (t>=xc->nextalarm) {
-		unsigned int t32;
-		t32=(unsigned int)t;
-		xc->nextalarm=0;
-		xc->hooks.alarmcall(xc->baggage.script,(int)t32); // it's received as uint32_t; we're good until 2106
-	}
+if (xc->nextalarm && (getmicroseconds()>=xc->nextalarm)) {
+	unsigned int t32;
+	t32=(unsigned int)time(NULL);
+	xc->nextalarm=0;
+	xc->hooks.alarmcall(xc->baggage.script,(int)t32); // it's received as uint32_t; we're good until 2106
 }
 
 if (!xc->hooks.checkinsertion(xc->baggage.script)) return 0;
-if ((vte->input.mode) || (vte->readqueue.max_buffer - vte->readqueue.qlen < BUFFSIZE_INSERTION_XCLIENT)) {
+if ((vte->input.mode) || (vte->readqueue.isring) || (vte->readqueue.max_buffer - vte->readqueue.qlen < BUFFSIZE_INSERTION_XCLIENT)) {
 	xc->ispaused=0;
 	return 0;
 }
@@ -1772,14 +1985,178 @@ error:
 	return -1;
 }
 
-static int pauseloop_xclient(struct xclient *xc) {
+static int addslot(struct xclient *xc, unsigned int slot, int fd, uint32_t events) {
+struct epoll_event ev;
+xc->loop.slots[slot].fd=fd;
+if (fd<0) return 0;
+ev.events=events;
+ev.data.u32=slot;
+if (epoll_ctl(xc->loop.epfd,EPOLL_CTL_ADD,fd,&ev)) GOTOERROR;
+xc->loop.slots[slot].events=events;
+return 0;
+error:
+	return -1;
+}
+
+static int watchslot(struct xclient *xc, unsigned int slot, uint32_t events) {
+// changes what wakes us for a slot, skips the syscall if nothing changed
+struct epoll_event ev;
+if (xc->loop.slots[slot].fd<0) return 0;
+ev.events=events;
+ev.data.u32=slot;
+if (xc->loop.slots[slot].isdropped) {
+	if (epoll_ctl(xc->loop.epfd,EPOLL_CTL_ADD,xc->loop.slots[slot].fd,&ev)) GOTOERROR;
+	xc->loop.slots[slot].isdropped=0;
+} else {
+	if (xc->loop.slots[slot].events==events) return 0;
+	if (epoll_ctl(xc->loop.epfd,EPOLL_CTL_MOD,xc->loop.slots[slot].fd,&ev)) GOTOERROR;
+}
+xc->loop.slots[slot].events=events;
+return 0;
+error:
+	return -1;
+}
+
+static int dropslot(struct xclient *xc, unsigned int slot) {
+// epoll reports EPOLLHUP even with no events, so an fd we're ignoring has to leave the set
+if (xc->loop.slots[slot].fd<0) return 0;
+if (xc->loop.slots[slot].isdropped) return 0;
+if (epoll_ctl(xc->loop.epfd,EPOLL_CTL_DEL,xc->loop.slots[slot].fd,NULL)) GOTOERROR;
+xc->loop.slots[slot].isdropped=1;
+return 0;
+error:
+	return -1;
+}
+
+static int startloop(struct xclient *xc) {
+struct x11info *x=xc->baggage.x;
+unsigned int ui;
+for (ui=0;ui<COUNT_SLOT_XCLIENT;ui++) { xc->loop.slots[ui].fd=-1; xc->loop.slots[ui].isdropped=0; }
+xc->loop.timerfd=-1;
+if (0>(xc->loop.epfd=epoll_create1(EPOLL_CLOEXEC))) GOTOERROR;
+if (0>(xc->loop.timerfd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC))) GOTOERROR;
+if (addslot(xc,X_SLOT_XCLIENT,ConnectionNumber(x->display),EPOLLIN)) GOTOERROR;
+if (addslot(xc,DATA_SLOT_XCLIENT,xc->baggage.pty->ring.datafd,0)) GOTOERROR;
+if (addslot(xc,PTY_SLOT_XCLIENT,xc->baggage.vte->writequeue.fd,0)) GOTOERROR;
+if (addslot(xc,INSERTION_SLOT_XCLIENT,xc->hooks.insertionfd(xc->baggage.script),0)) GOTOERROR;
+if (addslot(xc,TIMER_SLOT_XCLIENT,xc->loop.timerfd,EPOLLIN)) GOTOERROR;
+xc->loop.armed=0;
+xc->loop.blink=0;
+xc->loop.lastactive=getmicroseconds();
+return 0;
+error:
+	return -1;
+}
+
+static void stoploop(struct xclient *xc) {
+ifclose(xc->loop.timerfd);
+ifclose(xc->loop.epfd);
+}
+
+static inline uint64_t earliest(uint64_t a, uint64_t b) {
+// 0 => none
+if (!a) return b;
+if (!b) return a;
+return _BADMIN(a,b);
+}
+
+static inline int isidleduty(struct xclient *xc) {
+// things the old once-a-second select timeout used to clean up
+return xc->isnodraw || xc->status.ismarked;
+}
+
+static inline uint64_t idleus(struct xclient *xc) {
+return (uint64_t)(60-59*xc->baggage.x->isfocused)*1000000;
+}
+
+static int armtimer(struct xclient *xc, uint64_t frame, int isidle) {
+// sets timerfd to the first deadline, frame is mainloop's damage or jump deadline, 0 => none
 struct x11info *x=xc->baggage.x;
 struct cursor *cursor=xc->baggage.cursor;
-int xfd;
-xfd=ConnectionNumber(x->display);
+struct itimerspec its;
+uint64_t deadline;
+
+if (x->isfocused && cursor->config.isblink && cursor->isplaced) {
+	if (!xc->loop.blink) xc->loop.blink=getmicroseconds()+BLINKUS_XCLIENT;
+} else xc->loop.blink=0;
+deadline=earliest(frame,xc->loop.blink);
+deadline=earliest(deadline,xc->nextalarm);
+if (isidle && isidleduty(xc)) deadline=earliest(deadline,xc->loop.lastactive+idleus(xc));
+if (deadline==xc->loop.armed) return 0;
+memset(&its,0,sizeof(its));
+its.it_value.tv_sec=deadline/1000000;
+its.it_value.tv_nsec=(deadline%1000000)*1000;
+if (timerfd_settime(xc->loop.timerfd,TFD_TIMER_ABSTIME,&its,NULL)) GOTOERROR;
+xc->loop.armed=deadline;
+return 0;
+error:
+	return -1;
+}
+
+static int waitloop(unsigned int *fired_out, struct xclient *xc, uint64_t frame, int isidle) {
+// sleeps until a watched slot is ready or the timer fires, fired_out has a bit per slot
+struct epoll_event events[COUNT_SLOT_XCLIENT];
+unsigned int fired=0;
+int i,n;
+if (armtimer(xc,frame,isidle)) GOTOERROR;
+n=epoll_wait(xc->loop.epfd,events,COUNT_SLOT_XCLIENT,-1);
+if (n<0) {
+	if (errno!=EINTR) GOTOERROR;
+	n=0;
+}
+for (i=0;i<n;i++) fired|=1<<events[i].data.u32;
+if (fired&(1<<TIMER_SLOT_XCLIENT)) {
+	uint64_t u;
+	(ignore)read(xc->loop.timerfd,&u,sizeof(u));
+	xc->loop.armed=0;
+}
+if (fired&~(1<<TIMER_SLOT_XCLIENT)) xc->loop.lastactive=getmicroseconds();
+*fired_out=fired;
+return 0;
+error:
+	return -1;
+}
+
+static int runtimers(struct xclient *xc, uint64_t now) {
+// cursor pulses and alarms, these run paused or not
+if (xc->loop.blink && (now>=xc->loop.blink)) {
+	xc->loop.blink=0; // armtimer sets the next one
+	if (pulse_cursor(xc->baggage.cursor)) GOTOERROR;
+}
+if (xc->nextalarm && (now>=xc->nextalarm)) {
+	if (checkforscript(xc)) GOTOERROR;
+}
+return 0;
+error:
+	return -1;
+}
+
+static int idleduties(struct xclient *xc) {
+if (xc->isnodraw && drawon_xclient(xc)) GOTOERROR;
+if (checkforscript(xc)) GOTOERROR;
+if (unmark_xclient(xc)) GOTOERROR;
+xc->loop.lastactive=getmicroseconds();
+return 0;
+error:
+	return -1;
+}
+
+static inline int isinsertable(struct xclient *xc) {
+// checkforscript would take script output now
+struct vte *vte=xc->baggage.vte;
+if (vte->input.mode || vte->readqueue.isring) return 0;
+return (vte->readqueue.max_buffer - vte->readqueue.qlen >= BUFFSIZE_INSERTION_XCLIENT);
+}
+
+static int pauseloop_xclient(struct xclient *xc) {
+struct x11info *x=xc->baggage.x;
+if (flushdamage(xc)) GOTOERROR;
+// nothing is read or written while paused, a full ring stops the child
+if (watchslot(xc,DATA_SLOT_XCLIENT,0)) GOTOERROR;
+if (dropslot(xc,PTY_SLOT_XCLIENT)) GOTOERROR; // a hung up child would wake us on every pass, mainloop adds it back
+if (watchslot(xc,INSERTION_SLOT_XCLIENT,EPOLLIN)) GOTOERROR; // an insertion unpauses
 while (1) {
-	fd_set rset;
-	struct timeval tv;
+	unsigned int fired;
 
 	if (!xc->ispaused) break;
 
@@ -1789,17 +2166,14 @@ while (1) {
 		if (pause_handlexevent_xclient(xc)) GOTOERROR;
 		continue;
 	}
-	tv.tv_sec=60-59*x->isfocused;
-	tv.tv_usec=0;
-	FD_ZERO(&rset);
-	FD_SET(xfd,&rset);
-	switch (select(xfd+1,&rset,NULL,NULL,&tv)) {
-		case 0:
-			if (x->isfocused && pulse_cursor(cursor)) GOTOERROR;
-			continue;
-		case -1: GOTOERROR;
+	if (xc->damage.ispending) { // scripts can draw while paused
+		if (flushdamage(xc)) GOTOERROR;
+	}
+	if (waitloop(&fired,xc,0,0)) GOTOERROR;
+	if (fired&(1<<TIMER_SLOT_XCLIENT)) {
+		if (runtimers(xc,getmicroseconds())) GOTOERROR;
 	}
-	if (FD_ISSET(xfd,&rset)) {
+	if (fired&(1<<X_SLOT_XCLIENT)) {
 		XEventsQueued(x->display,QueuedAfterReading);
 	}
 }
@@ -1808,24 +2182,88 @@ error:
 	return -1;
 }
 
+static int checkjump(struct xclient *xc) {
+// once per frame: start or stop jump scrolling by the input rate, paint the screen while jumping
+struct x11info *x=xc->baggage.x;
+uint64_t now;
+int isflood;
+
+if (!xc->jump.threshold) return 0;
+now=getmicroseconds();
+if (now-xc->jump.framestart<xc->jump.frameus) return 0;
+if (xc->jump.isactive && isbacklogged(xc)) return 0; // let X catch up first
+isflood=(xc->jump.bytes>xc->jump.threshold);
+xc->jump.bytes=0;
+xc->jump.framestart=now;
+if (xc->jump.isactive) {
+	if (!isflood) return drawon_xclient(xc); // clears .isactive
+	xc->isnodraw=0;
+	if (redrawrect(xc,xc->config.xoff,xc->config.yoff,xc->config.rowwidth,xc->config.colheight)) GOTOERROR;
+	xc->isnodraw=1;
+	(void)sendfence(xc);
+	XFlush(x->display);
+} else if (isflood && !xc->isnodraw) {
+	if (flushdamage(xc)) GOTOERROR;
+	if (drawoff_xclient(xc)) GOTOERROR;
+	xc->jump.isactive=1;
+}
+return 0;
+error:
+	return -1;
+}
+
+static int parseslice(struct xclient *xc) {
+struct vte *vte=xc->baggage.vte;
+unsigned int qlen;
+qlen=vte->readqueue.qlen;
+if (processreadqueue_vte(vte)) GOTOERROR;
+if (qlen>vte->readqueue.qlen) xc->jump.bytes+=qlen-vte->readqueue.qlen;
+return 0;
+error:
+	return -1;
+}
+
+static int startahead(struct xclient *xc) {
+// with a parser thread, starts on the next slice while this one is drawn, returns 1 if it did
+struct vte *vte=xc->baggage.vte;
+if (!vte->parser.isthread) return 0;
+if (xc->baggage.events->ishooked) return 0; // hooks can pause, resize or read the vte
+if (!vte->readqueue.qlen) {
+	if (fillreadqueue_vte(vte)) return 0; // mainloop will see it again
+	if (!vte->readqueue.qlen) return 0;
+}
+(void)beginparse_vte(vte);
+return 1;
+}
+
+static int finishahead(struct xclient *xc) {
+// after startahead, the new slice becomes the one to draw
+struct vte *vte=xc->baggage.vte;
+unsigned int bytes;
+if (endparse_vte(&bytes,vte)) GOTOERROR;
+xc->jump.bytes+=bytes;
+xc->baggage.events=vte->baggage.events;
+return 0;
+error:
+	return -1;
+}
+
 int mainloop_xclient(struct xclient *xc) {
 struct x11info *x=xc->baggage.x;
 struct vte *vte=xc->baggage.vte;
-struct cursor *cursor=xc->baggage.cursor;
-int xfd,maxfd,ptyfd;
+struct pty *pty=xc->baggage.pty;
 
-maxfd=xfd=ConnectionNumber(x->display);
-ptyfd=vte->writequeue.fd;
-maxfd=_BADMAX(maxfd,ptyfd)+1;
+if (startloop(xc)) GOTOERROR;
 (ignore)setpointer_xclient(xc,0);
 if (checkforscript(xc)) GOTOERROR;
 while (1) {
-	fd_set rset,wset;
-	struct timeval tv;
+	uint64_t frame=0; // damage or jump deadline
+	unsigned int fired;
 nextloop:
 
 	if (xc->ispaused) {
 		if (pauseloop_xclient(xc)) GOTOERROR;
+		if (watchslot(xc,PTY_SLOT_XCLIENT,(vte->writequeue.len)?EPOLLOUT:0)) GOTOERROR; // pauseloop dropped it
 		if (checkforscript(xc)) GOTOERROR;
 		if (xc->isquit) break;
 	}
@@ -1834,52 +2272,99 @@ nextloop:
 		if (handlexevent_xclient(xc)) GOTOERROR;
 		continue;
 	}
-	if (vte->readqueue.qlen) while (1) {
-		if (processreadqueue_vte(vte)) GOTOERROR;
-		if (drawvteevents(xc)) GOTOERROR;
-		if (xc->ispaused) goto nextloop;
-		if (XEventsQueued(x->display,QueuedAfterReading)) goto nextloop;
-		if (!vte->readqueue.qlen) break;
+	if (fillreadqueue_vte(vte)) { xc->isquit=1; break; }
+	if (vte->readqueue.qlen) {
+		if (parseslice(xc)) GOTOERROR;
+		while (1) {
+			int isahead;
+			isahead=startahead(xc);
+			if (drawvteevents(xc)) GOTOERROR;
+			if (xc->ispaused) goto nextloop; // only hooks pause, those slices aren't parsed ahead
+			if (checkjump(xc)) GOTOERROR;
+			if (isdamagedue(xc) && flushdamage(xc)) GOTOERROR;
+			if (isahead && finishahead(xc)) GOTOERROR;
+			if (XEventsQueued(x->display,QueuedAfterReading)) {
+				if (isahead && drawvteevents(xc)) GOTOERROR; // x handlers expect no events outstanding
+				goto nextloop;
+			}
+			if (!isahead) {
+				if (!vte->readqueue.qlen) break;
+				if (parseslice(xc)) GOTOERROR;
+			}
+		}
 	}
-	tv.tv_sec=60-59*x->isfocused;
-	tv.tv_usec=0;
-	FD_ZERO(&rset);
-	FD_SET(xfd,&rset);
-	if (!vte->readqueue.qlen) FD_SET(ptyfd,&rset);
-	FD_ZERO(&wset);
-	if (vte->writequeue.len) FD_SET(ptyfd,&wset);
-	switch (select(maxfd,&rset,&wset,NULL,&tv)) {
-		case 0:
-			if (xc->isnodraw && drawon_xclient(xc)) GOTOERROR;
-			if (x->isfocused && pulse_cursor(cursor)) GOTOERROR;
-			if (checkforscript(xc)) GOTOERROR;
-			if (unmark_xclient(xc)) GOTOERROR;
+	if (!vte->readqueue.qlen && !isidle_pty(pty)) continue; // more arrived while we were drawing
+	if (xc->damage.ispending) {
+		uint64_t now;
+		now=getmicroseconds();
+		if (now-xc->damage.lastflush<xc->damage.frameus) {
+			frame=xc->damage.lastflush+xc->damage.frameus;
+		} else if (isbacklogged(xc)) { // fence events will wake us, the timeout is a fallback
+			frame=now+BACKLOGUS_DAMAGE;
+		} else {
+			if (flushdamage(xc)) GOTOERROR;
 			continue;
-		case -1: GOTOERROR;
+		}
+	} else if (xc->jump.isactive) { // the last frame of a flood still needs to be painted
+		uint64_t now;
+		now=getmicroseconds();
+		if (now-xc->jump.framestart>=xc->jump.frameus) {
+			if (checkjump(xc)) GOTOERROR;
+			if (xc->jump.isactive) { // backlogged
+				frame=now+BACKLOGUS_DAMAGE;
+			} else continue;
+		} else {
+			frame=xc->jump.framestart+xc->jump.frameus;
+		}
 	}
-
-	if (FD_ISSET(xfd,&rset)) {
+	if (watchslot(xc,DATA_SLOT_XCLIENT,(vte->readqueue.qlen)?0:EPOLLIN)) GOTOERROR;
+	if (watchslot(xc,PTY_SLOT_XCLIENT,(vte->writequeue.len)?EPOLLOUT:0)) GOTOERROR;
+	if (watchslot(xc,INSERTION_SLOT_XCLIENT,(isinsertable(xc))?EPOLLIN:0)) GOTOERROR;
+	if (waitloop(&fired,xc,frame,1)) GOTOERROR;
+
+	if (fired&(1<<TIMER_SLOT_XCLIENT)) {
+		uint64_t now;
+		now=getmicroseconds();
+		if (frame && (now>=frame)) {
+			if (xc->damage.ispending) {
+				if (flushdamage(xc)) GOTOERROR;
+			} else {
+				if (idleduties(xc)) GOTOERROR;
+			}
+		} else if (isidleduty(xc) && (now>=xc->loop.lastactive+idleus(xc))) {
+			if (idleduties(xc)) GOTOERROR;
+		}
+		if (runtimers(xc,now)) GOTOERROR;
+	}
+	if (fired&(1<<X_SLOT_XCLIENT)) {
 		XEventsQueued(x->display,QueuedAfterReading);
 	}
-	if (FD_ISSET(ptyfd,&rset)) {
-		if (fillreadqueue_vte(vte)) { xc->isquit=1; break; }
+	if (fired&(1<<DATA_SLOT_XCLIENT)) {
+		(void)ack_pty(pty);
 	}
-	if (FD_ISSET(ptyfd,&wset)) {
+	if (fired&(1<<PTY_SLOT_XCLIENT)) {
 		if (flush_vte(vte)) GOTOERROR;
 	}
+	if (fired&(1<<INSERTION_SLOT_XCLIENT)) {
+		if (checkforscript(xc)) GOTOERROR;
+	}
 }
+(void)stoploop(xc);
 return 0;
 error:
+	(void)stoploop(xc);
 	return -1;
 }
 
-static int clearcaches(struct xclient *xc) {
+static int clearcaches(struct xclient *xc, int isshapes) {
+// isshapes: glyphs changed, not just colors
 struct vte *vte=xc->baggage.vte;
 struct cursor *cursor=xc->baggage.cursor;
 
 if (cursor->isplaced) xc->config.changes.iscurset=1;
 if (reset_cursor(cursor)) GOTOERROR;
 (void)reset_charcache(xc->baggage.charcache);
+if (isshapes && xc->baggage.maskcache) (void)reset_charcache(xc->baggage.maskcache);
 if (setxcolors(xc,vte)) GOTOERROR;
 xc->config.changes.isredraw=1;
 return 0;
@@ -1895,7 +2380,7 @@ struct config *config=xc->baggage.config;
 if (config->isdarkmode) (void)setcolors_vte(vte,&config->darkmode);
 else (void)setcolors_vte(vte,&config->lightmode);
 
-if (clearcaches(xc)) GOTOERROR;
+if (clearcaches(xc,0)) GOTOERROR;
 return 0;
 error:
 	return -1;
@@ -1925,6 +2410,7 @@ lastline=line+xc->config.rowsm1;
 cols=xc->config.columns;
 while (1) {
 	memset4(line->backing,blankval,cols);
+	line->damage.isdirty=0;
 	if (line==lastline) break;
 	line++;
 }
@@ -1992,7 +2478,7 @@ error:
 
 void setalarm_xclient(struct xclient *xc, unsigned int seconds) {
 uint64_t t;
-t=(uint64_t)time(NULL)+seconds;
+t=getmicroseconds()+(uint64_t)seconds*1000000;
 if ((!xc->nextalarm) || (t<xc->nextalarm)) xc->nextalarm=t;
 }
 
@@ -2066,7 +2552,7 @@ error:
 
 int changefont_xclient(struct xclient *xc, char *fontname) {
 // call reconfig_ afterward
-if (clearcaches(xc)) GOTOERROR;
+if (clearcaches(xc,1)) GOTOERROR;
 if (changefont_xftchar(xc->baggage.xftchar,fontname)) GOTOERROR;
 return 0;
 error:
@@ -2100,7 +2586,7 @@ return 1;
 
 int resizewindow_xclient(struct xclient *xc, unsigned int width, unsigned int height) {
 // call reconfig_ afterward
-if (clearcaches(xc)) GOTOERROR;
+if (clearcaches(xc,0)) GOTOERROR;
 if (resizewindow_x11info(xc->baggage.x,width,height)) GOTOERROR;
 xc->config.changes.isredraw=1;
 xc->config.changes.isremap=1;
@@ -2119,13 +2605,13 @@ int resizesurface_xclient(struct xclient *xc, unsigned int rows, unsigned int co
 struct vte *vte=xc->baggage.vte;
 uint32_t blankvalue;
 long fillcolor;
-if (clearcaches(xc)) GOTOERROR;
+if (clearcaches(xc,0)) GOTOERROR;
 
 blankvalue=32|vte->curbgcolor->bgvaluemask;
 fillcolor=xc->xcolors[vte->curbgcolor->index].pixel;
 
 if (resize_surface_xclient(&xc->surface,xc->baggage.x,xc->config.rows,xc->config.columns,
-		rows,cols,blankvalue,xc->config.scrollbackcount,xc->config.cellw,xc->config.cellh,fillcolor,xc->config.changes.isremap)) GOTOERROR;
+		rows,cols,blankvalue,xc->config.cellw,xc->config.cellh,fillcolor,xc->config.changes.isremap)) GOTOERROR;
 
 xc->config.columns=cols;
 xc->config.columnsm1=cols-1;
@@ -2139,6 +2625,9 @@ xc->config.yoff=(xc->config.xheight-xc->config.colheight)/2;
 
 xc->config.changes.isredraw=1;
 
+if (xc->baggage.shmdraw) {
+	if (resize_shmdraw(xc->baggage.shmdraw,rows,cols,xc->config.cellw,xc->config.cellh)) GOTOERROR;
+}
 if (resize_pty(xc->baggage.pty,cols,rows)) GOTOERROR;
 if (resize_vte(xc->baggage.vte,rows,cols)) GOTOERROR;
 return 0;
@@ -2148,7 +2637,7 @@ error:
 
 int resizecell_xclient(struct xclient *xc, unsigned int cellw, unsigned int cellh) {
 // call reconfig_ afterward
-if (clearcaches(xc)) GOTOERROR;
+if (clearcaches(xc,1)) GOTOERROR;
 
 xc->config.cellw=cellw;
 xc->config.cellh=cellh;
@@ -2157,6 +2646,12 @@ xc->config.colheight=xc->config.rows*cellh;
 xc->config.changes.isredraw=1;
 if (resize_xftchar(xc->baggage.xftchar,cellw,cellh)) GOTOERROR;
 if (resize_charcache(xc->baggage.charcache,cellw,cellh)) GOTOERROR;
+if (xc->baggage.maskcache) {
+	if (resize_charcache(xc->baggage.maskcache,cellw,cellh)) GOTOERROR;
+}
+if (xc->baggage.shmdraw) {
+	if (resize_shmdraw(xc->baggage.shmdraw,xc->config.rows,xc->config.columns,cellw,cellh)) GOTOERROR;
+}
 return 0;
 error:
 	return -1;
@@ -2180,6 +2675,10 @@ error:
 
 void setparams_xclient(struct xclient *xc, int font0shift, int font0line, int fontulline, int fontullines) {
 (void)setparams_xftchar(xc->baggage.xftchar,font0shift,font0line,fontulline,fontullines);
+// masks would otherwise outlive palette changes with the old placement
+(void)reset_charcache(xc->baggage.charcache);
+if (xc->baggage.maskcache) (void)reset_charcache(xc->baggage.maskcache);
+xc->config.changes.isredraw=1;
 }
 
 int mark_xclient(struct xclient *xc) {
@@ -2223,27 +2722,19 @@ error:
 }
 
 static int drawrow(struct xclient *xc, uint32_t *backing, unsigned int row, uint32_t *oldbacking) {
-struct x11info *xi=xc->baggage.x;
-Display *display;
-Window window;
-GC context;
-Pixmap pixmap;
-unsigned int x,yoff,cellw,cellh;
+struct one_charcache *occ;
+unsigned int x,yoff,cellw;
 uint32_t *lastbacking;
 
-display=xi->display;
-window=xi->window;
-context=xi->context;
 x=xc->config.xoff;
 yoff=xc->config.yoff+xc->config.cellh*row;
 cellw=xc->config.cellw;
-cellh=xc->config.cellh;
 lastbacking=backing+xc->config.columnsm1;
 
 while (1) {
 	if (*backing!=*oldbacking) {
-		if (!(pixmap=getpixmap(xc,*backing))) GOTOERROR;
-		XCopyArea(display,pixmap,window,context,0,0,cellw,cellh,x,yoff);
+		if (!(occ=getglyph(xc,*backing))) GOTOERROR;
+		(void)copyglyph(xc,occ,x,yoff);
 	}
 	if (backing==lastbacking) break;
 	backing+=1;
@@ -2256,163 +2747,200 @@ error:
 	return -1;
 }
 
+static void hideline(struct xclient *xc, struct line_xclient *line, unsigned int row) {
+// line is leaving the screen from row, live lines are kept in livelines, history lines are just dropped
+unsigned int linesback=xc->scrollback.linesback;
+struct line_xclient *live;
+uint32_t *backing;
+if (row<linesback) return;
+live=xc->surface.livelines+row-linesback;
+backing=live->backing;
+live->backing=line->backing;
+line->backing=backing;
+}
+
+static void showline(struct xclient *xc, struct line_xclient *line, unsigned int row) {
+// line is about to be placed at row, its backing is free
+unsigned int linesback=xc->scrollback.linesback;
+if (row<linesback) {
+	(void)get_history(line->backing,xc->surface.numinline,&xc->surface.scrollback,linesback-row-1);
+	return;
+}
+(void)hideline(xc,line,row); // swapping back is the same as swapping out
+}
+
 static int scrollback(struct xclient *xc) {
 struct x11info *x=xc->baggage.x;
-struct sbline_xclient *sb;
 struct line_xclient ll;
-uint32_t *backing;
 
-#if 0
-sb=xc->surface.scrollback.first;
-WHEREAMI;
-if (drawrow(xc,sb->backing,0)) GOTOERROR;
-return 0;
-#endif
-
-sb=xc->surface.scrollback.first;
-xc->surface.scrollback.first=sb->next;
-if (sb->next) {
-	sb->next->previous=NULL;
-} else {
-	xc->surface.scrollback.last=NULL;
-}
 ll=xc->surface.lines[xc->config.rowsm1];
+(void)hideline(xc,&ll,xc->config.rowsm1);
 memmove(xc->surface.lines+1,xc->surface.lines,sizeof(struct line_xclient)*xc->config.rowsm1);
 XCopyArea(x->display,x->window,x->window,x->context,xc->config.xoff,xc->config.yoff,xc->config.rowwidth,
 		xc->config.cellh*xc->config.rowsm1, xc->config.xoff,xc->config.yoff+xc->config.cellh);
 
-// fprintf(stderr,"%s:%d sb->backing:%p\n",__FILE__,__LINE__,sb->backing);
-// fprintf(stderr,"%s:%d ll.backing:%p\n",__FILE__,__LINE__,ll.backing);
-backing=sb->backing;
-sb->backing=ll.backing;
-sb->next=xc->surface.scrollback.reverse.first;
-xc->surface.scrollback.reverse.first=sb;
-ll.backing=backing;
+xc->scrollback.linesback+=1;
+(void)showline(xc,&ll,0);
 xc->surface.lines[0]=ll;
 
-if (drawrow(xc,backing,0,xc->surface.lines[1].backing)) GOTOERROR;
+if (drawrow(xc,ll.backing,0,xc->surface.lines[1].backing)) GOTOERROR;
 XFlush(x->display);
-
-xc->scrollback.linesback+=1;
 return 0;
 error:
 	return -1;
 }
 
-static int rev_scrollback(struct xclient *xc) {
-struct x11info *x=xc->baggage.x;
-struct sbline_xclient *sb;
+static void nodraw_rev_scrollback(struct xclient *xc) {
 struct line_xclient fl;
-uint32_t *backing;
-
-sb=xc->surface.scrollback.reverse.first;
-xc->surface.scrollback.reverse.first=sb->next;
 
-fl=xc->surface.lines[0];
+fl=xc->surface.lines[0]; // always history, it's dropped
 memmove(xc->surface.lines,xc->surface.lines+1,sizeof(struct line_xclient)*xc->config.rowsm1);
-XCopyArea(x->display,x->window,x->window,x->context,xc->config.xoff,xc->config.yoff+xc->config.cellh,xc->config.rowwidth,
-		xc->config.cellh*xc->config.rowsm1, xc->config.xoff,xc->config.yoff);
 
-backing=sb->backing;
-sb->backing=fl.backing;
-sb->next=xc->surface.scrollback.first;
-if (xc->surface.scrollback.first) {
-	xc->surface.scrollback.first->previous=sb;
-	xc->surface.scrollback.first=sb;
-} else {
-	sb->next=sb->previous=NULL;
-	xc->surface.scrollback.first=xc->surface.scrollback.last=sb;
-}
-fl.backing=backing;
+xc->scrollback.linesback-=1;
+(void)showline(xc,&fl,xc->config.rowsm1);
 xc->surface.lines[xc->config.rowsm1]=fl;
+}
 
-if (drawrow(xc,backing,xc->config.rowsm1,xc->surface.lines[xc->config.rows-2].backing)) GOTOERROR;
-XFlush(x->display);
+static int rev_scrollback(struct xclient *xc) {
+struct x11info *x=xc->baggage.x;
 
-xc->scrollback.linesback-=1;
+XCopyArea(x->display,x->window,x->window,x->context,xc->config.xoff,xc->config.yoff+xc->config.cellh,xc->config.rowwidth,
+		xc->config.cellh*xc->config.rowsm1, xc->config.xoff,xc->config.yoff);
+(void)nodraw_rev_scrollback(xc);
+
+if (drawrow(xc,xc->surface.lines[xc->config.rowsm1].backing,xc->config.rowsm1,xc->surface.lines[xc->config.rows-2].backing)) GOTOERROR;
+XFlush(x->display);
 return 0;
 error:
 	return -1;
 }
 
-static void nodraw_rev_scrollback(struct xclient *xc) {
-struct sbline_xclient *sb;
-struct line_xclient fl;
-uint32_t *backing;
-
-sb=xc->surface.scrollback.reverse.first;
-xc->surface.scrollback.reverse.first=sb->next;
-
-fl=xc->surface.lines[0];
-memmove(xc->surface.lines,xc->surface.lines+1,sizeof(struct line_xclient)*xc->config.rowsm1);
-
-backing=sb->backing;
-sb->backing=fl.backing;
-sb->next=xc->surface.scrollback.first;
-if (xc->surface.scrollback.first) {
-	xc->surface.scrollback.first->previous=sb;
-	xc->surface.scrollback.first=sb;
-} else {
-	sb->next=sb->previous=NULL;
-	xc->surface.scrollback.first=xc->surface.scrollback.last=sb;
-}
-fl.backing=backing;
-xc->surface.lines[xc->config.rowsm1]=fl;
-
-xc->scrollback.linesback-=1;
-}
-
-static int reset_scrollback(struct xclient *xc) {
-while (1) {
-	(void)nodraw_rev_scrollback(xc);
-	if (!xc->scrollback.linesback) break;
-}
+static int jump_scrollback(struct xclient *xc, unsigned int linesback) {
+// any distance costs one decode per row and one repaint
+unsigned int row;
+for (row=0;row<xc->config.rows;row++) (void)hideline(xc,&xc->surface.lines[row],row);
+xc->scrollback.linesback=linesback;
+for (row=0;row<xc->config.rows;row++) (void)showline(xc,&xc->surface.lines[row],row);
 if (redrawrect(xc,0,0,xc->config.xwidth,xc->config.xheight)) GOTOERROR;
+XFlush(xc->baggage.x->display);
 return 0;
 error:
 	return -1;
 }
 
-int scrollback_xclient(struct xclient *xc, int delta) {
-if (delta>0) {
-	if (!xc->surface.scrollback.first) return 0;
-	if (!xc->scrollback.linesback) {
-		xc->scrollback.ispaused=xc->ispaused;
-		xc->ispaused=1;
-		if ((xc->scrollback.iscurset=xc->baggage.cursor->isplaced)) {
-			if (reset_cursor(xc->baggage.cursor)) GOTOERROR;
-		}
+int scrollto_xclient(struct xclient *xc, unsigned int linesback) {
+// linesback: 0 => the live screen, lines_history() => the oldest line is on top
+unsigned int current,total;
+
+total=lines_history(&xc->surface.scrollback);
+if (linesback>total) linesback=total;
+current=xc->scrollback.linesback;
+if (linesback==current) return 0;
+
+if (flushdamage(xc)) GOTOERROR; // scrollback() reuses drawn rows
+if (!current) {
+	xc->scrollback.ispaused=xc->ispaused;
+	xc->ispaused=1;
+	if ((xc->scrollback.iscurset=xc->baggage.cursor->isplaced)) {
+		if (reset_cursor(xc->baggage.cursor)) GOTOERROR;
 	}
-	while (1) {
+}
+if (linesback>current) {
+	if (linesback-current>=xc->config.rowsm1) {
+		if (jump_scrollback(xc,linesback)) GOTOERROR;
+	} else while (xc->scrollback.linesback!=linesback) {
 		if (scrollback(xc)) GOTOERROR;
-		delta--;
-		if (!delta) break;
-		if (!xc->surface.scrollback.first) break;
 	}
 } else {
-	if ((!(delta+xc->scrollback.linesback))&&(xc->scrollback.linesback>=xc->config.rowsm1)) { // go back to normal without scrolling
-		if (reset_scrollback(xc)) GOTOERROR;
-		XFlush(xc->baggage.x->display);
-	}
-	while (1) {
-		if (!xc->surface.scrollback.reverse.first) {
-			if (!xc->scrollback.ispaused) xc->ispaused=0;
-			if (xc->scrollback.iscurset) {
-				if (setcursor(xc,xc->baggage.cursor->row,xc->baggage.cursor->col)) GOTOERROR;
-			}
-			break;
-		}
-		if (!delta) break;
+	if (current-linesback>=xc->config.rowsm1) {
+		if (jump_scrollback(xc,linesback)) GOTOERROR;
+	} else while (xc->scrollback.linesback!=linesback) {
 		if (rev_scrollback(xc)) GOTOERROR;
-		delta++;
 	}
 }
+if (!linesback) {
+	if (!xc->scrollback.ispaused) xc->ispaused=0;
+	if (xc->scrollback.iscurset) {
+		if (setcursor(xc,xc->baggage.cursor->row,xc->baggage.cursor->col)) GOTOERROR;
+	}
+}
+return 0;
+error:
+	return -1;
+}
+
+static uint32_t *getlive(void *v, unsigned int row) {
+struct xclient *xc=(struct xclient *)v;
+unsigned int linesback=xc->scrollback.linesback;
+if (row+linesback<xc->config.rows) return xc->surface.lines[row+linesback].backing;
+return xc->surface.livelines[row].backing;
+}
+
+int search_xclient(int *isfound_out, uint64_t *line_out, unsigned int *col_out, struct xclient *xc,
+		unsigned char *utf8, unsigned int len, int direction, int isfold) {
+// repeating a search continues from the last match, the match is scrolled into view and selected
+// *line_out is numbered like scrollpos, 0 is the oldest line in history
+struct history *history=&xc->surface.scrollback;
+struct search *search=&xc->search;
+uint64_t top,line;
+unsigned int col,row;
+int ischanged,isfound;
+
+if (setpattern_search(&ischanged,search,utf8,len,isfold)) GOTOERROR;
+top=history->added-xc->scrollback.linesback; // line on row 0
+if ((!ischanged)&&(search->last.isvalid)) {
+	if (find_search(&isfound,search,history,getlive,xc,xc->config.rows,xc->config.columns,
+			search->last.line,search->last.col,direction)) GOTOERROR;
+} else if (direction<0) {
+	if (find_search(&isfound,search,history,getlive,xc,xc->config.rows,xc->config.columns,
+			top+xc->config.rowsm1,INT_MAX,direction)) GOTOERROR;
+} else {
+	if (find_search(&isfound,search,history,getlive,xc,xc->config.rows,xc->config.columns,
+			top,-1,direction)) GOTOERROR;
+}
+if (!isfound) {
+	*isfound_out=0;
+	return 0;
+}
+
+line=search->last.line;
+col=search->last.col;
+if ((line<top)||(line>=top+xc->config.rows)) {
+	top=(line>xc->config.rows/2)?line-xc->config.rows/2:0;
+	if (top<oldest_history(history)) top=oldest_history(history);
+	if (top>history->added) top=history->added;
+	if (scrollto_xclient(xc,history->added-top)) GOTOERROR;
+}
+row=line-top;
+if (col<xc->config.columns) {
+	unsigned int stop;
+	stop=col+search->pattern.cells-1;
+	if (stop>xc->config.columnsm1) stop=xc->config.columnsm1;
+	if (setselection_xclient(xc,RAW_MODE_SELECTION_SURFACE_XCLIENT,row,col,row,stop)) GOTOERROR;
+}
 
+*isfound_out=1;
+*line_out=line-oldest_history(history);
+*col_out=col;
 return 0;
 error:
 	return -1;
 }
 
+int scrollback_xclient(struct xclient *xc, int delta) {
+unsigned int linesback;
+linesback=xc->scrollback.linesback;
+if (delta<0) {
+	unsigned int back=-(unsigned int)delta;
+	if (back>=linesback) linesback=0;
+	else linesback-=back;
+} else {
+	linesback+=delta;
+	if (linesback<xc->scrollback.linesback) linesback=UINT_MAX;
+}
+return scrollto_xclient(xc,linesback);
+}
+
 int copy_xclient(struct xclient *xc, unsigned char *selection, unsigned int selectionlen, unsigned char *text, unsigned int textlen) {
 char selname[MAX_SELECTION_XCLIPBOARD+1];
 if (selectionlen>MAX_SELECTION_XCLIPBOARD) GOTOERROR;
@@ -2618,6 +3146,7 @@ error:
 
 int drawoff_xclient(struct xclient *xc) {
 xc->isnodraw=1;
+xc->jump.isactive=0;
 // fprintf(stderr,"Setting nodraw\n");
 if (unset_cursor(xc->baggage.cursor)) GOTOERROR;
 return 0;
@@ -2626,6 +3155,7 @@ error:
 }
 int drawon_xclient(struct xclient *xc) {
 xc->isnodraw=0;
+xc->jump.isactive=0;
 if (redrawrect(xc,xc->config.xoff,xc->config.yoff,xc->config.rowwidth,xc->config.colheight)) GOTOERROR;
 if (setcursor(xc, xc->baggage.cursor->row, xc->baggage.cursor->col)) GOTOERROR;
 XFlush(xc->baggage.x->display);
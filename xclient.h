@@ -24,14 +24,23 @@
 // free in vte's input before we attempt it (to avoid clipping)
 // as such, vte needs at least this in its read buffer
 #define BUFFSIZE_INSERTION_XCLIENT	512
+#define INFLIGHT_DAMAGE_XCLIENT	2
+#define JUMPFRAMEUS_XCLIENT	16666 // jump frame length if framerate is 0
+#define BLINKUS_XCLIENT	1000000 // cursor pulse period
+
+#define X_SLOT_XCLIENT	0
+#define DATA_SLOT_XCLIENT	1
+#define PTY_SLOT_XCLIENT	2
+#define INSERTION_SLOT_XCLIENT	3
+#define TIMER_SLOT_XCLIENT	4
+#define COUNT_SLOT_XCLIENT	5
 
 struct line_xclient {
 	uint32_t *backing; // [COLUMNS], the value at last draw
-};
-
-struct sbline_xclient {
-	uint32_t *backing;
-	struct sbline_xclient *next,*previous;
+	struct {
+		int isdirty:1; // backing[first..last] hasn't been sent to X yet
+		unsigned int first,last;
+	} damage;
 };
 
 struct xclient {
@@ -42,7 +51,7 @@ struct xclient {
 		unsigned int columns,rows;
 		unsigned int columnsm1,rowsm1;
 		unsigned int rowwidth,colheight;
-		unsigned int scrollbackcount; // 0 is ok, 1 is not, 2+ is ok
+		unsigned int scrollbackcount; // lines of history, 0 => none
 		unsigned int movepixels; // square of number of pixels to be considered mouse motion, hopefully 1mm^2
 		unsigned int isappcursor:1;
 		unsigned int isautorepeat:1;
@@ -63,6 +72,24 @@ struct xclient {
 		int ispaused:1;
 		unsigned int linesback; // 0=>no lines back
 	} scrollback;
+	struct {
+		int ispending:1; // a line is dirty or the cursor needs to be set
+		int iscursor:1;
+		unsigned int row,col; // of cursor
+		unsigned int frameus; // 0 => flush after every batch
+		uint64_t lastflush; // microseconds
+		int ispadding:1; // an expose touched the padding
+		Atom fenceatom;
+		unsigned long fences[INFLIGHT_DAMAGE_XCLIENT]; // request numbers, ring
+		unsigned int fenceindex; // oldest in fences[]
+	} damage;
+	struct { // jump scrolling, only the last state of each frame is painted during floods
+		int isactive:1; // isnodraw was set by us
+		unsigned int threshold; // bytes per frame, 0 => never jump
+		unsigned int frameus;
+		unsigned int bytes; // since framestart
+		uint64_t framestart;
+	} jump;
 #if 0
 	struct { // it's necessary to send paste requests to script so script can intercept them for dialogs
 		unsigned int max_buffer;
@@ -70,18 +97,13 @@ struct xclient {
 	} paste;
 #endif
 	struct surface_xclient {
-		struct {
-			struct sbline_xclient *first,*last;
-			struct sbline_xclient *firstfree;
-			struct {
-				struct sbline_xclient *first;
-			} reverse;
-		} scrollback;
+		struct history scrollback; // lines that scrolled off the top, compressed
 		unsigned int numinline; // never decreases, number of uint32s in each backing line (resizing => != config.columns)
 		unsigned int maxlines;
 		struct line_xclient *lines; // [ROWS]
 		struct line_xclient *sparelines; // [ROWS], there is _no_ backing reserved, this is for scrolling .lines
 		struct line_xclient *savedlines; // for script to save/restore a screenshot
+		struct line_xclient *livelines; // [ROWS], the live screen while it's scrolled back, spare backings otherwise
 		uint32_t *spareline; // useful for pyunicode_fromkindanddata
 		struct {
 #define NONE_MODE_SELECTION_SURFACE_XCLIENT 0
@@ -114,13 +136,24 @@ struct xclient {
 		} selection;
 		struct {
 			struct line_xclient *lines;
-			struct sbline_xclient *sblines;
 			uint32_t *backing;
 			unsigned int backcount;
 		} tofree;
 	} surface;
+	struct search search;
 	XColor xcolors[16];
-	uint64_t nextalarm;
+	uint64_t nextalarm; // microseconds, 0 => none
+	struct { // mainloop_xclient sleeps in epoll until an fd or the first deadline, nothing polls
+		int epfd,timerfd;
+		struct {
+			int fd; // -1 => not in the set
+			uint32_t events; // what we're watching for
+			int isdropped; // fd was taken out of epfd, watchslot puts it back
+		} slots[COUNT_SLOT_XCLIENT];
+		uint64_t armed; // timerfd deadline, 0 => disarmed
+		uint64_t lastactive; // last wakeup by an fd, idle duties wait on this
+		uint64_t blink; // next cursor pulse, 0 => not blinking
+	} loop;
 	int isnodraw:1;
 	int ispaused:1;
 	int isquit:1;
@@ -129,6 +162,8 @@ struct xclient {
 		struct x11info *x;
 		struct xftchar *xftchar;
 		struct charcache *charcache;
+		struct charcache *maskcache; // NULL without RENDER
+		struct shmdraw *shmdraw; // NULL unless config.isshmdraw
 		struct texttap *texttap;
 		struct pty *pty;
 		struct all_event *events;
@@ -147,6 +182,7 @@ struct xclient {
 		int (*alarmcall)(void *,int);
 		char *(*getinsertion)(unsigned int *,void *);
 		int (*checkinsertion)(void *);
+		int (*insertionfd)(void *); // readable when checkinsertion would be true, -1 => none
 		int (*message)(void *,char *,unsigned int);
 		int (*keysym)(void *,unsigned int, unsigned int);
 		int (*unkeysym)(void *,unsigned int, unsigned int);
@@ -159,7 +195,8 @@ struct xclient {
 };
 
 int init_xclient(struct xclient *xc, struct config *config, struct x11info *x, struct xftchar *xftchar,
-		struct charcache *charcache, struct texttap *texttap, struct pty *pty, struct all_event *events, struct vte *vte,
+		struct charcache *charcache, struct charcache *maskcache, struct shmdraw *shmdraw, struct texttap *texttap, struct pty *pty,
+		struct all_event *events, struct vte *vte,
 		struct cursor *cursor, struct xclipboard *xclipboard, void *script);
 void deinit_xclient(struct xclient *xc);
 // int verify_xclient(void);
@@ -194,6 +231,9 @@ void setparams_xclient(struct xclient *xc, int font0shift, int font0line, int fo
 int mark_xclient(struct xclient *xc);
 int unmark_xclient(struct xclient *xc);
 int scrollback_xclient(struct xclient *xc, int delta);
+int scrollto_xclient(struct xclient *xc, unsigned int linesback);
+int search_xclient(int *isfound_out, uint64_t *line_out, unsigned int *col_out, struct xclient *xc,
+		unsigned char *utf8, unsigned int len, int direction, int isfold);
 int copy_xclient(struct xclient *xc, unsigned char *selection, unsigned int selectionlen, unsigned char *text, unsigned int textlen);
 int getpaste_xclient(struct xclient *xc, unsigned char *dest, unsigned int destlen);
 int paste_xclient(unsigned int *newlen_out, struct xclient *xc, unsigned char *selection, unsigned int selectionlen, int timeout);
@@ -132,6 +132,14 @@ xc->draw=XftDrawCreate(x->display,x->window,x->visual,x->colormap);
 #endif
 if (!xc->draw) GOTOERROR;
 // if (!(xc->data=MALLOC(xc->width*xc->height*4))) GOTOERROR;
+{
+	int ign1,ign2;
+	if (XRenderQueryExtension(x->display,&ign1,&ign2)) {
+		xc->render.a8=XRenderFindStandardFormat(x->display,PictStandardA8);
+		xc->render.visual=XRenderFindVisualFormat(x->display,x->visual);
+		if (xc->render.a8 && xc->render.visual) xc->render.isavailable=1;
+	}
+}
 return 0;
 error:
 	return -1;
@@ -139,6 +147,10 @@ error:
 
 int setcolor_xftchar(struct xftchar *xc, unsigned int index, unsigned short red, unsigned short green, unsigned short blue) {
 XRenderColor xrc;
+if (xc->render.fills[index]) {
+	(ignore)XRenderFreePicture(xc->x->display,xc->render.fills[index]);
+	xc->render.fills[index]=0;
+}
 if (xc->colors[index].isallocated) (void)XftColorFree(xc->x->display,xc->x->visual,xc->x->colormap,&xc->colors[index].xftc);
 xrc.blue=blue;
 xrc.green=green;
@@ -169,26 +181,35 @@ if (!xc->x) return;
 if (xc->font) XftFontClose(xc->x->display,xc->font);
 if (xc->pixmap) XFreePixmap(xc->x->display,xc->pixmap);
 if (xc->draw) XftDrawDestroy(xc->draw);
+if (xc->render.maskdraw) XftDrawDestroy(xc->render.maskdraw);
 // IFFREE(xc->data);
 {
 	int index;
 	for (index=0;index<16;index++) {
+		if (xc->render.fills[index]) (ignore)XRenderFreePicture(xc->x->display,xc->render.fills[index]);
 		if (!xc->colors[index].isallocated) continue;
 		(void)XftColorFree(xc->x->display,xc->x->visual,xc->x->colormap,&xc->colors[index].xftc);
 	}
 }
 }
 
-void drawchar2_xftchar(Pixmap dest, struct xftchar *xc, unsigned int ucs4, unsigned int bgindex, unsigned int fgindex, int isunderline) {
+void drawchar2_xftchar(Pixmap dest, int x, int y, struct xftchar *xc, unsigned int ucs4, unsigned int bgindex, unsigned int fgindex,
+		int isunderline) {
+// draws a cell at x,y, clipped so overhangs don't touch neighbors
 XftColor *bg_xftc,*fg_xftc;
+XRectangle clip;
 
 (void)XftDrawChange(xc->draw,dest);
 // xc->isotherpixmap=1; // for drawchar_xftchar
+clip.x=clip.y=0;
+clip.width=xc->width;
+clip.height=xc->height;
+(ignore)XftDrawSetClipRectangles(xc->draw,x,y,&clip,1);
 
 bg_xftc=&xc->colors[bgindex].xftc;
 fg_xftc=&xc->colors[fgindex].xftc;
 
-(void)XftDrawRect(xc->draw,bg_xftc,0,0,xc->width,xc->height);
+(void)XftDrawRect(xc->draw,bg_xftc,x,y,xc->width,xc->height);
 #if 0
 {
 	XGlyphInfo extent;
@@ -202,8 +223,47 @@ fg_xftc=&xc->colors[fgindex].xftc;
 		extent.yOff);
 }
 #endif
-(void)XftDrawString32(xc->draw,fg_xftc,xc->font,xc->effective.font0shift,xc->effective.font0line,&ucs4,1);
-if (isunderline) (void)XftDrawRect(xc->draw,fg_xftc,0,xc->effective.fontulline,xc->width,xc->effective.fontullines);
+(void)XftDrawString32(xc->draw,fg_xftc,xc->font,x+xc->effective.font0shift,y+xc->effective.font0line,&ucs4,1);
+if (isunderline) (void)XftDrawRect(xc->draw,fg_xftc,x,y+xc->effective.fontulline,xc->width,xc->effective.fontullines);
+}
+
+int drawmask_xftchar(Pixmap mask, int x, int y, struct xftchar *xc, unsigned int ucs4, int isunderline) {
+// draws glyph coverage into an A8 pixmap, colors are added by composite_xftchar
+static XftColor clear={.color={0,0,0,0}};
+static XftColor opaque={.color={0,0,0,65535}};
+XRectangle clip;
+
+if (!xc->render.maskdraw) {
+	if (!(xc->render.maskdraw=XftDrawCreateAlpha(xc->x->display,mask,8))) GOTOERROR;
+} else (void)XftDrawChange(xc->render.maskdraw,mask);
+clip.x=clip.y=0;
+clip.width=xc->width;
+clip.height=xc->height;
+(ignore)XftDrawSetClipRectangles(xc->render.maskdraw,x,y,&clip,1);
+
+(void)XftDrawRect(xc->render.maskdraw,&clear,x,y,xc->width,xc->height);
+(void)XftDrawString32(xc->render.maskdraw,&opaque,xc->font,x+xc->effective.font0shift,y+xc->effective.font0line,&ucs4,1);
+if (isunderline) (void)XftDrawRect(xc->render.maskdraw,&opaque,x,y+xc->effective.fontulline,xc->width,xc->effective.fontullines);
+return 0;
+error:
+	return -1;
+}
+
+int composite_xftchar(Picture dest, int x, int y, struct xftchar *xc, Picture mask, int mx, int my,
+		unsigned int bgindex, unsigned int fgindex) {
+// fills a cell with bg and then fg through a mask from drawmask_xftchar
+Display *display=xc->x->display;
+Picture fill;
+
+if (!(fill=xc->render.fills[fgindex])) {
+	if (!(fill=XRenderCreateSolidFill(display,&xc->colors[fgindex].xftc.color))) GOTOERROR;
+	xc->render.fills[fgindex]=fill;
+}
+(void)XRenderFillRectangle(display,PictOpSrc,dest,&xc->colors[bgindex].xftc.color,x,y,xc->width,xc->height);
+(void)XRenderComposite(display,PictOpOver,fill,mask,dest,0,0,mx,my,x,y,xc->width,xc->height);
+return 0;
+error:
+	return -1;
 }
 
 #if 0
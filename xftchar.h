@@ -32,6 +32,12 @@ struct xftchar {
 	XftFont *font;
 	XftDraw *draw;
 	Pixmap pixmap;
+	struct {
+		unsigned int isavailable:1; // server has RENDER with A8
+		XRenderPictFormat *a8,*visual;
+		XftDraw *maskdraw; // alpha only, draws into A8 pixmaps
+		Picture fills[16]; // solid colors, made on demand
+	} render;
 //	unsigned char *data;
 	int isotherpixmap:1;
 };
@@ -42,7 +48,11 @@ int changefont_xftchar(struct xftchar *xc, char *fontname);
 int resize_xftchar(struct xftchar *xc, unsigned int width, unsigned int height);
 void setparams_xftchar(struct xftchar *xc, int font0shift, int font0line, int fontulline, int fontullines);
 int setcolor_xftchar(struct xftchar *xc, unsigned int index, unsigned short red, unsigned short green, unsigned short blue);
-void drawchar2_xftchar(Pixmap dest, struct xftchar *xc, unsigned int ucs4, unsigned int bgindex, unsigned int fgindex, int isunderline);
+void drawchar2_xftchar(Pixmap dest, int x, int y, struct xftchar *xc, unsigned int ucs4, unsigned int bgindex, unsigned int fgindex,
+		int isunderline);
+int drawmask_xftchar(Pixmap mask, int x, int y, struct xftchar *xc, unsigned int ucs4, int isunderline);
+int composite_xftchar(Picture dest, int x, int y, struct xftchar *xc, Picture mask, int mx, int my,
+		unsigned int bgindex, unsigned int fgindex);
 
 struct queryfont_xftchar {
 	int ismatch;